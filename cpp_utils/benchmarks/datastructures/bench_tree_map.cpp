@@ -0,0 +1,336 @@
+#include "cpp_utils/datastructures/LinearTreeMap.h"
+#include "cpp_utils/datastructures/TreeMap.h"
+#include "tree_shapes.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <random>
+#include <ranges>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/* TreeMap and LinearTreeMap counterparts of benchmarks in bench_trees.cpp.
+ * Keys are string representations of node insertion indexes. */
+
+namespace {
+
+constexpr int kMoves{100};
+/* See bench_trees.cpp. */
+constexpr int kDestroyIterations{10};
+
+using TreeMap = ds::TreeMap<std::string, int>;
+/* Baseline for key lookups through the default FlatHashMap registry. */
+using StdRegistryTreeMap =
+    ds::TreeMap<std::string,
+                int,
+                std::allocator<std::pair<const std::string, int>>,
+                std::unordered_map>;
+using LinearTreeMap = ds::LinearTreeMap<std::string, int>;
+
+template <typename TreeMapType>
+auto build(const bench::Shape& shape) -> TreeMapType
+{
+    TreeMapType tree;
+    for (int64_t i{0}; const auto parent : shape.parents) {
+        tree.addChild(bench::key_of(i),
+                      static_cast<int>(i),
+                      parent == -1 ? std::nullopt
+                                   : std::optional{bench::key_of(parent)});
+        ++i;
+    }
+    return tree;
+}
+
+template <typename TreeMapType>
+auto discard(benchmark::State& state, TreeMapType& tree) -> void
+{
+    state.PauseTiming();
+    {
+        auto garbage = std::move(tree);
+    }
+    state.ResumeTiming();
+}
+
+template <typename TreeMapType, typename ShapeT>
+auto BM_insert(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    for (auto _ : state) {
+        auto tree = build<TreeMapType>(shape);
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeMapType, typename ShapeT>
+auto BM_erase(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto top = bench::key_of(0);
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto tree = build<TreeMapType>(shape);
+        state.ResumeTiming();
+
+        for (auto n = std::ranges::ssize(tree.children(top)); n > 0; --n) {
+            tree.removeNodes(top, n - 1, 1);
+        }
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeMapType, typename ShapeT>
+auto BM_move_nodes(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    auto tree = build<TreeMapType>(shape);
+    const std::optional<std::string> top{bench::key_of(0)};
+    const auto child_count = std::ranges::ssize(tree.children(*top));
+
+    for (auto _ : state) {
+        for (int i = 0; i < kMoves; ++i) {
+            tree.moveNodes(top, 0, 1, std::nullopt, 1);
+            tree.moveNodes(std::nullopt, 1, 1, top, child_count - 1);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * 2 * kMoves);
+}
+
+template <typename TreeMapType, typename ShapeT>
+auto BM_preorder_iteration(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeMapType>(shape);
+    for (auto _ : state) {
+        int64_t sum{0};
+        tree.dfs(
+            [&sum](const auto& /* key */, int payload) { sum += payload; });
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeMapType, typename ShapeT>
+auto BM_flatten(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeMapType>(shape);
+    for (auto _ : state) {
+        auto flattened = tree.flatten();
+        benchmark::DoNotOptimize(flattened);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeMapType, typename ShapeT>
+auto BM_unflatten(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto flattened = build<TreeMapType>(shape).flatten();
+    for (auto _ : state) {
+        auto tree = TreeMapType::unflatten(flattened);
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeMapType, typename ShapeT>
+auto BM_mapped(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeMapType>(shape);
+    for (auto _ : state) {
+        auto mapped = tree.mapped([](int payload) { return payload + 1; });
+        benchmark::DoNotOptimize(mapped);
+        discard(state, mapped);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeMapType, typename ShapeT>
+auto BM_destroy(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto tree = std::optional{build<TreeMapType>(shape)};
+        state.ResumeTiming();
+
+        tree.reset();
+        benchmark::DoNotOptimize(tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+/* Removes the first half of the top-level node children with all their
+ * subtrees in one call. */
+template <typename TreeMapType, typename ShapeT>
+auto BM_remove_subtrees(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto top = bench::key_of(0);
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto tree = build<TreeMapType>(shape);
+        const auto half = std::ranges::ssize(tree.children(top)) / 2;
+        state.ResumeTiming();
+
+        tree.removeNodes(top, 0, half);
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeMapType, typename ShapeT>
+auto BM_copy(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeMapType>(shape);
+    for (auto _ : state) {
+        TreeMapType copy{tree};
+        benchmark::DoNotOptimize(copy);
+        discard(state, copy);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeMapType, typename ShapeT>
+auto BM_key_lookup(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeMapType>(shape);
+    std::vector<std::string> keys;
+    keys.reserve(static_cast<size_t>(shape.size()));
+    for (int64_t i{0}; i < shape.size(); ++i) {
+        keys.push_back(bench::key_of(i));
+    }
+    std::ranges::shuffle(keys, std::mt19937{42});
+    for (auto _ : state) {
+        for (const auto& key : keys) {
+            benchmark::DoNotOptimize(tree.payload(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+/* Visits rows of every node the way item view does when it is scrolled
+ * through: row by row, asking for position of each found child. */
+template <typename TreeMapType, typename ShapeT>
+auto BM_item_model_rows(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeMapType>(shape);
+    std::vector<std::pair<std::string, size_t>> nodes;
+    for (int64_t i{0}; i < shape.size(); ++i) {
+        auto key = bench::key_of(i);
+        const auto count =
+            static_cast<size_t>(std::ranges::distance(tree.children(key)));
+        nodes.emplace_back(std::move(key), count);
+    }
+    for (auto _ : state) {
+        for (const auto& [key, count] : nodes) {
+            for (size_t row{0}; row < count; ++row) {
+                benchmark::DoNotOptimize(tree.nthChild(key, row));
+            }
+        }
+        for (const auto& [key, count] : nodes) {
+            benchmark::DoNotOptimize(tree.positionInChildren(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 2 * shape.size());
+}
+
+/* Insert nodes of the shape, each before the first child of its parent,
+ * either one call at a time or as a single batch. */
+template <bool Batched, typename ShapeT>
+auto BM_insert_at_front(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    for (auto _ : state) {
+        TreeMap tree;
+        TreeMap::Batch batch;
+        for (int64_t i{0}; const auto parent : shape.parents) {
+            auto parentKey = parent == -1
+                                 ? std::nullopt
+                                 : std::optional{bench::key_of(parent)};
+            if constexpr (Batched) {
+                batch.addChild(bench::key_of(i),
+                               static_cast<int>(i),
+                               std::move(parentKey),
+                               0);
+            }
+            else {
+                tree.addChild(
+                    bench::key_of(i), static_cast<int>(i), parentKey, 0);
+            }
+            ++i;
+        }
+        if constexpr (Batched) {
+            benchmark::DoNotOptimize(tree.apply(std::move(batch)));
+        }
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+} // namespace
+
+#define TREE_MAP_BENCHMARKS(TreeMapType, ShapeT)                               \
+    BENCHMARK_TEMPLATE(BM_insert, TreeMapType, ShapeT)                         \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_erase, TreeMapType, ShapeT)                          \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_move_nodes, TreeMapType, ShapeT)                     \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_preorder_iteration, TreeMapType, ShapeT)             \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_flatten, TreeMapType, ShapeT)                        \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_unflatten, TreeMapType, ShapeT)                      \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_mapped, TreeMapType, ShapeT)                         \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_destroy, TreeMapType, ShapeT)                        \
+        ->Apply(bench::sizes<ShapeT>)                                          \
+        ->Iterations(kDestroyIterations);                                      \
+    BENCHMARK_TEMPLATE(BM_remove_subtrees, TreeMapType, ShapeT)                \
+        ->Apply(bench::sizes<ShapeT>)                                          \
+        ->Iterations(kDestroyIterations);                                      \
+    BENCHMARK_TEMPLATE(BM_copy, TreeMapType, ShapeT)                           \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_item_model_rows, TreeMapType, ShapeT)                \
+        ->Apply(bench::sizes<ShapeT>)
+
+TREE_MAP_BENCHMARKS(TreeMap, bench::Wide);
+TREE_MAP_BENCHMARKS(TreeMap, bench::Deep);
+TREE_MAP_BENCHMARKS(TreeMap, bench::Random);
+TREE_MAP_BENCHMARKS(LinearTreeMap, bench::Wide);
+TREE_MAP_BENCHMARKS(LinearTreeMap, bench::Deep);
+TREE_MAP_BENCHMARKS(LinearTreeMap, bench::Random);
+
+// Inserting nodes one by one is quadratic here, sizes are capped accordingly
+BENCHMARK_TEMPLATE(BM_insert_at_front, false, bench::Wide)
+    ->RangeMultiplier(10)
+    ->Range(1'000, 10'000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_insert_at_front, true, bench::Wide)
+    ->RangeMultiplier(10)
+    ->Range(1'000, 100'000)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_key_lookup, TreeMap, bench::Random)
+    ->Apply(bench::sizes<bench::Random>);
+BENCHMARK_TEMPLATE(BM_key_lookup, StdRegistryTreeMap, bench::Random)
+    ->Apply(bench::sizes<bench::Random>);
+BENCHMARK_TEMPLATE(BM_key_lookup, LinearTreeMap, bench::Random)
+    ->Apply(bench::sizes<bench::Random>);
@@ -0,0 +1,469 @@
+#include "cpp_utils/datastructures/ConcurrentTree.h"
+#include "cpp_utils/datastructures/LinearTree.h"
+#include "cpp_utils/datastructures/PersistentTree.h"
+#include "cpp_utils/datastructures/Tree.h"
+#include "tree_shapes.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <ranges>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+/* Benchmarks for containers sharing iterator-based tree API (Tree, ArenaTree
+ * and LinearTree). Each benchmark is instantiated for every container and every
+ * shape from tree_shapes.h, so results can be compared side by side. */
+
+namespace {
+
+constexpr int kMoves{100};
+/* Fixed, as rebuilding tree between iterations dominates run time when
+ * destruction itself is cheap. */
+constexpr int kDestroyIterations{10};
+
+template <typename TreeType> auto build(const bench::Shape& shape) -> TreeType
+{
+    TreeType tree;
+    std::vector<typename TreeType::iterator> nodes;
+    nodes.reserve(shape.parents.size());
+    for (int payload{0}; const auto parent : shape.parents) {
+        nodes.push_back(tree.insert(
+            parent == -1 ? tree.end() : nodes[static_cast<size_t>(parent)],
+            payload++));
+    }
+    return tree;
+}
+
+/* Destroys tree outside of measured region. */
+template <typename TreeType>
+auto discard(benchmark::State& state, TreeType& tree) -> void
+{
+    state.PauseTiming();
+    {
+        auto garbage = std::move(tree);
+    }
+    state.ResumeTiming();
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_insert(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    for (auto _ : state) {
+        auto tree = build<TreeType>(shape);
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+/* Erases children of the top-level node one by one starting from the last
+ * one. */
+template <typename TreeType, typename ShapeT>
+auto BM_erase(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto tree = build<TreeType>(shape);
+        auto top = tree.begin();
+        state.ResumeTiming();
+
+        for (auto n = std::ranges::ssize(tree.children(top)); n > 0; --n) {
+            auto children = tree.children_iterators(top);
+            tree.erase(*std::ranges::prev(std::ranges::end(children)));
+        }
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+/* Moves first child of the top-level node to the top level and then back to
+ * the end of its former parent children. */
+template <typename TreeType, typename ShapeT>
+auto BM_move_nodes(benchmark::State& state) -> void
+{
+    using ds::Count;
+    using ds::DestinationPosition;
+    using ds::SourcePosition;
+
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    auto tree = build<TreeType>(shape);
+    auto top = tree.begin();
+    const auto child_count = std::ranges::ssize(tree.children(top));
+
+    for (auto _ : state) {
+        for (int i = 0; i < kMoves; ++i) {
+            tree.move_nodes(top,
+                            SourcePosition{0},
+                            Count{1},
+                            tree.end(),
+                            DestinationPosition{1});
+            tree.move_nodes(tree.end(),
+                            SourcePosition{1},
+                            Count{1},
+                            top,
+                            DestinationPosition{child_count - 1});
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * 2 * kMoves);
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_preorder_iteration(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeType>(shape);
+    for (auto _ : state) {
+        int64_t sum{0};
+        for (const auto& payload : tree) {
+            sum += payload;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_flatten(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeType>(shape);
+    for (auto _ : state) {
+        auto flattened = tree.flatten();
+        benchmark::DoNotOptimize(flattened);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_from_flattened(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    // Not const, as LinearTree::from_flattened moves payloads out of the range
+    auto flattened = build<TreeType>(shape).flatten();
+    for (auto _ : state) {
+        auto tree = TreeType::from_flattened(flattened);
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+/* Parent positions of shape nodes relisted in preorder, as expected by bulk
+ * builders. Relative order of siblings is the same as in build(). */
+auto preorder_parents(const bench::Shape& shape) -> std::vector<int64_t>
+{
+    // Node i is at position i + 1, position 0 stands for the fake root
+    std::vector<std::vector<int64_t>> children(shape.parents.size() + 1);
+    for (int64_t node{0}; const auto parent : shape.parents) {
+        children[static_cast<size_t>(parent + 1)].push_back(node++);
+    }
+
+    std::vector<int64_t> parents;
+    std::vector<int64_t> listed_as(shape.parents.size());
+    parents.reserve(shape.parents.size());
+    std::vector<int64_t> frontier{children[0].rbegin(), children[0].rend()};
+    while (not frontier.empty()) {
+        const auto node = frontier.back();
+        frontier.pop_back();
+        const auto parent = shape.parents[static_cast<size_t>(node)];
+        listed_as[static_cast<size_t>(node)] = std::ssize(parents);
+        parents.push_back(
+            parent == -1 ? -1 : listed_as[static_cast<size_t>(parent)]);
+        const auto& own = children[static_cast<size_t>(node + 1)];
+        frontier.insert(frontier.end(), own.rbegin(), own.rend());
+    }
+    return parents;
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_from_parent_indexes(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto parents = preorder_parents(shape);
+    std::vector<int> payloads(parents.size());
+    std::iota(payloads.begin(), payloads.end(), 0);
+    for (auto _ : state) {
+        auto tree = TreeType::from_parent_indexes(parents, payloads);
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_from_image(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    std::stringstream ss;
+    build<TreeType>(shape).write_image(ss);
+    const auto bytes = ss.str();
+    std::vector<std::byte> image(bytes.size());
+    std::memcpy(image.data(), bytes.data(), bytes.size());
+    for (auto _ : state) {
+        auto tree = TreeType::from_image(image);
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_transform(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeType>(shape);
+    for (auto _ : state) {
+        auto mapped = tree.transform([](int payload) { return payload + 1; });
+        benchmark::DoNotOptimize(mapped);
+        discard(state, mapped);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+/* Filters tree with predicate dropping every third node with its subtree,
+ * sequentially or with parallel overload. */
+template <typename TreeType, typename ShapeT, bool Parallel>
+auto BM_filter(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeType>(shape);
+    auto pred = [](int payload) { return payload % 3 != 2; };
+    for (auto _ : state) {
+        auto filtered = [&]() {
+            if constexpr (Parallel) {
+                return ds::filter(ds::Parallel{}, tree, pred);
+            }
+            else {
+                return ds::filter(tree, pred);
+            }
+        }();
+        benchmark::DoNotOptimize(filtered);
+        discard(state, filtered);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeType, typename ShapeT, bool Parallel>
+auto BM_find_if(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeType>(shape);
+    auto pred = [](int payload) { return payload == -1; };
+    for (auto _ : state) {
+        if constexpr (Parallel) {
+            benchmark::DoNotOptimize(
+                ds::find_if(ds::Parallel{}, tree, tree.cend(), pred));
+        }
+        else {
+            benchmark::DoNotOptimize(ds::find_if(tree, tree.cend(), pred));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_destroy(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto tree = std::optional{build<TreeType>(shape)};
+        state.ResumeTiming();
+
+        tree.reset();
+        benchmark::DoNotOptimize(tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_copy(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeType>(shape);
+    for (auto _ : state) {
+        TreeType copy{tree};
+        benchmark::DoNotOptimize(copy);
+        discard(state, copy);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+using Tree = ds::Tree<int>;
+using LinearTree = ds::LinearTree<int>;
+using ArenaTree = ds::ArenaTree<int>;
+using PersistentTree = ds::PersistentTree<int>;
+
+constexpr int kSnapshotFanout{8};
+
+/* Builds complete tree with kSnapshotFanout children per node, where node i
+ * is the parent of nodes i * kSnapshotFanout + 1 and on. Nodes are inserted
+ * in preorder only ever using iterator returned by the last insertion, since
+ * PersistentTree iterators do not survive modifications. */
+template <typename TreeType> auto build_balanced(int64_t n) -> TreeType
+{
+    TreeType tree;
+    auto current = tree.end();
+    // Pending nodes along with depth of their parent
+    std::vector<std::pair<int64_t, int64_t>> pending{{0, -1}};
+    int64_t current_depth{-1};
+    while (not pending.empty()) {
+        const auto [index, parent_depth] = pending.back();
+        pending.pop_back();
+        for (; current_depth > parent_depth; --current_depth) {
+            current = tree.parent(current);
+        }
+        current = tree.insert(current, static_cast<int>(index));
+        ++current_depth;
+        for (auto child = std::min(index * kSnapshotFanout + kSnapshotFanout,
+                                   n - 1);
+             child > index * kSnapshotFanout;
+             --child) {
+            pending.emplace_back(child, current_depth);
+        }
+    }
+    return tree;
+}
+
+/* Keeps snapshot of the tree before every insertion, as i.e. undo history
+ * would. */
+template <typename TreeType>
+auto BM_snapshot_and_insert(benchmark::State& state) -> void
+{
+    auto tree = build_balanced<TreeType>(state.range(0));
+    for (auto _ : state) {
+        TreeType snapshot{tree};
+        auto inserted = tree.insert(std::prev(tree.end()), 0);
+        benchmark::DoNotOptimize(snapshot);
+        discard(state, snapshot);
+        state.PauseTiming();
+        tree.erase(inserted);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/* Reads tree with global mutex, as is done without ConcurrentTree. Each read
+ * looks up children of the top-level node. */
+auto BM_locked_read(benchmark::State& state) -> void
+{
+    static std::mutex mutex;
+    static const auto tree = build<LinearTree>(
+        bench::shape_of_size<bench::Random>(1 << 16));
+    for (auto _ : state) {
+        std::lock_guard lock{mutex};
+        benchmark::DoNotOptimize(
+            std::ranges::ssize(tree.children(tree.begin())));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+auto BM_concurrent_read(benchmark::State& state) -> void
+{
+    static const ds::ConcurrentTree<LinearTree> tree{
+        build<LinearTree>(bench::shape_of_size<bench::Random>(1 << 16))};
+    ds::ConcurrentTree<LinearTree>::Reader reader{tree};
+    for (auto _ : state) {
+        const auto& snapshot = reader.get();
+        benchmark::DoNotOptimize(
+            std::ranges::ssize(snapshot.children(snapshot.begin())));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/* Preorder iteration over LinearTree which had every subtree of the
+ * top-level node taken out and inserted back. Reinsertion fills released
+ * slots breadth-first, so storage order no longer follows preorder unless
+ * tree is compacted afterwards. */
+template <typename ShapeT, bool Compact>
+auto BM_preorder_iteration_after_churn(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    auto tree = build<LinearTree>(shape);
+    auto top = tree.begin();
+    for (auto n = std::ranges::ssize(tree.children(top)); n > 0; --n) {
+        auto subtree = tree.take_subtree(*tree.children_iterators(top).begin());
+        tree.insert_subtree(top, subtree, std::nullopt);
+    }
+    if constexpr (Compact) {
+        tree.compact();
+    }
+
+    for (auto _ : state) {
+        int64_t sum{0};
+        for (const auto& payload : std::as_const(tree)) {
+            sum += payload;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+} // namespace
+
+#define TREE_BENCHMARKS(TreeType, ShapeT)                                      \
+    BENCHMARK_TEMPLATE(BM_insert, TreeType, ShapeT)                            \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_erase, TreeType, ShapeT)                             \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_move_nodes, TreeType, ShapeT)                        \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_preorder_iteration, TreeType, ShapeT)                \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_flatten, TreeType, ShapeT)                           \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_from_flattened, TreeType, ShapeT)                    \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_from_parent_indexes, TreeType, ShapeT)               \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_from_image, TreeType, ShapeT)                        \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_transform, TreeType, ShapeT)                         \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_destroy, TreeType, ShapeT)                           \
+        ->Apply(bench::sizes<ShapeT>)                                          \
+        ->Iterations(kDestroyIterations);                                      \
+    BENCHMARK_TEMPLATE(BM_copy, TreeType, ShapeT)->Apply(bench::sizes<ShapeT>)
+
+TREE_BENCHMARKS(Tree, bench::Wide);
+TREE_BENCHMARKS(Tree, bench::Deep);
+TREE_BENCHMARKS(Tree, bench::Random);
+TREE_BENCHMARKS(LinearTree, bench::Wide);
+TREE_BENCHMARKS(LinearTree, bench::Deep);
+TREE_BENCHMARKS(LinearTree, bench::Random);
+TREE_BENCHMARKS(ArenaTree, bench::Wide);
+TREE_BENCHMARKS(ArenaTree, bench::Deep);
+TREE_BENCHMARKS(ArenaTree, bench::Random);
+
+BENCHMARK_TEMPLATE(BM_preorder_iteration_after_churn, bench::Random, false)
+    ->Apply(bench::sizes<bench::Random>);
+BENCHMARK_TEMPLATE(BM_preorder_iteration_after_churn, bench::Random, true)
+    ->Apply(bench::sizes<bench::Random>);
+
+BENCHMARK_TEMPLATE(BM_snapshot_and_insert, Tree)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_snapshot_and_insert, PersistentTree)
+    ->Range(1 << 10, 1 << 20);
+
+#define PARALLEL_ALGORITHM_BENCHMARKS(TreeType, ShapeT)                        \
+    BENCHMARK_TEMPLATE(BM_filter, TreeType, ShapeT, false)                     \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_filter, TreeType, ShapeT, true)                      \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_find_if, TreeType, ShapeT, false)                    \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_find_if, TreeType, ShapeT, true)                     \
+        ->Apply(bench::sizes<ShapeT>)
+
+PARALLEL_ALGORITHM_BENCHMARKS(Tree, bench::Random);
+PARALLEL_ALGORITHM_BENCHMARKS(LinearTree, bench::Random);
+
+BENCHMARK(BM_locked_read)->ThreadRange(1, 8);
+BENCHMARK(BM_concurrent_read)->ThreadRange(1, 8);
@@ -0,0 +1,103 @@
+#include "cpp_utils/datastructures/UniqueElementsTree.h"
+#include "tree_shapes.h"
+#include <benchmark/benchmark.h>
+#include <optional>
+#include <utility>
+
+/* UniqueElementsTree counterparts of benchmarks in bench_trees.cpp.
+ *
+ * UniqueElementsTree has neither erase, move, transform nor copy, so only
+ * insertion, iteration and (un)flattening are measured. */
+
+namespace {
+
+using UniqueElementsTree = ds::UniqueElementsTree<int64_t>;
+
+template <typename TreeType> auto build(const bench::Shape& shape) -> TreeType
+{
+    TreeType tree;
+    for (int64_t i{0}; const auto parent : shape.parents) {
+        tree.add_child(i++,
+                       parent == -1 ? std::nullopt
+                                    : typename TreeType::maybe_key{parent});
+    }
+    return tree;
+}
+
+template <typename TreeType>
+auto discard(benchmark::State& state, TreeType& tree) -> void
+{
+    state.PauseTiming();
+    {
+        auto garbage = std::move(tree);
+    }
+    state.ResumeTiming();
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_insert(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    for (auto _ : state) {
+        auto tree = build<TreeType>(shape);
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_preorder_iteration(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeType>(shape);
+    for (auto _ : state) {
+        int64_t sum{0};
+        for (auto it = tree.cbegin_dfs(); it != tree.cend_dfs(); ++it) {
+            sum += *it;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_flatten(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto tree = build<TreeType>(shape);
+    for (auto _ : state) {
+        auto flattened = tree.flatten();
+        benchmark::DoNotOptimize(flattened);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+template <typename TreeType, typename ShapeT>
+auto BM_unflatten(benchmark::State& state) -> void
+{
+    const auto& shape = bench::shape_of_size<ShapeT>(state.range(0));
+    const auto flattened = build<TreeType>(shape).flatten();
+    for (auto _ : state) {
+        auto tree = TreeType::unflatten(flattened);
+        benchmark::DoNotOptimize(tree);
+        discard(state, tree);
+    }
+    state.SetItemsProcessed(state.iterations() * shape.size());
+}
+
+} // namespace
+
+#define UNIQUE_ELEMENTS_TREE_BENCHMARKS(ShapeT)                                \
+    BENCHMARK_TEMPLATE(BM_insert, UniqueElementsTree, ShapeT)                  \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_preorder_iteration, UniqueElementsTree, ShapeT)      \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_flatten, UniqueElementsTree, ShapeT)                 \
+        ->Apply(bench::sizes<ShapeT>);                                         \
+    BENCHMARK_TEMPLATE(BM_unflatten, UniqueElementsTree, ShapeT)               \
+        ->Apply(bench::sizes<ShapeT>)
+
+UNIQUE_ELEMENTS_TREE_BENCHMARKS(bench::Wide);
+UNIQUE_ELEMENTS_TREE_BENCHMARKS(bench::Deep);
+UNIQUE_ELEMENTS_TREE_BENCHMARKS(bench::Random);
@@ -0,0 +1,111 @@
+#ifndef TREE_SHAPES_H_Q4WZ7KDN
+#define TREE_SHAPES_H_Q4WZ7KDN
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+/* Tree shape given as a list of parent indexes in insertion order.
+ *
+ * parents[i] is the index of the parent of i-th node (always less than i) or
+ * -1 if node is a top-level node. Shapes are generated once per size and then
+ * fed to every container, so that all containers are measured on exactly the
+ * same trees.
+ */
+struct Shape {
+    std::vector<int64_t> parents;
+
+    auto size() const -> int64_t
+    {
+        return static_cast<int64_t>(parents.size());
+    }
+};
+
+/* Single top-level node with all other nodes as its direct children. */
+struct Wide {
+    static constexpr int64_t max_nodes{10'000'000};
+
+    static auto make(int64_t n) -> Shape
+    {
+        Shape shape;
+        shape.parents.reserve(static_cast<size_t>(n));
+        shape.parents.push_back(-1);
+        for (int64_t i = 1; i < n; ++i) {
+            shape.parents.push_back(0);
+        }
+        return shape;
+    }
+};
+
+/* Single chain, every node is the only child of the previous one.
+ *
+ * Some containers still have O(depth) recursion and O(N * depth) teardown, so
+ * chains are capped well below the other shapes to keep the suite runnable.
+ */
+struct Deep {
+    static constexpr int64_t max_nodes{10'000};
+
+    static auto make(int64_t n) -> Shape
+    {
+        Shape shape;
+        shape.parents.reserve(static_cast<size_t>(n));
+        for (int64_t i = 0; i < n; ++i) {
+            shape.parents.push_back(i - 1);
+        }
+        return shape;
+    }
+};
+
+/* Random recursive tree: every node picks its parent uniformly among nodes
+ * created before it. Expected depth is logarithmic, fanout is skewed towards
+ * the older nodes. Seed is fixed so that runs are comparable.
+ */
+struct Random {
+    static constexpr int64_t max_nodes{10'000'000};
+
+    static auto make(int64_t n) -> Shape
+    {
+        std::mt19937_64 gen{42};
+        Shape shape;
+        shape.parents.reserve(static_cast<size_t>(n));
+        shape.parents.push_back(-1);
+        for (int64_t i = 1; i < n; ++i) {
+            std::uniform_int_distribution<int64_t> dist{0, i - 1};
+            shape.parents.push_back(dist(gen));
+        }
+        return shape;
+    }
+};
+
+/* Shapes are expensive to generate for large sizes, so they are cached per
+ * size for the lifetime of the benchmark binary. */
+template <typename ShapeT> auto shape_of_size(int64_t n) -> const Shape&
+{
+    static std::map<int64_t, Shape> cache;
+    if (auto it = cache.find(n); it != cache.end()) {
+        return it->second;
+    }
+    return cache.emplace(n, ShapeT::make(n)).first->second;
+}
+
+template <typename ShapeT> auto sizes(benchmark::internal::Benchmark* b) -> void
+{
+    for (int64_t n = 1'000; n <= ShapeT::max_nodes; n *= 10) {
+        b->Arg(n);
+    }
+    b->Unit(benchmark::kMillisecond);
+}
+
+inline auto key_of(int64_t index) -> std::string
+{
+    return std::to_string(index);
+}
+
+} // namespace bench
+
+#endif /* end of include guard: TREE_SHAPES_H_Q4WZ7KDN */
@@ -0,0 +1,122 @@
+#ifndef CONCURRENTTREE_H_T6MWR3JE
+#define CONCURRENTTREE_H_T6MWR3JE
+
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace ds {
+
+/* Tree for read-mostly workloads, where many threads read the tree while
+ * single writer modifies it from time to time.
+ *
+ * Readers never see the tree being modified, they work with immutable
+ * snapshots instead. Snapshot is an ordinary const tree, so that all tree
+ * algorithms (for_each, find_if, etc.) work on it as is. Writer applies a
+ * batch of modifications to a private copy of the latest version and then
+ * publishes the copy as a new version. Versions are reference counted, old
+ * version is destroyed once the last reader holding it lets it go.
+ *
+ * Each published version costs a copy of the whole tree, so modifications
+ * should be batched in as few update calls as possible.
+ *
+ * Taking a snapshot with snapshot() touches reference count shared by all
+ * readers of the version. Readers that take snapshots in a tight loop should
+ * use Reader instead, which only goes for a new snapshot when a new version
+ * is published and otherwise reads nothing but version counter.
+ *
+ * Meant to be used with LinearTree, as it is the cheapest one to copy and to
+ * read, but works with any copyable tree, i.e. ConcurrentTree<Tree<T>>. */
+template <typename TreeType> class ConcurrentTree {
+public:
+    using tree_type = TreeType;
+    using snapshot_type = std::shared_ptr<const TreeType>;
+
+    /* Per-thread handle caching the latest snapshot. Must not be shared
+     * between threads. Cached snapshot is kept alive until the next call to
+     * get() after a new version is published or until Reader is
+     * destroyed. */
+    class Reader {
+    public:
+        explicit Reader(const ConcurrentTree& source_)
+            : source{&source_}
+            , version{source_.version.load(std::memory_order_acquire)}
+            , cached{source_.snapshot()}
+        {
+        }
+
+        /* Return the latest published version. */
+        auto get() -> const TreeType&
+        {
+            const auto latest = source->version.load(std::memory_order_acquire);
+            if (latest != version) {
+                cached = source->snapshot();
+                version = latest;
+            }
+            return *cached;
+        }
+
+    private:
+        const ConcurrentTree* source;
+        uint64_t version;
+        snapshot_type cached;
+    };
+
+    ConcurrentTree()
+        : ConcurrentTree{TreeType{}}
+    {
+    }
+
+    explicit ConcurrentTree(TreeType tree)
+        : current{std::make_shared<const TreeType>(std::move(tree))}
+    {
+    }
+
+    ConcurrentTree(const ConcurrentTree&) = delete;
+    auto operator=(const ConcurrentTree&) -> ConcurrentTree& = delete;
+    ConcurrentTree(ConcurrentTree&&) = delete;
+    auto operator=(ConcurrentTree&&) -> ConcurrentTree& = delete;
+
+    ~ConcurrentTree() = default;
+
+    /* Return the latest published version. Returned snapshot stays valid and
+     * unchanged regardless of subsequent updates. */
+    auto snapshot() const -> snapshot_type
+    {
+        return current.load(std::memory_order_acquire);
+    }
+
+    /* Apply modifications to a copy of the latest version and publish it.
+     *
+     * modifications is invoked with mutable reference to the copy. If it
+     * throws, nothing is published. Concurrent updates are serialized.
+     * Return published version. */
+    template <std::invocable<TreeType&> Modifications>
+    auto update(Modifications modifications) -> snapshot_type
+    {
+        std::lock_guard lock{writer_mutex};
+        // Only writers store versions and they are serialized
+        const auto latest = current.load(std::memory_order_relaxed);
+        auto next = std::make_shared<TreeType>(*latest);
+        std::invoke(modifications, *next);
+        snapshot_type published{std::move(next)};
+        current.store(published, std::memory_order_release);
+        version.fetch_add(1, std::memory_order_release);
+        return published;
+    }
+
+private:
+    std::atomic<snapshot_type> current;
+    /* Incremented after each publication, so that readers can tell if their
+     * snapshot is outdated without touching the snapshot itself. */
+    std::atomic<uint64_t> version{0};
+    std::mutex writer_mutex;
+};
+
+} // namespace ds
+
+#endif /* end of include guard: CONCURRENTTREE_H_T6MWR3JE */
@@ -0,0 +1,537 @@
+#ifndef FLATHASHMAP_H_M2TQ8VXE
+#define FLATHASHMAP_H_M2TQ8VXE
+
+#include "cpp_utils/datastructures/TreeCommon.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) and not defined(CPP_UTILS_PORTABLE_HASH_GROUPS)
+#include <emmintrin.h>
+#define CPP_UTILS_SSE2_HASH_GROUPS
+#endif
+
+namespace details {
+
+/* Control byte of a slot is either one of these or 7 low bits of the hash of
+ * key stored in the slot. */
+inline constexpr int8_t ctrl_empty{-128};
+inline constexpr int8_t ctrl_deleted{-2};
+
+/* Spread bits of hash, so that both parts of it used by the table (low 7
+ * bits and the rest) are well distributed even for identity hashes such as
+ * std::hash of integers. */
+inline auto mix_hash(size_t hash) -> size_t
+{
+    uint64_t mixed{hash};
+    mixed *= 0x9E3779B97F4A7C15;
+    mixed ^= mixed >> 32;
+    return mixed;
+}
+
+/* Slots of a group matched by some criteria. Each slot is represented by
+ * 1 << Shift bits of which only the highest one might be set. */
+template <int Shift> class GroupMatch {
+public:
+    explicit GroupMatch(uint64_t mask_)
+        : mask{mask_}
+    {
+    }
+
+    explicit operator bool() const { return mask != 0; }
+
+    /* Return index of the first matched slot in the group. */
+    auto lowest() const -> size_t
+    {
+        return static_cast<size_t>(std::countr_zero(mask)) >> Shift;
+    }
+
+    auto drop_lowest() -> void { mask &= mask - 1; }
+
+private:
+    uint64_t mask;
+};
+
+#ifdef CPP_UTILS_SSE2_HASH_GROUPS
+
+/* Control bytes of 16 consecutive slots, matched by a single SSE2
+ * comparison. */
+class CtrlGroup {
+public:
+    static constexpr size_t width{16};
+
+    explicit CtrlGroup(const int8_t* ctrl)
+        : bytes{_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))}
+    {
+    }
+
+    auto match(int8_t h2) const -> GroupMatch<0>
+    {
+        return GroupMatch<0>{static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), bytes)))};
+    }
+
+    auto match_empty() const -> GroupMatch<0> { return match(ctrl_empty); }
+
+    /* Match empty and deleted slots, which are the only negative ones. */
+    auto match_free() const -> GroupMatch<0>
+    {
+        return GroupMatch<0>{static_cast<uint32_t>(_mm_movemask_epi8(bytes))};
+    }
+
+private:
+    __m128i bytes;
+};
+
+#else
+
+/* Control bytes of 8 consecutive slots, matched by bit tricks on a single
+ * word for targets without SSE2. */
+class CtrlGroup {
+public:
+    static constexpr size_t width{8};
+
+    explicit CtrlGroup(const int8_t* ctrl)
+    {
+        std::memcpy(&bytes, ctrl, sizeof(bytes));
+        if constexpr (std::endian::native == std::endian::big) {
+            bytes = std::byteswap(bytes);
+        }
+    }
+
+    /* Might report false positives, which are ruled out by comparing
+     * keys. */
+    auto match(int8_t h2) const -> GroupMatch<3>
+    {
+        const auto diff = bytes ^ (lsbs * static_cast<uint8_t>(h2));
+        return GroupMatch<3>{(diff - lsbs) & ~diff & msbs};
+    }
+
+    auto match_empty() const -> GroupMatch<3>
+    {
+        // Of negative bytes only empty one has bit 1 clear
+        return GroupMatch<3>{bytes & ~(bytes << 6) & msbs};
+    }
+
+    /* Match empty and deleted slots, which are the only negative ones. */
+    auto match_free() const -> GroupMatch<3>
+    {
+        return GroupMatch<3>{bytes & msbs};
+    }
+
+private:
+    static constexpr uint64_t lsbs{0x0101010101010101};
+    static constexpr uint64_t msbs{0x8080808080808080};
+    uint64_t bytes;
+};
+
+#endif
+
+} // namespace details
+
+namespace ds {
+
+/* Hash map with open addressing in the spirit of Swiss tables.
+ *
+ * Entries are kept densely in a vector in insertion order, the table itself
+ * only holds a control byte and an entry index per slot. Lookup hashes the
+ * key once and compares control bytes of a whole group of slots at once
+ * (with SSE2 where available), so most lookups touch a single cache line of
+ * control bytes and a single entry. Iteration is a sequential scan of
+ * entries and its order does not change on rehashing.
+ *
+ * Erasing an entry moves the last entry into its place, which is the only
+ * operation that reorders entries. Iterators are invalidated by any
+ * insertion or erasure.
+ *
+ * Interface is a subset of std::unordered_map sufficient to serve as a key
+ * registry of trees. As with standard containers, lookups accept any type
+ * Hash and KeyEqual accept when both are transparent. Entries can not be modified through iterators, as that
+ * would allow changing keys, use at() or operator[] to modify values. */
+template <typename Key,
+          typename T,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Allocator = std::allocator<std::pair<const Key, T>>>
+class FlatHashMap {
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<Key, T>;
+    using size_type = size_t;
+    using hasher = Hash;
+    using key_equal = KeyEqual;
+    using allocator_type = Allocator;
+
+private:
+    using Entries =
+        std::vector<value_type, details::Rebind<Allocator, value_type>>;
+    using Group = details::CtrlGroup;
+    using Index = uint32_t;
+    using CtrlAllocator = details::Rebind<Allocator, int8_t>;
+    using IndexAllocator = details::Rebind<Allocator, Index>;
+
+public:
+    using iterator = typename Entries::const_iterator;
+    using const_iterator = typename Entries::const_iterator;
+
+    FlatHashMap()
+        : FlatHashMap{Allocator{}}
+    {
+    }
+
+    explicit FlatHashMap(const Allocator& alloc)
+        : entries(typename Entries::allocator_type{alloc})
+        , ctrl(CtrlAllocator{alloc})
+        , slots(IndexAllocator{alloc})
+    {
+    }
+
+    FlatHashMap(const FlatHashMap&) = default;
+
+    FlatHashMap(FlatHashMap&&) noexcept = default;
+
+    FlatHashMap(const FlatHashMap& other, const Allocator& alloc)
+        : entries(other.entries, typename Entries::allocator_type{alloc})
+        , ctrl(other.ctrl, CtrlAllocator{alloc})
+        , slots(other.slots, IndexAllocator{alloc})
+        , tombstones{other.tombstones}
+        , hash{other.hash}
+        , equal{other.equal}
+    {
+    }
+
+    FlatHashMap(FlatHashMap&& other, const Allocator& alloc)
+        : entries(std::move(other.entries),
+                  typename Entries::allocator_type{alloc})
+        , ctrl(std::move(other.ctrl), CtrlAllocator{alloc})
+        , slots(std::move(other.slots), IndexAllocator{alloc})
+        , tombstones{other.tombstones}
+        , hash{std::move(other.hash)}
+        , equal{std::move(other.equal)}
+    {
+    }
+
+    auto operator=(const FlatHashMap&) -> FlatHashMap& = default;
+
+    auto operator=(FlatHashMap&&) -> FlatHashMap& = default;
+
+    auto get_allocator() const -> Allocator
+    {
+        return Allocator(entries.get_allocator());
+    }
+
+    auto begin() const -> const_iterator { return entries.cbegin(); }
+
+    auto end() const -> const_iterator { return entries.cend(); }
+
+    auto cbegin() const -> const_iterator { return entries.cbegin(); }
+
+    auto cend() const -> const_iterator { return entries.cend(); }
+
+    auto size() const -> size_type { return entries.size(); }
+
+    auto empty() const -> bool { return entries.empty(); }
+
+    auto find(const Key& key) const -> const_iterator
+    {
+        return find_entry(key);
+    }
+
+    template <typename K>
+        requires details::TransparentLookup<Hash, KeyEqual>
+    auto find(const K& key) const -> const_iterator
+    {
+        return find_entry(key);
+    }
+
+    auto contains(const Key& key) const -> bool
+    {
+        return find_slot(key, hash_of(key)) != npos;
+    }
+
+    template <typename K>
+        requires details::TransparentLookup<Hash, KeyEqual>
+    auto contains(const K& key) const -> bool
+    {
+        return find_slot(key, hash_of(key)) != npos;
+    }
+
+    auto at(const Key& key) -> T&
+    {
+        return entries[index_of(key)].second;
+    }
+
+    auto at(const Key& key) const -> const T&
+    {
+        return entries[index_of(key)].second;
+    }
+
+    template <typename K>
+        requires details::TransparentLookup<Hash, KeyEqual>
+    auto at(const K& key) -> T&
+    {
+        return entries[index_of(key)].second;
+    }
+
+    template <typename K>
+        requires details::TransparentLookup<Hash, KeyEqual>
+    auto at(const K& key) const -> const T&
+    {
+        return entries[index_of(key)].second;
+    }
+
+    auto operator[](const Key& key) -> T&
+    {
+        const auto it = try_emplace(key).first;
+        return entries[static_cast<size_t>(it - begin())].second;
+    }
+
+    /* Insert entry with value constructed from args unless key is already
+     * present. */
+    template <typename K, typename... Args>
+    auto try_emplace(K&& key, Args&&... args) -> std::pair<iterator, bool>
+    {
+        const auto key_hash = hash_of(key);
+        if (const auto slot = find_slot(key, key_hash); slot != npos) {
+            return {begin() + slots[slot], false};
+        }
+
+        if (entries.size() >= max_entries) {
+            throw std::length_error{"FlatHashMap is too large"};
+        }
+        if ((entries.size() + tombstones + 1) * 8 > capacity() * 7) {
+            rehash(capacity_for(entries.size() + 1));
+        }
+        entries.emplace_back(
+            std::piecewise_construct,
+            std::forward_as_tuple(std::forward<K>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+        place(entries.size() - 1, key_hash);
+        return {std::prev(end()), true};
+    }
+
+    template <typename K, typename V>
+    auto emplace(K&& key, V&& value) -> std::pair<iterator, bool>
+    {
+        return try_emplace(std::forward<K>(key), std::forward<V>(value));
+    }
+
+    auto insert(const value_type& entry) -> std::pair<iterator, bool>
+    {
+        return try_emplace(entry.first, entry.second);
+    }
+
+    auto insert(value_type&& entry) -> std::pair<iterator, bool>
+    {
+        return try_emplace(std::move(entry.first), std::move(entry.second));
+    }
+
+    auto erase(const Key& key) -> size_type { return erase_key(key); }
+
+    template <typename K>
+        requires details::TransparentLookup<Hash, KeyEqual>
+    auto erase(const K& key) -> size_type
+    {
+        return erase_key(key);
+    }
+
+    auto clear() -> void
+    {
+        entries.clear();
+        std::ranges::fill(ctrl, details::ctrl_empty);
+        tombstones = 0;
+    }
+
+    auto reserve(size_type count) -> void
+    {
+        if (const auto wanted = capacity_for(count); wanted > capacity()) {
+            rehash(wanted);
+        }
+        entries.reserve(count);
+    }
+
+    auto swap(FlatHashMap& other) noexcept -> void
+    {
+        using std::swap;
+        swap(entries, other.entries);
+        swap(ctrl, other.ctrl);
+        swap(slots, other.slots);
+        swap(tombstones, other.tombstones);
+        swap(hash, other.hash);
+        swap(equal, other.equal);
+    }
+
+private:
+    static constexpr size_t npos{std::numeric_limits<size_t>::max()};
+    static constexpr size_t max_entries{std::numeric_limits<Index>::max()};
+
+    /* Visits every group of table once, starting from the one hash points
+     * to. Offsets grow by 1, 2, 3... groups, which for power of two number
+     * of groups covers all of them. */
+    struct Probe {
+        Probe(size_t key_hash, size_t mask_)
+            : mask{mask_}
+            , offset{(key_hash >> 7) & mask_}
+        {
+        }
+
+        auto slot(size_t i) const -> size_t { return (offset + i) & mask; }
+
+        auto next() -> void
+        {
+            stride += Group::width;
+            offset = (offset + stride) & mask;
+        }
+
+        size_t mask;
+        size_t offset;
+        size_t stride{0};
+    };
+
+    Entries entries;
+    // Control bytes of first group are repeated past the end of the table,
+    // so that group starting at any slot can be loaded at once
+    std::vector<int8_t, CtrlAllocator> ctrl;
+    std::vector<Index, IndexAllocator> slots;
+    size_t tombstones{0};
+    [[no_unique_address]] Hash hash;
+    [[no_unique_address]] KeyEqual equal;
+
+    template <typename K> auto hash_of(const K& key) const -> size_t
+    {
+        return details::mix_hash(hash(key));
+    }
+
+    static auto h2(size_t key_hash) -> int8_t
+    {
+        return static_cast<int8_t>(key_hash & 0x7f);
+    }
+
+    /* Smallest table keeping load factor at most 7/8 for count entries. */
+    static auto capacity_for(size_t count) -> size_t
+    {
+        return std::bit_ceil(std::max(Group::width, count + count / 7 + 1));
+    }
+
+    auto capacity() const -> size_t { return slots.size(); }
+
+    template <typename K>
+    auto find_slot(const K& key, size_t key_hash) const -> size_t
+    {
+        if (slots.empty()) {
+            return npos;
+        }
+        for (Probe probe{key_hash, capacity() - 1};; probe.next()) {
+            const Group group{ctrl.data() + probe.offset};
+            for (auto match = group.match(h2(key_hash)); match;
+                 match.drop_lowest()) {
+                const auto slot = probe.slot(match.lowest());
+                if (equal(entries[slots[slot]].first, key)) {
+                    return slot;
+                }
+            }
+            if (group.match_empty()) {
+                return npos;
+            }
+        }
+    }
+
+    auto slot_of_index(size_t index) const -> size_t
+    {
+        const auto key_hash = hash_of(entries[index].first);
+        for (Probe probe{key_hash, capacity() - 1};; probe.next()) {
+            const Group group{ctrl.data() + probe.offset};
+            for (auto match = group.match(h2(key_hash)); match;
+                 match.drop_lowest()) {
+                const auto slot = probe.slot(match.lowest());
+                if (slots[slot] == index) {
+                    return slot;
+                }
+            }
+        }
+    }
+
+    template <typename K> auto index_of(const K& key) const -> size_t
+    {
+        const auto slot = find_slot(key, hash_of(key));
+        if (slot == npos) {
+            throw std::out_of_range{"Key is not in the map"};
+        }
+        return slots[slot];
+    }
+
+    template <typename K> auto find_entry(const K& key) const -> const_iterator
+    {
+        const auto slot = find_slot(key, hash_of(key));
+        return slot == npos ? end() : begin() + slots[slot];
+    }
+
+    template <typename K> auto erase_key(const K& key) -> size_type
+    {
+        const auto slot = find_slot(key, hash_of(key));
+        if (slot == npos) {
+            return 0;
+        }
+
+        const auto index = slots[slot];
+        set_ctrl(slot, details::ctrl_deleted);
+        ++tombstones;
+
+        if (const auto last = entries.size() - 1; index != last) {
+            slots[slot_of_index(last)] = index;
+            entries[index] = std::move(entries.back());
+        }
+        entries.pop_back();
+        return 1;
+    }
+
+    auto set_ctrl(size_t slot, int8_t value) -> void
+    {
+        ctrl[slot] = value;
+        if (slot < Group::width) {
+            ctrl[capacity() + slot] = value;
+        }
+    }
+
+    /* Put index of entry into the first free slot on its probe sequence. */
+    auto place(size_t index, size_t key_hash) -> void
+    {
+        for (Probe probe{key_hash, capacity() - 1};; probe.next()) {
+            if (const auto match = Group{ctrl.data() + probe.offset}
+                                       .match_free()) {
+                const auto slot = probe.slot(match.lowest());
+                if (ctrl[slot] == details::ctrl_deleted) {
+                    --tombstones;
+                }
+                set_ctrl(slot, h2(key_hash));
+                slots[slot] = static_cast<Index>(index);
+                return;
+            }
+        }
+    }
+
+    /* Rebuild table with given number of slots, dropping tombstones. Entries
+     * themselves stay in place. */
+    auto rehash(size_t new_capacity) -> void
+    {
+        ctrl.assign(new_capacity + Group::width, details::ctrl_empty);
+        slots.assign(new_capacity, 0);
+        tombstones = 0;
+        for (size_t index{0}; index < entries.size(); ++index) {
+            place(index, hash_of(entries[index].first));
+        }
+    }
+};
+
+} // namespace ds
+
+#endif /* end of include guard: FLATHASHMAP_H_M2TQ8VXE */
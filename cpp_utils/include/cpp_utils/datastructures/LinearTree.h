@@ -3,26 +3,250 @@
 
 #include "cpp_utils/algorithms/alg_ext.h"
 #include "cpp_utils/datastructures/TreeCommon.h"
+#include "cpp_utils/datastructures/TreeImage.h"
 #include <algorithm>
 #include <concepts>
 #include <cstdint>
+#include <deque>
 #include <iterator>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <queue>
 #include <ranges>
+#include <span>
 #include <sstream>
 #include <stack>
+#include <tuple>
 #include <vector>
 
 namespace ds {
 
-template <typename T> class LinearTree {
+/* Tree of T keeping all nodes in flat arrays allocated with Allocator.
+ *
+ * Arrays are ordinary allocator-aware containers, so copies, moves and
+ * assignments follow the standard rules of allocator propagation. */
+template <typename T, typename Allocator = std::allocator<T>>
+class LinearTree {
+    static_assert(
+        std::same_as<typename std::allocator_traits<Allocator>::value_type, T>,
+        "Allocator::value_type must be the same as value type of the tree");
+
 private:
-    struct Node {
-        int64_t parent{-1};
-        T payload{};
-        int64_t pos{0};
-        std::vector<int64_t> children{};
+    using IndexAllocator = details::Rebind<Allocator, int64_t>;
+    using Indexes = std::vector<int64_t, IndexAllocator>;
+    using FreePositions =
+        std::queue<int64_t, std::deque<int64_t, IndexAllocator>>;
+
+    /* Nodes are stored as a structure of arrays: each array is indexed by node
+     * index, index 0 being reserved for the fake root. Traversals that only
+     * need tree structure never pull payloads through the cache.
+     *
+     * Children are kept as doubly linked sibling lists threaded through the
+     * same arrays, so inserting a node costs no allocations beyond amortized
+     * growth of the arrays and copying the tree copies a handful of flat
+     * vectors. Position of each node among its siblings is cached in
+     * positions, which keeps position_in_children O(1); finding n-th child
+     * walks sibling list from the nearer end.
+     *
+     * All nodes are also threaded in preorder into a circular doubly linked
+     * list passing through the fake root. Advancing preorder iterator is then
+     * a single load, and every subtree occupies contiguous segment of the
+     * thread that can be spliced in constant time once its last node is
+     * known. */
+    struct Storage {
+        explicit Storage(const Allocator& alloc)
+            : parents(IndexAllocator{alloc})
+            , first_children(IndexAllocator{alloc})
+            , last_children(IndexAllocator{alloc})
+            , next_siblings(IndexAllocator{alloc})
+            , prev_siblings(IndexAllocator{alloc})
+            , child_counts(IndexAllocator{alloc})
+            , positions(IndexAllocator{alloc})
+            , preorder_next(IndexAllocator{alloc})
+            , preorder_prev(IndexAllocator{alloc})
+            , payloads(alloc)
+        {
+        }
+
+        Storage(const Storage&) = default;
+
+        Storage(Storage&&) noexcept = default;
+
+        Storage(const Storage& other, const Allocator& alloc)
+            : Storage{alloc}
+        {
+            std::apply([this](const auto&... src) { assign(src...); },
+                       other.arrays());
+        }
+
+        Storage(Storage&& other, const Allocator& alloc)
+            : Storage{alloc}
+        {
+            std::apply([this](auto&... src) { assign(std::move(src)...); },
+                       other.arrays());
+        }
+
+        auto operator=(const Storage&) -> Storage& = default;
+
+        auto operator=(Storage&&) -> Storage& = default;
+
+        Indexes parents;
+        Indexes first_children;
+        Indexes last_children;
+        Indexes next_siblings;
+        Indexes prev_siblings;
+        Indexes child_counts;
+        Indexes positions;
+        Indexes preorder_next;
+        Indexes preorder_prev;
+        std::vector<T, Allocator> payloads;
+
+    private:
+        auto arrays() { return std::tie(parents,
+                            first_children,
+                            last_children,
+                            next_siblings,
+                            prev_siblings,
+                            child_counts,
+                            positions,
+                            preorder_next,
+                            preorder_prev,
+                            payloads); }
+
+        auto arrays() const { return std::tie(parents,
+                            first_children,
+                            last_children,
+                            next_siblings,
+                            prev_siblings,
+                            child_counts,
+                            positions,
+                            preorder_next,
+                            preorder_prev,
+                            payloads); }
+
+        /* Assign arrays one by one, each keeping its own allocator. */
+        template <typename... Arrays> auto assign(Arrays&&... src) -> void
+        {
+            std::apply(
+                [&](auto&... dst) { ((dst = std::forward<Arrays>(src)), ...); },
+                arrays());
+        }
+    };
+
+    /* Preorder interval index. entry and exit hold preorder numbers of a node
+     * and of its last descendant, so that node a is an ancestor of node b iff
+     * entry[a] < entry[b] <= exit[a]. order maps preorder numbers back to node
+     * indexes. The fake root gets entry -1 and spans the whole tree.
+     *
+     * Index is built on demand by the first interval query and invalidated
+     * by every structural edit, so a batch of edits costs a single O(N)
+     * rebuild when queries resume, and trees that never ask interval queries
+     * never pay for it. */
+    struct IntervalIndex {
+        explicit IntervalIndex(const Allocator& alloc)
+            : entry(IndexAllocator{alloc})
+            , exit(IndexAllocator{alloc})
+            , order(IndexAllocator{alloc})
+        {
+        }
+
+        Indexes entry;
+        Indexes exit;
+        Indexes order;
+        bool valid{false};
+    };
+
+    /* Bidirectional sized view over indexes of node children. */
+    class ChildIndexes : public std::ranges::view_interface<ChildIndexes> {
+    public:
+        class Iterator {
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using difference_type = std::ptrdiff_t;
+            using value_type = int64_t;
+
+            Iterator() = default;
+
+            Iterator(const Storage* storage_, int64_t current_, int64_t last_)
+                : storage{storage_}
+                , current{current_}
+                , last{last_}
+            {
+            }
+
+            auto operator*() const -> int64_t { return current; }
+
+            auto operator++() -> Iterator&
+            {
+                current = storage->next_siblings[static_cast<size_t>(current)];
+                return *this;
+            }
+
+            auto operator++(int) -> Iterator
+            {
+                auto tmp = *this;
+                ++(*this);
+                return tmp;
+            }
+
+            auto operator--() -> Iterator&
+            {
+                current =
+                    current == -1
+                        ? last
+                        : storage->prev_siblings[static_cast<size_t>(current)];
+                return *this;
+            }
+
+            auto operator--(int) -> Iterator
+            {
+                auto tmp = *this;
+                --(*this);
+                return tmp;
+            }
+
+            friend auto operator==(const Iterator& lhs, const Iterator& rhs)
+                -> bool
+            {
+                return lhs.current == rhs.current;
+            }
+
+        private:
+            const Storage* storage{nullptr};
+            int64_t current{-1};
+            int64_t last{-1};
+        };
+
+        ChildIndexes() = default;
+
+        ChildIndexes(const Storage* storage_, int64_t parent_)
+            : storage{storage_}
+            , parent{parent_}
+        {
+        }
+
+        auto begin() const -> Iterator
+        {
+            return Iterator{storage,
+                            storage->first_children[offset(parent)],
+                            storage->last_children[offset(parent)]};
+        }
+
+        auto end() const -> Iterator
+        {
+            return Iterator{
+                storage, -1, storage->last_children[offset(parent)]};
+        }
+
+        auto size() const -> size_t
+        {
+            return static_cast<size_t>(storage->child_counts[offset(parent)]);
+        }
+
+    private:
+        const Storage* storage{nullptr};
+        int64_t parent{0};
     };
 
 public:
@@ -31,18 +255,25 @@ public:
         std::invoke_result_t<TransformFunc,
                              std::invoke_result_t<Proj, const T&>>>;
 
+    template <typename TransformFunc, typename Proj>
+    using TransformResultTree = LinearTree<
+        TransformResultT<TransformFunc, Proj>,
+        details::Rebind<Allocator, TransformResultT<TransformFunc, Proj>>>;
+
     // Forward declarations
     template <class v_type, class n_type> class PreorderIterator;
     template <class v_type, class n_type> class ConstPreorderIterator;
 
     using value_type = T;
-    using iterator = PreorderIterator<value_type, Node>;
-    using const_iterator = ConstPreorderIterator<const value_type, const Node>;
+    using allocator_type = Allocator;
+    using iterator = PreorderIterator<value_type, Storage>;
+    using const_iterator =
+        ConstPreorderIterator<const value_type, const Storage>;
 
     // Non-const iterator
     template <class v_type, class n_type> class PreorderIterator {
     public:
-        using iterator_category = std::forward_iterator_tag;
+        using iterator_category = std::bidirectional_iterator_tag;
         using difference_type = std::ptrdiff_t;
         using value_type = v_type;
         using element_type = v_type;
@@ -52,15 +283,8 @@ public:
 
         PreorderIterator() = default;
 
-        PreorderIterator(int64_t p_, LinearTree<T>* tree_ptr)
-            : ptr{p_}
-            , tree{tree_ptr}
-        {
-        }
-
-        PreorderIterator(int64_t p_, int64_t prev_, LinearTree<T>* tree_ptr)
+        PreorderIterator(int64_t p_, LinearTree* tree_ptr)
             : ptr{p_}
-            , prev{prev_}
             , tree{tree_ptr}
         {
         }
@@ -72,58 +296,25 @@ public:
         // Conversion to const iterator
         operator ConstPreorderIterator<const v_type, const n_type>() const
         {
-            return ConstPreorderIterator<const v_type, const n_type>{
-                ptr, prev, tree};
+            return ConstPreorderIterator<const v_type, const n_type>{ptr,
+                                                                     tree};
         }
 
         auto operator*() const -> element_type&
         {
-            return tree->get_node(ptr).payload;
+            return tree->payload_of(ptr);
         }
 
         auto operator->() -> element_type*
         {
-            return &tree->get_node(ptr).payload;
+            return &tree->payload_of(ptr);
         }
 
         auto operator++() -> PreorderIterator&
         {
-            if (ptr == -1) {
-                return *this;
-            }
-
-            const auto& current_node = tree->get_node(ptr);
-
-            // If we came from the parent, go to the first child
-            if (prev == current_node.parent) {
-                if (!current_node.children.empty()) {
-                    prev = ptr;
-                    ptr = current_node.children[0];
-                    return *this;
-                }
-            }
-
-            // If we came from a child, try to go to the next sibling
-            if (prev != current_node.parent && prev != -1) {
-                const auto& prev_node = tree->get_node(prev);
-                if (prev_node.pos + 1 <
-                    static_cast<int64_t>(current_node.children.size())) {
-                    prev = ptr;
-                    ptr = current_node
-                              .children[static_cast<size_t>(prev_node.pos) + 1];
-                    return *this;
-                }
-            }
-
-            // If no more children, go back to the parent
-            prev = ptr;
-            ptr = current_node.parent;
-
-            // If we're not at the end, continue navigating
             if (ptr != -1) {
-                this->operator++();
+                ptr = tree->preorder_successor(ptr);
             }
-
             return *this;
         }
 
@@ -134,6 +325,19 @@ public:
             return tmp;
         }
 
+        auto operator--() -> PreorderIterator&
+        {
+            ptr = tree->preorder_predecessor(ptr);
+            return *this;
+        }
+
+        auto operator--(int) -> PreorderIterator
+        {
+            auto tmp = *this;
+            --(*this);
+            return tmp;
+        }
+
         friend auto operator==(const PreorderIterator& lhs,
                                const PreorderIterator& rhs) -> bool
         {
@@ -148,14 +352,13 @@ public:
 
     private:
         int64_t ptr{-1};
-        int64_t prev{-1};
-        LinearTree<T>* tree{nullptr};
+        LinearTree* tree{nullptr};
     };
 
     // Const iterator
     template <class v_type, class n_type> class ConstPreorderIterator {
     public:
-        using iterator_category = std::forward_iterator_tag;
+        using iterator_category = std::bidirectional_iterator_tag;
         using difference_type = std::ptrdiff_t;
         using value_type = v_type;
         using element_type = v_type;
@@ -165,27 +368,17 @@ public:
 
         ConstPreorderIterator() = default;
 
-        ConstPreorderIterator(int64_t p_, const LinearTree<T>* tree_ptr)
+        ConstPreorderIterator(int64_t p_, const LinearTree* tree_ptr)
             : ptr{p_}
             , tree{tree_ptr}
         {
         }
 
-        ConstPreorderIterator(int64_t p_,
-                              int64_t prev_,
-                              const LinearTree<T>* tree_ptr)
-            : ptr{p_}
-            , prev{prev_}
-            , tree{tree_ptr}
-        {
-        }
-
         ConstPreorderIterator(const ConstPreorderIterator&) = default;
 
         // Conversion from non-const iterator
         ConstPreorderIterator(const PreorderIterator<v_type, n_type>& rhs)
             : ptr{rhs.ptr}
-            , prev{rhs.prev}
             , tree{rhs.tree}
         {
         }
@@ -198,59 +391,25 @@ public:
             -> ConstPreorderIterator&
         {
             ptr = rhs.ptr;
-            prev = rhs.prev;
             tree = rhs.tree;
             return *this;
         }
 
         auto operator*() const -> const element_type&
         {
-            return tree->get_node(ptr).payload;
+            return tree->payload_of(ptr);
         }
 
         auto operator->() -> const element_type*
         {
-            return &tree->get_node(ptr).payload;
+            return &tree->payload_of(ptr);
         }
 
         auto operator++() -> ConstPreorderIterator&
         {
-            if (ptr == -1) {
-                return *this;
-            }
-
-            const auto& current_node = tree->get_node(ptr);
-
-            // If we came from the parent, go to the first child
-            if (prev == current_node.parent) {
-                if (!current_node.children.empty()) {
-                    prev = ptr;
-                    ptr = current_node.children[0];
-                    return *this;
-                }
-            }
-
-            // If we came from a child, try to go to the next sibling
-            if (prev != current_node.parent && prev != -1) {
-                const auto& prev_node = tree->get_node(prev);
-                if (prev_node.pos + 1 <
-                    static_cast<int64_t>(current_node.children.size())) {
-                    prev = ptr;
-                    ptr = current_node
-                              .children[static_cast<size_t>(prev_node.pos) + 1];
-                    return *this;
-                }
-            }
-
-            // If no more children, go back to the parent
-            prev = ptr;
-            ptr = current_node.parent;
-
-            // If we're not at the end, continue navigating
             if (ptr != -1) {
-                this->operator++();
+                ptr = tree->preorder_successor(ptr);
             }
-
             return *this;
         }
 
@@ -261,6 +420,19 @@ public:
             return tmp;
         }
 
+        auto operator--() -> ConstPreorderIterator&
+        {
+            ptr = tree->preorder_predecessor(ptr);
+            return *this;
+        }
+
+        auto operator--(int) -> ConstPreorderIterator
+        {
+            auto tmp = *this;
+            --(*this);
+            return tmp;
+        }
+
         friend auto operator==(const ConstPreorderIterator& lhs,
                                const ConstPreorderIterator& rhs) -> bool
         {
@@ -275,57 +447,329 @@ public:
 
     private:
         int64_t ptr{-1};
-        int64_t prev{-1};
-        const LinearTree<T>* tree{nullptr};
+        const LinearTree* tree{nullptr};
     };
 
-    static auto from_flattened(std::ranges::input_range auto&& r) -> LinearTree
+    /* Forward iterator visiting nodes in postorder, i.e. every node right
+     * after all of its descendants. Converts to preorder iterator pointing to
+     * the same node, so it can be passed to parent(), children() and the
+     * like. */
+    template <class v_type> class PostorderIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = v_type;
+        using element_type = v_type;
+        using tree_pointer = std::conditional_t<std::is_const_v<v_type>,
+                                                const LinearTree*,
+                                                LinearTree*>;
+
+        friend class PostorderIterator<const v_type>;
+        friend class LinearTree;
+
+        PostorderIterator() = default;
+
+        PostorderIterator(int64_t p_, tree_pointer tree_ptr)
+            : ptr{p_}
+            , tree{tree_ptr}
+        {
+        }
+
+        // Conversion from non-const iterator
+        template <class nv_type>
+            requires(std::is_const_v<v_type> && !std::is_const_v<nv_type> &&
+                     std::is_same_v<std::remove_const_t<v_type>, nv_type>)
+        PostorderIterator(const PostorderIterator<nv_type>& rhs)
+            : ptr{rhs.ptr}
+            , tree{rhs.tree}
+        {
+        }
+
+        operator const_iterator() const { return const_iterator{ptr, tree}; }
+
+        operator iterator() const
+            requires(!std::is_const_v<v_type>)
+        {
+            return iterator{ptr, tree};
+        }
+
+        auto operator*() const -> element_type&
+        {
+            return tree->payload_of(ptr);
+        }
+
+        auto operator->() -> element_type*
+        {
+            return &tree->payload_of(ptr);
+        }
+
+        auto operator++() -> PostorderIterator&
+        {
+            if (ptr != -1) {
+                ptr = tree->postorder_successor(ptr);
+            }
+            return *this;
+        }
+
+        auto operator++(int) -> PostorderIterator
+        {
+            auto tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        friend auto operator==(const PostorderIterator& lhs,
+                               const PostorderIterator& rhs) -> bool
+        {
+            return lhs.ptr == rhs.ptr && lhs.tree == rhs.tree;
+        }
+
+    private:
+        int64_t ptr{-1};
+        tree_pointer tree{nullptr};
+    };
+
+    /* Forward iterator visiting nodes level by level. Iterator owns queue of
+     * pending nodes, so copying it is not free. Converts to preorder iterator
+     * pointing to the same node. */
+    template <class v_type> class LevelOrderIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = v_type;
+        using element_type = v_type;
+        using tree_pointer = std::conditional_t<std::is_const_v<v_type>,
+                                                const LinearTree*,
+                                                LinearTree*>;
+
+        friend class LevelOrderIterator<const v_type>;
+        friend class LinearTree;
+
+        LevelOrderIterator() = default;
+
+        LevelOrderIterator(int64_t p_, tree_pointer tree_ptr)
+            : tree{tree_ptr}
+        {
+            if (p_ != -1) {
+                frontier.push(p_);
+            }
+        }
+
+        // Conversion from non-const iterator
+        template <class nv_type>
+            requires(std::is_const_v<v_type> && !std::is_const_v<nv_type> &&
+                     std::is_same_v<std::remove_const_t<v_type>, nv_type>)
+        LevelOrderIterator(const LevelOrderIterator<nv_type>& rhs)
+            : frontier{rhs.frontier}
+            , tree{rhs.tree}
+        {
+        }
+
+        operator const_iterator() const
+        {
+            return const_iterator{current(), tree};
+        }
+
+        operator iterator() const
+            requires(!std::is_const_v<v_type>)
+        {
+            return iterator{current(), tree};
+        }
+
+        auto operator*() const -> element_type&
+        {
+            return tree->payload_of(current());
+        }
+
+        auto operator->() -> element_type*
+        {
+            return &tree->payload_of(current());
+        }
+
+        auto operator++() -> LevelOrderIterator&
+        {
+            if (frontier.empty()) {
+                return *this;
+            }
+            const auto index = frontier.front();
+            frontier.pop();
+            for (auto child : tree->child_indexes(index)) {
+                frontier.push(child);
+            }
+            return *this;
+        }
+
+        auto operator++(int) -> LevelOrderIterator
+        {
+            auto tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        friend auto operator==(const LevelOrderIterator& lhs,
+                               const LevelOrderIterator& rhs) -> bool
+        {
+            return lhs.current() == rhs.current() && lhs.tree == rhs.tree;
+        }
+
+    private:
+        std::queue<int64_t> frontier;
+        tree_pointer tree{nullptr};
+
+        auto current() const -> int64_t
+        {
+            return frontier.empty() ? -1 : frontier.front();
+        }
+    };
+
+    using postorder_iterator = PostorderIterator<value_type>;
+    using const_postorder_iterator = PostorderIterator<const value_type>;
+    using level_order_iterator = LevelOrderIterator<value_type>;
+    using const_level_order_iterator = LevelOrderIterator<const value_type>;
+
+    static auto from_flattened(std::ranges::input_range auto&& r,
+                               const Allocator& alloc = {}) -> LinearTree
     {
-        return from_flattened(std::ranges::begin(r), std::ranges::end(r));
+        return from_flattened(
+            std::ranges::begin(r), std::ranges::end(r), alloc);
     }
 
     template <std::input_iterator I, std::sentinel_for<I> S>
-    static auto from_flattened(I first, S last) -> LinearTree
+    static auto from_flattened(I first, S last, const Allocator& alloc = {})
+        -> LinearTree
     {
-        std::queue<iterator> frontier;
-        LinearTree tree;
-        frontier.push(tree.begin());
+        Unflattener unflattener{alloc};
+        for (; first != last and not unflattener.done(); ++first) {
+            unflattener.push(std::move(*first));
+        }
+        return unflattener.finish();
+    }
 
-        for (auto it = first + 2; not frontier.empty() and it != last; ++it) {
-            auto parent_it{frontier.front()};
-            frontier.pop();
-            for (; it->has_value(); ++it) {
-                auto child = tree.insert(parent_it, std::forward<T>(**it));
-                frontier.push(child);
+    /* Push-based counterpart of from_flattened. Entries of flattened
+     * sequence are fed as they arrive, e.g. chunk by chunk from a stream, and
+     * turned into nodes right away, so the sequence is never held in memory
+     * as a whole. */
+    class Unflattener {
+    public:
+        explicit Unflattener(const Allocator& alloc = {})
+            : tree{alloc}
+        {
+        }
+
+        auto push(std::optional<T> entry) -> void
+        {
+            decoder.push(std::move(entry), [this](int64_t parent, T&& payload) {
+                return tree.insert(iterator{parent, &tree}, std::move(payload))
+                    .ptr;
+            });
+        }
+
+        template <std::ranges::input_range R> auto push_range(R&& chunk) -> void
+        {
+            for (auto&& entry : chunk) {
+                push(std::forward<decltype(entry)>(entry));
             }
         }
 
-        return tree;
+        /* Whether the sequence is complete, further entries are ignored. */
+        auto done() const -> bool { return decoder.done(); }
+
+        /* Return tree decoded so far. */
+        auto finish() -> LinearTree { return std::move(tree); }
+
+    private:
+        LinearTree tree;
+        // Nodes are tracked by index, as iterators are bound to the address
+        // of the tree
+        details::FlattenedDecoder<int64_t> decoder{0};
+    };
+
+    /* Build tree from nodes listed in preorder, parents[i] being position of
+     * parent of i-th node in the list or -1 for top-level nodes.
+     *
+     * Storage is sized once and filled in a single pass with node indexes
+     * following the list, so the tree comes out compacted. Throws
+     * std::invalid_argument if nodes are not listed in preorder or there is
+     * not exactly one payload per node. */
+    static auto from_parent_indexes(std::span<const int64_t> parents,
+                                    std::ranges::sized_range auto&& payloads,
+                                    const Allocator& alloc = {}) -> LinearTree
+    {
+        details::throw_if_not_preorder(parents);
+        return build_preorder(parents, payloads, alloc);
+    }
+
+    /* Same as above, but nodes are given by their depths, top-level nodes
+     * being at depth 0. */
+    static auto from_depths(std::span<const int64_t> depths,
+                            std::ranges::sized_range auto&& payloads,
+                            const Allocator& alloc = {}) -> LinearTree
+    {
+        return build_preorder(
+            details::parents_from_depths(depths), payloads, alloc);
+    }
+
+    /* Build tree from binary image written by write_image of any tree with
+     * the same payload type. Throws std::invalid_argument if image is not
+     * valid. */
+    static auto from_image(std::span<const std::byte> image,
+                           const Allocator& alloc = {}) -> LinearTree
+        requires details::ImageStorable<T>
+    {
+        const TreeImageView<T> view{image};
+        return from_parent_indexes(
+            view.parent_indexes(), view.payloads(), alloc);
     }
 
     LinearTree()
+        : LinearTree{Allocator{}}
+    {
+    }
+
+    explicit LinearTree(const Allocator& alloc)
+        : storage{alloc}
+        , free_positions{alloc}
+        , interval_index{alloc}
     {
         // Initialize with root node
-        storage.push_back(Node{-1, T{}, 0, {}});
+        insert_into_free_spot(-1, T{});
     }
 
     LinearTree(const LinearTree&) = default;
 
+    LinearTree(const LinearTree& other, const Allocator& alloc)
+        : storage{other.storage, alloc}
+        , free_positions{other.free_positions, alloc}
+        , interval_index{alloc}
+        , compaction_threshold{other.compaction_threshold}
+    {
+    }
+
     auto operator=(const LinearTree&) -> LinearTree& = default;
 
     LinearTree(LinearTree&&) = default;
 
+    LinearTree(LinearTree&& other, const Allocator& alloc)
+        : storage{std::move(other.storage), alloc}
+        , free_positions{std::move(other.free_positions), alloc}
+        , interval_index{alloc}
+        , compaction_threshold{other.compaction_threshold}
+    {
+    }
+
     auto operator=(LinearTree&&) -> LinearTree& = default;
 
     auto insert(iterator parent, T payload) -> iterator
     {
         const auto true_parent = find_true_index(parent);
-        const auto pos{
-            static_cast<int64_t>(get_node(true_parent).children.size())};
-        const auto child_index = insert_into_free_spot(
-            Node{true_parent, std::move(payload), pos, std::vector<int64_t>{}});
-        get_node(true_parent).children.push_back(child_index);
-        return iterator{child_index, true_parent, this};
+        const auto thread_next = preorder_insertion_point(true_parent, -1);
+        const auto child_index =
+            insert_into_free_spot(true_parent, std::move(payload));
+        link_before(true_parent, child_index, child_index, -1);
+        thread_before(child_index, child_index, thread_next);
+        storage.positions[offset(child_index)] =
+            child_count_of(true_parent) - 1;
+        return iterator{child_index, this};
     }
 
     auto insert(iterator parent, T payload, DestinationPosition insert_pos)
@@ -333,16 +777,14 @@ public:
     {
         const auto true_parent = find_true_index(parent);
         throw_if_invalid_destination(true_parent, insert_pos);
+        const auto next = nth_child(true_parent, insert_pos);
+        const auto thread_next = preorder_insertion_point(true_parent, next);
         const auto child_index =
-            insert_into_free_spot(Node{true_parent,
-                                       std::move(payload),
-                                       insert_pos,
-                                       std::vector<int64_t>()});
-        auto& parent_children = get_node(true_parent).children;
-        parent_children.insert(parent_children.begin() + insert_pos,
-                               child_index);
-        fix_positions_and_parents(true_parent, insert_pos);
-        return iterator{child_index, true_parent, this};
+            insert_into_free_spot(true_parent, std::move(payload));
+        link_before(true_parent, child_index, child_index, next);
+        thread_before(child_index, child_index, thread_next);
+        rebuild_position_indexes(child_index, insert_pos);
+        return iterator{child_index, this};
     }
 
     auto insert(iterator parent,
@@ -391,9 +833,8 @@ public:
                 S last,
                 Proj proj = {}) -> iterator
     {
-        const auto pos =
-            insert_pos.value_or(DestinationPosition{static_cast<int64_t>(
-                get_node(find_true_index(parent)).children.size())});
+        const auto pos = insert_pos.value_or(
+            DestinationPosition{child_count_of(find_true_index(parent))});
         return insert(parent, pos, first, last, proj);
     }
 
@@ -413,28 +854,22 @@ public:
         const auto true_parent = find_true_index(parent);
         throw_if_invalid_destination(true_parent, insert_pos);
 
-        std::vector<int64_t> indexes(
-            static_cast<size_t>(std::distance(first, last)));
-        std::transform(
-            first, last, indexes.begin(), [&, i = 0](auto&& source) mutable {
-                return insert_into_free_spot(Node{true_parent,
-                                                  std::invoke(proj, source),
-                                                  insert_pos + i++,
-                                                  std::vector<int64_t>{}});
-            });
-        auto& parent_children = get_node(true_parent).children;
-
-#ifdef __cpp_lib_containers_ranges
-        parent_children.insert_range(parent_children.begin() + insert_pos,
-                                     indexes);
-#else
-        parent_children.insert(parent_children.begin() + insert_pos,
-                               indexes.begin(),
-                               indexes.end());
-#endif
+        const auto next = nth_child(true_parent, insert_pos);
+        const auto thread_next = preorder_insertion_point(true_parent, next);
+        const auto first_inserted = insert_into_free_spot(
+            true_parent, std::invoke(proj, *first));
+        link_before(true_parent, first_inserted, first_inserted, next);
+        thread_before(first_inserted, first_inserted, thread_next);
+
+        for (++first; first != last; ++first) {
+            const auto child_index = insert_into_free_spot(
+                true_parent, std::invoke(proj, *first));
+            link_before(true_parent, child_index, child_index, next);
+            thread_before(child_index, child_index, thread_next);
+        }
 
-        fix_positions_and_parents(true_parent, insert_pos);
-        return iterator{indexes.front(), true_parent, this};
+        rebuild_position_indexes(first_inserted, insert_pos);
+        return iterator{first_inserted, this};
     }
 
     auto insert_subtree(iterator parent,
@@ -442,11 +877,10 @@ public:
                         const std::optional<DestinationPosition>& insert_pos)
         -> void
     {
-        insert_subtree(
-            parent,
-            other,
-            insert_pos.value_or(DestinationPosition{static_cast<int64_t>(
-                get_node(find_true_index(parent)).children.size())}));
+        insert_subtree(parent,
+                       other,
+                       insert_pos.value_or(DestinationPosition{
+                           child_count_of(find_true_index(parent))}));
     }
 
     auto insert_subtree(iterator parent,
@@ -458,9 +892,8 @@ public:
 
         std::queue<std::pair<iterator, int64_t>> frontier;
 
-        for (auto child_id : other.get_node(0).children) {
-            auto it =
-                insert(parent, other.get_node(child_id).payload, insert_pos);
+        for (auto child_id : other.child_indexes(0)) {
+            auto it = insert(parent, other.payload_of(child_id), insert_pos);
             ++insert_pos;
             frontier.push({it, child_id});
         }
@@ -469,8 +902,8 @@ public:
             auto [parent_it, current] = frontier.front();
             frontier.pop();
 
-            for (auto child_id : other.get_node(current).children) {
-                auto it = insert(parent_it, other.get_node(child_id).payload);
+            for (auto child_id : other.child_indexes(current)) {
+                auto it = insert(parent_it, other.payload_of(child_id));
                 frontier.push({it, child_id});
             }
         }
@@ -481,12 +914,15 @@ public:
         if (subtree == end()) {
             return;
         }
-        const auto parent_index = find_true_index(parent(subtree));
-        auto& parent_children = get_node(parent_index).children;
-        parent_children.erase(parent_children.begin() +
-                              get_node(subtree.ptr).pos);
-        mark_removed(subtree.ptr);
-        fix_positions_and_parents(parent_index, get_node(subtree.ptr).pos);
+        const auto parent_index = parent_of(subtree.ptr);
+        const auto next = next_sibling_of(subtree.ptr);
+        const auto pos = position_of(subtree.ptr);
+        const auto thread_last = last_descendant(subtree.ptr);
+        unlink(parent_index, subtree.ptr, subtree.ptr, 1);
+        thread_detach(subtree.ptr, thread_last);
+        mark_removed(subtree.ptr, thread_last);
+        rebuild_position_indexes(next, pos);
+        compact_if_sparse();
     }
 
     auto move_nodes(iterator source_parent,
@@ -502,113 +938,269 @@ public:
         throw_if_invalid_source(source_parent_index, source_pos, count);
         throw_if_invalid_destination(destination_parent_index, destination_pos);
 
-        auto& source_children = get_node(source_parent_index).children;
-        auto& destination_children =
-            get_node(destination_parent_index).children;
+        if (count == 0) {
+            return;
+        }
 
-        if (source_parent_index == destination_parent_index) {
-            alg::slide(source_children.begin() + source_pos,
-                       source_children.begin() + source_pos + count,
-                       source_children.begin() + destination_pos);
-            fix_positions_and_parents(source_parent_index, 0);
+        // Same semantics as sliding subrange of children vector, see
+        // alg::slide.
+        const bool same_parent{source_parent_index == destination_parent_index};
+        if (same_parent and destination_pos >= source_pos and
+            destination_pos <= source_pos + count) {
             return;
         }
 
-        auto [first, last] =
-            alg::slide(source_children.begin() + source_pos,
-                       source_children.begin() + source_pos + count,
-                       source_children.end());
-        source_children.erase(first, last);
-        fix_positions_and_parents(source_parent_index, source_pos);
+        const auto first = nth_child(source_parent_index, source_pos);
+        auto last = first;
+        for (int64_t i{1}; i < count; ++i) {
+            last = next_sibling_of(last);
+        }
+        const auto source_next = next_sibling_of(last);
+        const auto next = nth_child(destination_parent_index, destination_pos);
+        const auto thread_last = last_descendant(last);
+
+        thread_detach(first, thread_last);
+        unlink(source_parent_index, first, last, count);
+        const auto thread_next =
+            preorder_insertion_point(destination_parent_index, next);
+        link_before(destination_parent_index, first, last, next);
+        thread_before(first, thread_last, thread_next);
+
+        if (same_parent) {
+            const auto first_changed =
+                std::min<int64_t>(source_pos, destination_pos);
+            rebuild_position_indexes(
+                nth_child(source_parent_index, first_changed), first_changed);
+            return;
+        }
 
-        destination_children.insert(
-            destination_children.begin() + destination_pos, first, last);
-        fix_positions_and_parents(destination_parent_index, destination_pos);
+        for (auto child = first; child != next;
+             child = next_sibling_of(child)) {
+            storage.parents[offset(child)] = destination_parent_index;
+        }
+        rebuild_position_indexes(source_next, source_pos);
+        rebuild_position_indexes(first, destination_pos);
     }
 
     auto parent(const_iterator it) const -> const_iterator
     {
-        if (get_node(it.ptr).parent == 0 or it == cend()) {
+        if (it == cend() or parent_of(it.ptr) == 0) {
             return cend();
         }
-        return const_iterator{get_node(it.ptr).parent, it.ptr, this};
+        return const_iterator{parent_of(it.ptr), this};
     }
 
     auto parent(iterator it) -> iterator
     {
-        if (get_node(it.ptr).parent == 0 or it == end()) {
+        if (it == end() or parent_of(it.ptr) == 0) {
+            return end();
+        }
+        return iterator{parent_of(it.ptr), this};
+    }
+
+    /* Return iterator to the node following subtree of it in preorder, i.e.
+     * to its next sibling or to next sibling of its closest ancestor having
+     * one. Runs in constant time while interval index is up to date (see
+     * is_ancestor) and in time proportional to length of the rightmost path
+     * in subtree otherwise. */
+    auto skip_subtree(iterator it) -> iterator
+    {
+        if (it == end()) {
             return end();
         }
-        return iterator{get_node(it.ptr).parent, it.ptr, this};
+        return iterator{subtree_successor(it.ptr), this};
+    }
+
+    auto skip_subtree(const_iterator it) const -> const_iterator
+    {
+        if (it == cend()) {
+            return cend();
+        }
+        return const_iterator{subtree_successor(it.ptr), this};
+    }
+
+    /* Return true if ancestor is a proper ancestor of node. End iterator
+     * stands for the root of the tree and thus is an ancestor of every node.
+     *
+     * This and other interval queries rebuild interval index in linear time
+     * if tree structure has changed since they were last called and answer in
+     * constant time otherwise. Rebuild mutates internal cache, so concurrent
+     * queries on a const tree must be preceded by build_interval_index(). */
+    auto is_ancestor(const_iterator ancestor, const_iterator node) const
+        -> bool
+    {
+        const auto& index = fresh_interval_index();
+        const auto a = offset(find_true_index(ancestor));
+        const auto entry = index.entry[offset(find_true_index(node))];
+        return index.entry[a] < entry and entry <= index.exit[a];
+    }
+
+    /* Return true if node belongs to subtree rooted at subtree_root, the root
+     * itself included. */
+    auto is_in_subtree(const_iterator subtree_root, const_iterator node) const
+        -> bool
+    {
+        return subtree_root == node or is_ancestor(subtree_root, node);
+    }
+
+    /* Return range of nodes of subtree rooted at subtree_root in preorder. */
+    auto subtree_range(iterator subtree_root)
+        -> std::ranges::subrange<iterator>
+    {
+        fresh_interval_index();
+        if (subtree_root == end()) {
+            return {begin(), end()};
+        }
+        return {subtree_root, skip_subtree(subtree_root)};
+    }
+
+    auto subtree_range(const_iterator subtree_root) const
+        -> std::ranges::subrange<const_iterator>
+    {
+        fresh_interval_index();
+        if (subtree_root == cend()) {
+            return {cbegin(), cend()};
+        }
+        return {subtree_root, skip_subtree(subtree_root)};
+    }
+
+    /* Bring interval index up to date, see is_ancestor. */
+    auto build_interval_index() const -> void { fresh_interval_index(); }
+
+    /* Renumber nodes so that they are stored in preorder with no gaps left
+     * by erased nodes, and release unused storage.
+     *
+     * Erased slots are reused by later insertions in arbitrary order, so
+     * after a lot of edits preorder traversal keeps jumping across the
+     * arrays. Compaction makes it a sequential scan again.
+     *
+     * Invalidates all iterators. Returned table maps old node indexes to new
+     * ones (-1 for released slots); pass it to relocate() to fix up iterators
+     * held outside of the tree. */
+    auto compact() -> std::vector<int64_t>
+    {
+        std::vector<int64_t> remap(storage.parents.size(), -1);
+        remap[0] = 0;
+        std::vector<int64_t> order{0};
+        order.reserve(offset(size()) + 1);
+        for (auto current = storage.preorder_next[0]; current != 0;
+             current = storage.preorder_next[offset(current)]) {
+            remap[offset(current)] = static_cast<int64_t>(order.size());
+            order.push_back(current);
+        }
+
+        const auto node_count = order.size();
+        const auto map = [&remap](int64_t index) {
+            return index == -1 ? -1 : remap[offset(index)];
+        };
+
+        Storage compacted{get_allocator()};
+        compacted.parents.reserve(node_count);
+        compacted.first_children.reserve(node_count);
+        compacted.last_children.reserve(node_count);
+        compacted.next_siblings.reserve(node_count);
+        compacted.prev_siblings.reserve(node_count);
+        compacted.child_counts.reserve(node_count);
+        compacted.positions.reserve(node_count);
+        compacted.preorder_next.reserve(node_count);
+        compacted.preorder_prev.reserve(node_count);
+        compacted.payloads.reserve(node_count);
+
+        for (size_t index{0}; index < node_count; ++index) {
+            const auto old = offset(order[index]);
+            compacted.parents.push_back(map(storage.parents[old]));
+            compacted.first_children.push_back(
+                map(storage.first_children[old]));
+            compacted.last_children.push_back(map(storage.last_children[old]));
+            compacted.next_siblings.push_back(map(storage.next_siblings[old]));
+            compacted.prev_siblings.push_back(map(storage.prev_siblings[old]));
+            compacted.child_counts.push_back(storage.child_counts[old]);
+            compacted.positions.push_back(storage.positions[old]);
+            compacted.preorder_next.push_back(
+                static_cast<int64_t>((index + 1) % node_count));
+            compacted.preorder_prev.push_back(
+                static_cast<int64_t>((index + node_count - 1) % node_count));
+            compacted.payloads.push_back(std::move(storage.payloads[old]));
+        }
+
+        storage = std::move(compacted);
+        free_positions = FreePositions{get_allocator()};
+        interval_index.valid = false;
+        return remap;
+    }
+
+    /* Return iterator to the same node as it was before compaction that
+     * returned remap. */
+    auto relocate(iterator it, const std::vector<int64_t>& remap) -> iterator
+    {
+        return it == end() ? end() : iterator{remap[offset(it.ptr)], this};
+    }
+
+    auto relocate(const_iterator it, const std::vector<int64_t>& remap) const
+        -> const_iterator
+    {
+        return it == cend() ? cend()
+                            : const_iterator{remap[offset(it.ptr)], this};
+    }
+
+    /* Compact tree automatically whenever erase leaves share of released
+     * slots in storage above max_free_ratio. Disabled by default, as it
+     * invalidates all iterators on such erase. Compaction is linear in tree
+     * size, while erases between two of them release at least max_free_ratio
+     * of slots, so amortized cost of erase stays constant. */
+    auto set_compaction_threshold(std::optional<double> max_free_ratio)
+        -> void
+    {
+        compaction_threshold = max_free_ratio;
     }
 
     auto children(iterator it)
     {
         const auto index = find_true_index(it);
-        return std::views::transform(get_node(index).children,
-                                     [this](const auto& child_id) {
-                                         return get_node(child_id).payload;
-                                     });
+        return std::views::transform(
+            child_indexes(index),
+            [this](const auto& child_id) { return payload_of(child_id); });
     }
 
     auto children(const_iterator it) const
     {
         const auto index = find_true_index(it);
-        return std::views::transform(get_node(index).children,
-                                     [this](const auto& child_id) {
-                                         return get_node(child_id).payload;
-                                     });
+        return std::views::transform(
+            child_indexes(index),
+            [this](const auto& child_id) { return payload_of(child_id); });
     }
 
     auto children_iterators(iterator it)
     {
-        // NOTE we are setting prev node for all children iterators to their
-        // parent. This is required for proper subtree iteration when using this
-        // method in more complex traversals.
-        //
-        // Note also that setting prev to parent is correct for the first child,
-        // but incorrect for the rest of them -- as iterator is now implemented,
-        // each child prev should point to previous child, but now it is
-        // pointing to parent instead. This is fine for forward_iterator, but if
-        // in the future more complex iterators will be implemented, this should
-        // be dealt with.
         const auto index = find_true_index(it);
-        return std::views::transform(get_node(index).children,
-                                     [&, parent_index = index](auto& child_id) {
-                                         return iterator{
-                                             child_id, parent_index, this};
-                                     });
+        return std::views::transform(
+            child_indexes(index),
+            [this](auto child_id) { return iterator{child_id, this}; });
     }
 
     auto children_iterators(const_iterator it) const
     {
-        // NOTE we are setting prev node for all children iterators to their
-        // parent. This is required for proper subtree iteration when using this
-        // method in more complex traversals.
-        //
-        // Note also that setting prev to parent is correct for the first child,
-        // but incorrect for the rest of them -- as iterator is now implemented,
-        // each child prev should point to previous child, but now it is
-        // pointing to parent instead. This is fine for forward_iterator, but if
-        // in the future more complex iterators will be implemented, this should
-        // be dealt with.
         const auto index = find_true_index(it);
         return std::views::transform(
-            get_node(index).children,
-            [&, parent_index = index](const auto& child_id) {
-                return const_iterator{child_id, parent_index, this};
-            });
+            child_indexes(index),
+            [this](auto child_id) { return const_iterator{child_id, this}; });
     }
 
-    auto empty() const -> bool { return children(cend()).size() == 0; }
+    auto empty() const -> bool { return child_count_of(0) == 0; }
 
-    /* Return number of nodes in the tree in linear time. */
+    auto get_allocator() const -> Allocator
+    {
+        return storage.payloads.get_allocator();
+    }
+
+    /* Return number of nodes in the tree in constant time. */
     auto size() const -> int
     {
-        return std::ranges::fold_left(
-            cbegin(), cend(), 0, [](auto acc, const auto& /* payload */) {
-                return acc + 1;
-            });
+        // Every allocated slot except for the fake root and released ones
+        // holds a node.
+        return static_cast<int>(storage.parents.size() -
+                                free_positions.size()) -
+               1;
     }
 
     // Returns subtree with subtree_root as root.
@@ -626,43 +1218,38 @@ public:
 
     auto position_in_children(const_iterator it) const -> int64_t
     {
-        return it == cend() ? 0 : get_node(it.ptr).pos;
+        return it == cend() ? 0 : position_of(it.ptr);
     }
 
     template <typename Func, typename Proj = std::identity>
     auto transform(Func func, Proj proj = {}) const
-        -> LinearTree<TransformResultT<Func, Proj>>
+        -> TransformResultTree<Func, Proj>
     {
         return transform(cend(), func, proj);
     }
 
     template <typename Func, typename Proj = std::identity>
     auto transform(const_iterator subtree_root, Func func, Proj proj = {}) const
-        -> LinearTree<TransformResultT<Func, Proj>>
+        -> TransformResultTree<Func, Proj>
     {
-        using Y = TransformResultT<Func, Proj>;
-        LinearTree<Y> mapped;
+        using Mapped = TransformResultTree<Func, Proj>;
+        Mapped mapped{typename Mapped::allocator_type{get_allocator()}};
 
-        std::queue<std::pair<int64_t, typename LinearTree<Y>::iterator>>
-            frontier;
+        std::queue<std::pair<int64_t, typename Mapped::iterator>> frontier;
 
         if (subtree_root == cend()) {
-            const auto& children = get_node(0).children;
-
-            for (auto child_id : children) {
+            for (auto child_id : child_indexes(0)) {
                 auto it = mapped.insert(
                     mapped.end(),
-                    std::invoke(func,
-                                std::invoke(proj, get_node(child_id).payload)));
+                    std::invoke(func, std::invoke(proj, payload_of(child_id))));
                 frontier.push({child_id, it});
             }
         }
         else {
             auto it = mapped.insert(
                 mapped.end(),
-                std::invoke(
-                    func,
-                    std::invoke(proj, get_node(subtree_root.ptr).payload)));
+                std::invoke(func,
+                            std::invoke(proj, payload_of(subtree_root.ptr))));
             frontier.push({subtree_root.ptr, it});
         }
 
@@ -670,13 +1257,10 @@ public:
             auto [current, mapped_it] = frontier.front();
             frontier.pop();
 
-            const auto& children = get_node(current).children;
-
-            for (auto child_id : children) {
+            for (auto child_id : child_indexes(current)) {
                 auto it = mapped.insert(
                     mapped_it,
-                    std::invoke(func,
-                                std::invoke(proj, get_node(child_id).payload)));
+                    std::invoke(func, std::invoke(proj, payload_of(child_id))));
                 frontier.push({child_id, it});
             }
         }
@@ -684,31 +1268,115 @@ public:
         return mapped;
     }
 
-    auto flatten() const -> std::vector<std::optional<T>>
+    /* Parallel transform of the whole tree.
+     *
+     * Mapped tree gets exactly the same layout: index arrays are copied as is
+     * and payloads are mapped in place by chunks of slots evaluated in
+     * parallel, so there is no per-node insertion. Slots released by erased
+     * nodes are kept released, their payloads are default constructed. */
+    template <typename Func, typename Proj = std::identity>
+        requires std::default_initializable<TransformResultT<Func, Proj>>
+    auto transform(const Parallel& policy, Func func, Proj proj = {}) const
+        -> TransformResultTree<Func, Proj>
     {
-        std::queue<int64_t> frontier;
-        frontier.push(0);
+        using Mapped = TransformResultTree<Func, Proj>;
+        using MappedT = typename Mapped::value_type;
+        Mapped mapped{typename Mapped::allocator_type{get_allocator()}};
+
+        auto copy_indexes = [](const Indexes& source, auto& destination) {
+            destination.assign(source.begin(), source.end());
+        };
+        copy_indexes(storage.parents, mapped.storage.parents);
+        copy_indexes(storage.first_children, mapped.storage.first_children);
+        copy_indexes(storage.last_children, mapped.storage.last_children);
+        copy_indexes(storage.next_siblings, mapped.storage.next_siblings);
+        copy_indexes(storage.prev_siblings, mapped.storage.prev_siblings);
+        copy_indexes(storage.child_counts, mapped.storage.child_counts);
+        copy_indexes(storage.positions, mapped.storage.positions);
+        copy_indexes(storage.preorder_next, mapped.storage.preorder_next);
+        copy_indexes(storage.preorder_prev, mapped.storage.preorder_prev);
+        mapped.compaction_threshold = compaction_threshold;
+
+        std::vector<bool> released;
+        if (not free_positions.empty()) {
+            released.resize(storage.parents.size());
+            for (auto pending = free_positions; not pending.empty();
+                 pending.pop()) {
+                released[offset(pending.front())] = true;
+                mapped.free_positions.push(pending.front());
+            }
+        }
 
-        std::vector<std::optional<T>> flattened{std::nullopt, std::nullopt};
+        auto& payloads = mapped.storage.payloads;
+        payloads.resize(storage.payloads.size());
+        // Elements of std::vector<bool> are not separate memory locations
+        const auto threads =
+            details::constructible_in_parallel<
+                MappedT,
+                typename Mapped::allocator_type> and
+                    not std::same_as<MappedT, bool>
+                ? policy.threads
+                : 1U;
+        details::run_in_parallel(
+            threads, payloads.size(), [&](size_t first, size_t last) {
+                // Slot 0 is the fake root
+                for (auto i = std::max(first, size_t{1}); i < last; ++i) {
+                    if (released.empty() or not released[i]) {
+                        payloads[i] = std::invoke(
+                            func, std::invoke(proj, storage.payloads[i]));
+                    }
+                }
+            });
 
-        while (not frontier.empty()) {
-            const auto current = frontier.front();
-            frontier.pop();
+        return mapped;
+    }
 
-            for (auto child : get_node(current).children) {
-                flattened.push_back(get_node(child).payload);
-                frontier.push(child);
-            }
-            flattened.push_back(std::nullopt);
+    auto flatten() const -> std::vector<std::optional<T>>
+    {
+        // Every node and every terminator of its children, plus fake root
+        std::vector<std::optional<T>> flattened;
+        flattened.reserve(2 * static_cast<size_t>(size()) + 3);
+        flatten_to(std::back_inserter(flattened));
+        return flattened;
+    }
+
+    /* Write flattened sequence to out entry by entry instead of collecting
+     * it into a vector. */
+    template <std::output_iterator<std::optional<T>> O>
+    auto flatten_to(O out) const -> O
+    {
+        return details::flatten_to(
+            int64_t{0},
+            std::optional<T>{},
+            [this](int64_t index) { return child_indexes(index); },
+            [this](int64_t index) {
+                return std::optional<T>{payload_of(index)};
+            },
+            std::move(out));
+    }
+
+    /* Write binary image of the tree, see TreeImage.h. Released slots are
+     * skipped, so image is always compact. */
+    auto write_image(std::ostream& os) const -> void
+        requires details::ImageStorable<T>
+    {
+        std::vector<int64_t> positions(storage.parents.size(), -1);
+        std::vector<int64_t> parents;
+        parents.reserve(offset(size()));
+        for (auto current = storage.preorder_next[0]; current != 0;
+             current = storage.preorder_next[offset(current)]) {
+            positions[offset(current)] = std::ssize(parents);
+            parents.push_back(positions[offset(parent_of(current))]);
         }
 
-        return flattened;
+        details::write_image<details::NoKey, T>(
+            os, parents, std::views::empty<details::NoKey>, *this);
     }
 
     auto to_string() const -> std::string
     {
         std::stack<std::pair<int, int64_t>> frontier;
-        for (auto child : std::views::reverse(storage[0u].children)) {
+        for (auto child : std::views::reverse(child_indexes(0))) {
             frontier.push({0, child});
         }
 
@@ -719,9 +1387,9 @@ public:
             frontier.pop();
 
             ss << std::string(static_cast<size_t>(level * 3), ' ')
-               << get_node(current).payload << '\n';
+               << payload_of(current) << '\n';
 
-            for (auto child : std::views::reverse(get_node(current).children)) {
+            for (auto child : std::views::reverse(child_indexes(current))) {
                 frontier.push({level + 1, child});
             }
         }
@@ -729,23 +1397,44 @@ public:
         return ss.str();
     }
 
-    auto begin() -> iterator { return ++iterator{0, -1, this}; }
+    auto begin() -> iterator { return ++iterator{0, this}; }
+
+    auto end() -> iterator { return iterator{-1, this}; }
+
+    auto begin() const -> const_iterator { return ++const_iterator{0, this}; }
+
+    auto end() const -> const_iterator { return const_iterator{-1, this}; }
 
-    auto end() -> iterator { return iterator{-1, -1, this}; }
+    auto cbegin() const -> const_iterator { return ++const_iterator{0, this}; }
 
-    auto begin() const -> const_iterator
+    auto cend() const -> const_iterator { return const_iterator{-1, this}; }
+
+    /* Return range of all nodes in postorder. */
+    auto postorder() -> std::ranges::subrange<postorder_iterator>
     {
-        return ++const_iterator{0, -1, this};
+        return {postorder_iterator{postorder_first(0), this},
+                postorder_iterator{-1, this}};
     }
 
-    auto end() const -> const_iterator { return const_iterator{-1, -1, this}; }
+    auto postorder() const -> std::ranges::subrange<const_postorder_iterator>
+    {
+        return {const_postorder_iterator{postorder_first(0), this},
+                const_postorder_iterator{-1, this}};
+    }
 
-    auto cbegin() const -> const_iterator
+    /* Return range of all nodes in level order. */
+    auto level_order() -> std::ranges::subrange<level_order_iterator>
     {
-        return ++const_iterator{0, -1, this};
+        auto first = ++level_order_iterator{0, this};
+        return {std::move(first), level_order_iterator{-1, this}};
     }
 
-    auto cend() const -> const_iterator { return const_iterator{-1, -1, this}; }
+    auto level_order() const
+        -> std::ranges::subrange<const_level_order_iterator>
+    {
+        auto first = ++const_level_order_iterator{0, this};
+        return {std::move(first), const_level_order_iterator{-1, this}};
+    }
 
     friend auto operator==(const LinearTree& lhs, const LinearTree& rhs) -> bool
     {
@@ -776,73 +1465,366 @@ public:
         return true;
     }
 
-    // Public get_node methods for iterator access
-    auto get_node(int64_t storage_pos) const -> const Node&
+private:
+    template <typename, typename> friend class LinearTree;
+    // Maps keep node indexes in their registries and use them directly
+    template <std::default_initializable,
+              std::default_initializable,
+              typename,
+              template <typename...> class>
+    friend class LinearTreeMap;
+
+    Storage storage;
+    FreePositions free_positions;
+    mutable IntervalIndex interval_index;
+    std::optional<double> compaction_threshold;
+
+    static auto offset(int64_t index) -> size_t
     {
-        if (storage_pos < 0 ||
-            static_cast<size_t>(storage_pos) >= storage.size()) {
-            throw std::out_of_range{"Node index out of range"};
+        return static_cast<size_t>(index);
+    }
+
+    auto parent_of(int64_t index) const -> int64_t
+    {
+        return storage.parents[offset(index)];
+    }
+
+    auto first_child_of(int64_t index) const -> int64_t
+    {
+        return storage.first_children[offset(index)];
+    }
+
+    auto next_sibling_of(int64_t index) const -> int64_t
+    {
+        return storage.next_siblings[offset(index)];
+    }
+
+    auto prev_sibling_of(int64_t index) const -> int64_t
+    {
+        return storage.prev_siblings[offset(index)];
+    }
+
+    auto child_count_of(int64_t index) const -> int64_t
+    {
+        return storage.child_counts[offset(index)];
+    }
+
+    auto position_of(int64_t index) const -> int64_t
+    {
+        return storage.positions[offset(index)];
+    }
+
+    auto child_indexes(int64_t index) const -> ChildIndexes
+    {
+        return ChildIndexes{&storage, index};
+    }
+
+    auto payload_of(int64_t index) const -> const T&
+    {
+        throw_if_invalid_index(index);
+        return storage.payloads[offset(index)];
+    }
+
+    auto payload_of(int64_t index) -> T&
+    {
+        throw_if_invalid_index(index);
+        return storage.payloads[offset(index)];
+    }
+
+    /* Return index of node following given one in preorder or -1 if it is the
+     * last one. */
+    auto preorder_successor(int64_t index) const -> int64_t
+    {
+        const auto next = storage.preorder_next[offset(index)];
+        return next == 0 ? -1 : next;
+    }
+
+    /* Return index of node preceding given one in preorder, the last node if
+     * index is -1 or -1 if there is no such node. */
+    auto preorder_predecessor(int64_t index) const -> int64_t
+    {
+        const auto prev =
+            storage.preorder_prev[offset(index == -1 ? 0 : index)];
+        return prev == 0 ? -1 : prev;
+    }
+
+    /* Return index of node visited first in postorder traversal of subtree or
+     * -1 if subtree is the empty fake root. */
+    auto postorder_first(int64_t index) const -> int64_t
+    {
+        for (auto child = first_child_of(index); child != -1;
+             child = first_child_of(child)) {
+            index = child;
         }
-        return storage[static_cast<size_t>(storage_pos)];
+        return index == 0 ? -1 : index;
     }
 
-    auto get_node(int64_t storage_pos) -> Node&
+    auto postorder_successor(int64_t index) const -> int64_t
     {
-        if (storage_pos < 0 ||
-            static_cast<size_t>(storage_pos) >= storage.size()) {
-            throw std::out_of_range{"Node index out of range"};
+        if (const auto next = next_sibling_of(index); next != -1) {
+            return postorder_first(next);
         }
-        return storage[static_cast<size_t>(storage_pos)];
+        const auto parent = parent_of(index);
+        return parent == 0 ? -1 : parent;
     }
 
-private:
-    std::vector<Node> storage;
-    std::queue<int64_t> free_positions;
+    auto fresh_interval_index() const -> const IntervalIndex&
+    {
+        auto& index = interval_index;
+        if (index.valid) {
+            return index;
+        }
+
+        index.entry.assign(storage.parents.size(), -1);
+        index.exit.assign(storage.parents.size(), -1);
+        index.order.clear();
+        index.order.reserve(static_cast<size_t>(size()));
+
+        for (auto current = storage.preorder_next[0]; current != 0;
+             current = storage.preorder_next[offset(current)]) {
+            index.entry[offset(current)] =
+                static_cast<int64_t>(index.order.size());
+            index.order.push_back(current);
+        }
+
+        // Descendants follow their ancestors in preorder, so walking it
+        // backwards exit of the last child is always known.
+        for (auto current : std::views::reverse(index.order)) {
+            const auto last = storage.last_children[offset(current)];
+            index.exit[offset(current)] = last == -1
+                                              ? index.entry[offset(current)]
+                                              : index.exit[offset(last)];
+        }
+        index.exit[0] = static_cast<int64_t>(index.order.size()) - 1;
+
+        index.valid = true;
+        return index;
+    }
 
-    auto fix_positions_and_parents(int64_t index, int64_t first)
+    /* Return index of node following subtree in preorder or -1 if there is
+     * none. Answered from interval index when it is up to date. */
+    auto subtree_successor(int64_t index) const -> int64_t
     {
-        auto& children = get_node(index).children;
-        if (first >= static_cast<int64_t>(children.size())) {
-            return;
+        if (interval_index.valid) {
+            const auto next = offset(interval_index.exit[offset(index)]) + 1;
+            return next < interval_index.order.size()
+                       ? interval_index.order[next]
+                       : -1;
         }
-        std::for_each(
-            children.begin() + first, children.end(), [&](auto& child) {
-                auto& node = get_node(child);
-                node.pos = first++;
-                node.parent = index;
-            });
+        return preorder_successor(last_descendant(index));
+    }
+
+    /* Return index of the last node of subtree in preorder. */
+    auto last_descendant(int64_t index) const -> int64_t
+    {
+        for (auto child = storage.last_children[offset(index)]; child != -1;
+             child = storage.last_children[offset(child)]) {
+            index = child;
+        }
+        return index;
     }
 
-    auto insert_into_free_spot(Node&& node) -> int64_t
+    /* Return index of node that should follow in preorder a child being
+     * inserted into parent before child next (or at the end if next is -1). */
+    auto preorder_insertion_point(int64_t parent, int64_t next) const
+        -> int64_t
+    {
+        return next != -1 ? next
+                          : storage.preorder_next[offset(
+                                last_descendant(parent))];
+    }
+
+    /* Splice detached preorder segment [first, last] before node before. */
+    auto thread_before(int64_t first, int64_t last, int64_t before) -> void
+    {
+        const auto prev = storage.preorder_prev[offset(before)];
+        storage.preorder_next[offset(prev)] = first;
+        storage.preorder_prev[offset(first)] = prev;
+        storage.preorder_next[offset(last)] = before;
+        storage.preorder_prev[offset(before)] = last;
+    }
+
+    /* Cut preorder segment [first, last] out of the thread, leaving links
+     * inside of the segment intact. */
+    auto thread_detach(int64_t first, int64_t last) -> void
+    {
+        const auto prev = storage.preorder_prev[offset(first)];
+        const auto next = storage.preorder_next[offset(last)];
+        storage.preorder_next[offset(prev)] = next;
+        storage.preorder_prev[offset(next)] = prev;
+    }
+
+    /* Return index of child at given position or -1 if position is equal to
+     * number of children. */
+    auto nth_child(int64_t parent, int64_t pos) const -> int64_t
+    {
+        const auto count = child_count_of(parent);
+        if (pos >= count) {
+            return -1;
+        }
+        if (pos <= count / 2) {
+            auto child = first_child_of(parent);
+            for (; pos > 0; --pos) {
+                child = next_sibling_of(child);
+            }
+            return child;
+        }
+        auto child = storage.last_children[offset(parent)];
+        for (pos = count - 1 - pos; pos > 0; --pos) {
+            child = prev_sibling_of(child);
+        }
+        return child;
+    }
+
+    /* Link chain of siblings [first, last] into children of parent before
+     * child next, or at the end of children if next is -1. */
+    auto link_before(int64_t parent,
+                     int64_t first,
+                     int64_t last,
+                     int64_t next) -> void
+    {
+        interval_index.valid = false;
+        const auto prev = next == -1 ? storage.last_children[offset(parent)]
+                                     : prev_sibling_of(next);
+        storage.prev_siblings[offset(first)] = prev;
+        storage.next_siblings[offset(last)] = next;
+        (prev == -1 ? storage.first_children[offset(parent)]
+                    : storage.next_siblings[offset(prev)]) = first;
+        (next == -1 ? storage.last_children[offset(parent)]
+                    : storage.prev_siblings[offset(next)]) = last;
+
+        int64_t count{1};
+        for (auto child = first; child != last;
+             child = next_sibling_of(child)) {
+            ++count;
+        }
+        storage.child_counts[offset(parent)] += count;
+    }
+
+    /* Unlink chain of count siblings [first, last] from children of
+     * parent. */
+    auto unlink(int64_t parent, int64_t first, int64_t last, int64_t count)
+        -> void
+    {
+        interval_index.valid = false;
+        const auto prev = prev_sibling_of(first);
+        const auto next = next_sibling_of(last);
+        (prev == -1 ? storage.first_children[offset(parent)]
+                    : storage.next_siblings[offset(prev)]) = next;
+        (next == -1 ? storage.last_children[offset(parent)]
+                    : storage.prev_siblings[offset(next)]) = prev;
+        storage.prev_siblings[offset(first)] = -1;
+        storage.next_siblings[offset(last)] = -1;
+        storage.child_counts[offset(parent)] -= count;
+    }
+
+    /* Renumber cached positions of child and all siblings following it. */
+    auto rebuild_position_indexes(int64_t child, int64_t pos) -> void
+    {
+        for (; child != -1; child = next_sibling_of(child)) {
+            storage.positions[offset(child)] = pos++;
+        }
+    }
+
+    template <typename U>
+    auto insert_into_free_spot(int64_t parent, U&& payload) -> int64_t
     {
         if (free_positions.empty()) {
-            storage.push_back(std::move(node));
-            return static_cast<int64_t>(storage.size()) - 1;
+            // Fresh node forms single node preorder segment
+            const auto index = static_cast<int64_t>(storage.parents.size());
+            storage.parents.push_back(parent);
+            storage.first_children.push_back(-1);
+            storage.last_children.push_back(-1);
+            storage.next_siblings.push_back(-1);
+            storage.prev_siblings.push_back(-1);
+            storage.child_counts.push_back(0);
+            storage.positions.push_back(0);
+            storage.preorder_next.push_back(index);
+            storage.preorder_prev.push_back(index);
+            storage.payloads.push_back(std::forward<U>(payload));
+            return index;
         }
-        const auto pos = free_positions.front();
+        const auto index = free_positions.front();
         free_positions.pop();
-        get_node(pos) = std::move(node);
-        return pos;
+        storage.parents[offset(index)] = parent;
+        storage.first_children[offset(index)] = -1;
+        storage.last_children[offset(index)] = -1;
+        storage.next_siblings[offset(index)] = -1;
+        storage.prev_siblings[offset(index)] = -1;
+        storage.child_counts[offset(index)] = 0;
+        storage.positions[offset(index)] = 0;
+        storage.preorder_next[offset(index)] = index;
+        storage.preorder_prev[offset(index)] = index;
+        storage.payloads[offset(index)] = std::forward<U>(payload);
+        return index;
     }
 
-    auto mark_removed(int64_t subtree_root) -> void
+    /* Fill storage of a fresh tree from validated preorder parent positions,
+     * see from_parent_indexes. Node i gets index i + 1, so parents precede
+     * their children and the preorder thread runs through consecutive
+     * indexes. */
+    template <typename Payloads>
+    static auto build_preorder(std::span<const int64_t> parents,
+                               Payloads&& payloads,
+                               const Allocator& alloc) -> LinearTree
     {
-        std::stack<int64_t> frontier;
-        frontier.push(subtree_root);
+        details::throw_if_payload_count_differs(
+            parents.size(), static_cast<size_t>(std::ranges::size(payloads)));
+
+        LinearTree tree{alloc};
+        auto& s = tree.storage;
+        const auto slots = parents.size() + 1;
+        s.parents.resize(slots);
+        s.first_children.resize(slots, -1);
+        s.last_children.resize(slots, -1);
+        s.next_siblings.resize(slots, -1);
+        s.prev_siblings.resize(slots, -1);
+        s.child_counts.resize(slots, 0);
+        s.positions.resize(slots, 0);
+        s.preorder_next.resize(slots);
+        s.preorder_prev.resize(slots);
+        s.payloads.reserve(slots);
+
+        for (size_t i{0}; i < parents.size(); ++i) {
+            const auto index = static_cast<int64_t>(i) + 1;
+            const auto parent = parents[i] + 1;
+            const auto prev = s.last_children[offset(parent)];
+            s.parents[offset(index)] = parent;
+            (prev == -1 ? s.first_children[offset(parent)]
+                        : s.next_siblings[offset(prev)]) = index;
+            s.prev_siblings[offset(index)] = prev;
+            s.last_children[offset(parent)] = index;
+            s.positions[offset(index)] = s.child_counts[offset(parent)]++;
+            s.preorder_next[offset(index - 1)] = index;
+            s.preorder_prev[offset(index)] = index - 1;
+        }
+        s.preorder_next[slots - 1] = 0;
+        s.preorder_prev[0] = static_cast<int64_t>(slots) - 1;
 
-        while (not frontier.empty()) {
-            const auto current = frontier.top();
-            frontier.pop();
+        for (auto&& payload : payloads) {
+            s.payloads.emplace_back(std::forward<decltype(payload)>(payload));
+        }
+        return tree;
+    }
 
-            free_positions.push(current);
+    auto compact_if_sparse() -> void
+    {
+        if (compaction_threshold and
+            static_cast<double>(free_positions.size()) >
+                *compaction_threshold *
+                    static_cast<double>(storage.parents.size())) {
+            compact();
+        }
+    }
 
-#ifdef __cpp_lib_containers_ranges
-            frontier.push_range(get_node(current).children);
-#else
-            std::ranges::for_each(
-                get_node(current).children,
-                [&frontier](auto child) { frontier.push(child); });
-#endif
+    /* Release nodes of detached preorder segment [first, last]. */
+    auto mark_removed(int64_t first, int64_t last) -> void
+    {
+        auto current = first;
+        free_positions.push(current);
+        while (current != last) {
+            current = storage.preorder_next[offset(current)];
+            free_positions.push(current);
         }
     }
 
@@ -860,9 +1842,8 @@ private:
                                  SourcePosition source,
                                  Count count) -> void
     {
-        if (source < 0 or
-            source + count >
-                static_cast<int64_t>(get_node(node_id).children.size())) {
+        if (source < 0 or count < 0 or
+            source + count > child_count_of(node_id)) {
             throw std::out_of_range{"Source position out of range"};
         }
     }
@@ -870,12 +1851,17 @@ private:
     auto throw_if_invalid_destination(int64_t node_id,
                                       DestinationPosition destination) -> void
     {
-        if (destination < 0 or
-            destination >
-                static_cast<int64_t>(get_node(node_id).children.size())) {
+        if (destination < 0 or destination > child_count_of(node_id)) {
             throw std::out_of_range{"Destination out of range"};
         }
     }
+
+    auto throw_if_invalid_index(int64_t index) const -> void
+    {
+        if (index < 0 or offset(index) >= storage.payloads.size()) {
+            throw std::out_of_range{"Node index out of range"};
+        }
+    }
 };
 
 // Static assertions
@@ -900,8 +1886,33 @@ static_assert(!std::is_convertible_v<LinearTree<double>::iterator,
 static_assert(!std::is_convertible_v<LinearTree<double>::const_iterator,
                                      LinearTree<int>::const_iterator>);
 
-static_assert(std::forward_iterator<LinearTree<int>::iterator>);
-static_assert(std::forward_iterator<LinearTree<int>::const_iterator>);
+static_assert(std::bidirectional_iterator<LinearTree<int>::iterator>);
+static_assert(std::bidirectional_iterator<LinearTree<int>::const_iterator>);
+static_assert(std::forward_iterator<LinearTree<int>::postorder_iterator>);
+static_assert(std::forward_iterator<LinearTree<int>::const_postorder_iterator>);
+static_assert(std::forward_iterator<LinearTree<int>::level_order_iterator>);
+static_assert(
+    std::forward_iterator<LinearTree<int>::const_level_order_iterator>);
+
+// Postorder and level order iterators convert to preorder ones
+static_assert(std::is_convertible_v<LinearTree<int>::postorder_iterator,
+                                    LinearTree<int>::iterator>);
+static_assert(std::is_convertible_v<LinearTree<int>::postorder_iterator,
+                                    LinearTree<int>::const_iterator>);
+static_assert(!std::is_convertible_v<LinearTree<int>::const_postorder_iterator,
+                                     LinearTree<int>::iterator>);
+static_assert(std::is_convertible_v<LinearTree<int>::level_order_iterator,
+                                    LinearTree<int>::iterator>);
+static_assert(
+    !std::is_convertible_v<LinearTree<int>::const_level_order_iterator,
+                           LinearTree<int>::iterator>);
+
+namespace pmr {
+
+template <typename T>
+using LinearTree = ds::LinearTree<T, std::pmr::polymorphic_allocator<T>>;
+
+} // namespace pmr
 
 } // namespace ds
 
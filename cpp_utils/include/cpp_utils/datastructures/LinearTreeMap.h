@@ -0,0 +1,712 @@
+#ifndef LINEARTREEMAP_H_K4PZ7WQM
+#define LINEARTREEMAP_H_K4PZ7WQM
+
+#include "cpp_utils/datastructures/FlatHashMap.h"
+#include "cpp_utils/datastructures/LinearTree.h"
+#include "cpp_utils/datastructures/TreeCommon.h"
+#include "cpp_utils/datastructures/TreeImage.h"
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <ostream>
+#include <ranges>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ds {
+
+/* Tree of unique keys with payloads with the interface of TreeMap, keeping
+ * entries in a LinearTree instead of separately allocated nodes. Registry
+ * maps keys to node indexes of that tree.
+ *
+ * Nodes of the whole tree live in a handful of flat arrays, so adding a node
+ * costs amortized growth of the arrays and a registry insertion, and walking
+ * children or subtrees touches contiguous memory. Node indexes never change,
+ * so copying the tree copies the arrays and the registry as they are.
+ *
+ * positionInChildren is O(1). nthChild walks sibling list, but starts from
+ * the child found by the previous call whenever it is closer, so asking for
+ * children of a node row after row, as item views do, costs O(1) per row.
+ * That cache is updated by const member functions, so unlike TreeMap this
+ * tree can not be read from several threads at once without
+ * synchronization.
+ *
+ * Allocator and RegistryMap are used as in TreeMap. */
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator = std::allocator<std::pair<const KeyT, PayloadT>>,
+          template <typename...> class RegistryMap = FlatHashMap>
+class LinearTreeMap {
+public:
+    using entry_t = std::pair<KeyT, PayloadT>;
+    using allocator_type = Allocator;
+
+private:
+    using Tree = LinearTree<entry_t, details::Rebind<Allocator, entry_t>>;
+    using TreeIterator = typename Tree::iterator;
+
+    using Registry = RegistryMap<
+        KeyT,
+        int64_t,
+        RegistryHash<KeyT>,
+        std::equal_to<>,
+        details::Rebind<Allocator, std::pair<const KeyT, int64_t>>>;
+
+    template <typename Func>
+    using TransformResultT =
+        std::remove_cvref_t<std::invoke_result_t<Func, const PayloadT&>>;
+
+    template <typename Func>
+    using MappedTreeMap = LinearTreeMap<
+        KeyT,
+        TransformResultT<Func>,
+        details::Rebind<Allocator,
+                        std::pair<const KeyT, TransformResultT<Func>>>,
+        RegistryMap>;
+
+    /* Lookups accept the same key types as those of TreeMap. */
+    template <typename K>
+    static constexpr bool isLookupKey{
+        details::LookupKey<K,
+                           KeyT,
+                           typename Registry::hasher,
+                           typename Registry::key_equal>};
+
+    template <typename K>
+    static auto asLookupKey(const K& key) -> decltype(auto)
+    {
+        return details::lookup_key<KeyT,
+                                   typename Registry::hasher,
+                                   typename Registry::key_equal>(key);
+    }
+
+    /* Child found by the last nthChild, see class comment. Reset by every
+     * structural edit. */
+    struct ChildCursor {
+        int64_t parent{-1};
+        int64_t position{0};
+        int64_t child{-1};
+    };
+
+    Tree tree;
+    Registry registry;
+    mutable ChildCursor cursor;
+
+    template <std::default_initializable,
+              std::default_initializable,
+              typename,
+              template <typename...> class>
+    friend class LinearTreeMap;
+
+public:
+    LinearTreeMap()
+        : LinearTreeMap{Allocator{}}
+    {
+    }
+
+    explicit LinearTreeMap(const Allocator& alloc)
+        : tree{typename Tree::allocator_type{alloc}}
+        , registry{typename Registry::allocator_type{alloc}}
+    {
+    }
+
+    LinearTreeMap(const LinearTreeMap&) = default;
+
+    LinearTreeMap(const LinearTreeMap& other, const Allocator& alloc)
+        : tree{other.tree, typename Tree::allocator_type{alloc}}
+        , registry{other.registry, typename Registry::allocator_type{alloc}}
+        , cursor{other.cursor}
+    {
+    }
+
+    LinearTreeMap(LinearTreeMap&&) = default;
+
+    LinearTreeMap(LinearTreeMap&& other, const Allocator& alloc)
+        : tree{std::move(other.tree), typename Tree::allocator_type{alloc}}
+        , registry{std::move(other.registry),
+                   typename Registry::allocator_type{alloc}}
+        , cursor{other.cursor}
+    {
+    }
+
+    auto operator=(const LinearTreeMap&) -> LinearTreeMap& = default;
+
+    auto operator=(LinearTreeMap&&) -> LinearTreeMap& = default;
+
+    auto get_allocator() const -> Allocator
+    {
+        return Allocator(tree.get_allocator());
+    }
+
+    auto subTreeMap(const KeyT& key) const -> LinearTreeMap
+    {
+        return mapped(std::identity{}, key);
+    }
+
+    auto addChild(KeyT key,
+                  PayloadT payload,
+                  const std::optional<KeyT>& parent,
+                  std::optional<int64_t> insertBeforePosition = std::nullopt)
+        -> void
+    {
+        if (hasNode(key)) {
+            throw std::runtime_error{"Unique key constraint failed"};
+        }
+        const auto parentIndex = tryLocateNode(parent);
+        cursor = {};
+        const auto child = tree.insert(
+            iteratorAt(parentIndex),
+            entry_t{key, std::move(payload)},
+            insertBeforePosition.transform(
+                [](int64_t pos) { return DestinationPosition{pos}; }));
+        registry.insert({std::move(key), tree.find_true_index(child)});
+    }
+
+    /* Insert copies of top-level nodes of addedTreeMap along with their
+     * subtrees as children of parent. Throws without changing the tree if
+     * any of the keys is already present. */
+    auto addSubtree(const LinearTreeMap& addedTreeMap,
+                    const std::optional<KeyT>& parent,
+                    const std::optional<int64_t>& insertBeforePosition) -> void
+    {
+        for (const auto& entry : addedTreeMap.tree) {
+            if (hasNode(entry.first)) {
+                throw std::runtime_error{"Unique key constraint failed"};
+            }
+        }
+        const auto parentIndex = tryLocateNode(parent);
+        cursor = {};
+
+        // Indexes of copies by indexes of nodes of added tree
+        std::vector<int64_t> copies(
+            addedTreeMap.tree.storage.parents.size(), parentIndex);
+        int64_t pos{insertBeforePosition.value_or(0)};
+        addedTreeMap.forEachIn(0, [&](int64_t index) {
+            const auto& entry = addedTreeMap.tree.payload_of(index);
+            const auto addedParent = addedTreeMap.tree.parent_of(index);
+            const auto copy =
+                addedParent == 0
+                    ? tree.insert(iteratorAt(parentIndex),
+                                  entry,
+                                  DestinationPosition{pos++})
+                    : tree.insert(iteratorAt(copies[offset(addedParent)]),
+                                  entry);
+            copies[offset(index)] = tree.find_true_index(copy);
+            registry.insert({entry.first, copies[offset(index)]});
+        });
+    }
+
+    /* Func is (const PayloadT&) -> TransPayload */
+    template <typename Func>
+    auto mapped(Func func,
+                const std::optional<KeyT>& initial = std::nullopt) const
+        -> MappedTreeMap<Func>
+    {
+        MappedTreeMap<Func> mappedTreeMap{
+            typename MappedTreeMap<Func>::allocator_type{get_allocator()}};
+        const auto first = tryLocateNode(initial);
+
+        std::vector<int64_t> copies(tree.storage.parents.size(), 0);
+        forEachIn(first, [&](int64_t index) {
+            const auto& [key, payload] = tree.payload_of(index);
+            const auto parent =
+                index == first ? 0 : copies[offset(tree.parent_of(index))];
+            copies[offset(index)] =
+                mappedTreeMap.appendChild(parent, KeyT{key}, func(payload));
+        });
+
+        return mappedTreeMap;
+    }
+
+    /* Return view to all keys in unspecified order. */
+    auto keysView() const { return std::views::keys(registry); }
+
+    /* Return view to all payloads in preorder. */
+    auto payloadView() const { return std::views::values(tree); }
+
+    /* Return view to all entries in preorder. */
+    auto entriesView() const { return std::views::all(tree); }
+
+    template <typename K = KeyT>
+    auto parent(const K& child) const
+        -> std::optional<std::reference_wrapper<const KeyT>>
+        requires isLookupKey<K>
+    {
+        const auto it = registry.find(asLookupKey(child));
+        if (it == cend(registry)) {
+            throw std::runtime_error{"Asking for parent of non-existing key"};
+        }
+        const auto parentIndex = tree.parent_of(it->second);
+        if (parentIndex == 0) {
+            return std::nullopt;
+        }
+        return std::optional<std::reference_wrapper<const KeyT>>{
+            tree.payload_of(parentIndex).first};
+    }
+
+    template <typename K = KeyT>
+    auto payload(const K& key) const
+        -> std::optional<std::reference_wrapper<const PayloadT>>
+        requires isLookupKey<K>
+    {
+        if (auto it = registry.find(asLookupKey(key)); it != cend(registry)) {
+            return {tree.payload_of(it->second).second};
+        }
+        return std::nullopt;
+    }
+
+    /* Return view to (keys) children of node with given key. If key is invalid
+     * returns view to root's children. */
+    template <typename K = KeyT>
+    auto children(const K& key) const
+        requires isLookupKey<K>
+    {
+        const auto it = registry.find(asLookupKey(key));
+        return childKeys(it != cend(registry) ? it->second : 0);
+    }
+
+    /* Return view to children (keys) of root node (top-level children). */
+    auto children() const { return childKeys(0); }
+
+    template <typename K = KeyT>
+    auto nthChild(const K& key, size_t n) const
+        -> std::optional<std::reference_wrapper<const PayloadT>>
+        requires isLookupKey<K>
+    {
+        if (auto it = registry.find(asLookupKey(key)); it != cend(registry)) {
+            return nthChildPayload(it->second, n);
+        }
+        return std::nullopt;
+    }
+
+    auto nthChild(size_t n) const
+        -> std::optional<std::reference_wrapper<const PayloadT>>
+    {
+        return nthChildPayload(0, n);
+    }
+
+    // Returns node position among it's parent's children. //
+    template <typename K = KeyT>
+    auto positionInChildren(const K& key) const -> std::optional<size_t>
+        requires isLookupKey<K>
+    {
+        if (auto it = registry.find(asLookupKey(key)); it != cend(registry)) {
+            return static_cast<size_t>(tree.position_of(it->second));
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] auto leaves() const -> std::vector<PayloadT>
+    {
+        std::vector<PayloadT> nodes;
+        forEachIn(0, [&](int64_t index) {
+            if (tree.child_count_of(index) == 0) {
+                nodes.push_back(tree.payload_of(index).second);
+            }
+        });
+        return nodes;
+    }
+
+    /* Func is (const KeyT&, const PayloadT&) -> void */
+    template <typename Func>
+    auto dfs(Func func, const std::optional<KeyT>& initial = std::nullopt) const
+        -> void
+    {
+        forEachIn(tryLocateNode(initial), [&](int64_t index) {
+            const auto& [key, payload] = tree.payload_of(index);
+            func(key, payload);
+        });
+    }
+
+    auto flatten() const -> std::vector<std::optional<entry_t>>
+    {
+        std::vector<std::optional<entry_t>> flattened;
+        flattened.reserve(2 * registry.size() + 3);
+        flattenTo(std::back_inserter(flattened));
+        return flattened;
+    }
+
+    /* Write flattened sequence to out entry by entry instead of collecting
+     * it into a vector. */
+    template <std::output_iterator<std::optional<entry_t>> O>
+    auto flattenTo(O out) const -> O
+    {
+        return details::flatten_to(
+            int64_t{0},
+            std::optional<entry_t>{tree.payload_of(0)},
+            [this](int64_t index) { return tree.child_indexes(index); },
+            [this](int64_t index) {
+                return std::optional<entry_t>{tree.payload_of(index)};
+            },
+            std::move(out));
+    }
+
+    static auto unflatten(std::span<const std::optional<entry_t>> flat,
+                          const Allocator& alloc = {}) -> LinearTreeMap
+    {
+        Unflattener unflattener{alloc};
+        for (const auto& entry : flat) {
+            if (unflattener.done()) {
+                break;
+            }
+            unflattener.push(entry);
+        }
+        return unflattener.finish();
+    }
+
+    /* Write binary image of the tree with keys section, see TreeImage.h. */
+    auto writeImage(std::ostream& os) const -> void
+        requires details::ImageStorable<KeyT> and
+                 details::ImageStorable<PayloadT>
+    {
+        std::vector<int64_t> positions(tree.storage.parents.size(), -1);
+        std::vector<int64_t> parents;
+        parents.reserve(registry.size());
+        forEachIn(0, [&](int64_t index) {
+            positions[offset(index)] = std::ssize(parents);
+            parents.push_back(positions[offset(tree.parent_of(index))]);
+        });
+
+        details::write_image<KeyT, PayloadT>(
+            os, parents, std::views::keys(tree), std::views::values(tree));
+    }
+
+    /* Build tree from binary image written by writeImage of any tree map.
+     * Throws std::invalid_argument if image is not valid and
+     * std::runtime_error if it holds duplicate keys. */
+    static auto fromImage(std::span<const std::byte> image,
+                          const Allocator& alloc = {}) -> LinearTreeMap
+        requires details::ImageStorable<KeyT> and
+                 details::ImageStorable<PayloadT>
+    {
+        const TreeImageView<PayloadT> view{image};
+        const auto keys = view.template keys<KeyT>();
+        const auto payloads = view.payloads();
+
+        LinearTreeMap result{alloc};
+        result.tree = Tree::from_parent_indexes(
+            view.parent_indexes(),
+            std::views::iota(size_t{0}, keys.size()) |
+                std::views::transform([&](size_t i) {
+                    return entry_t{keys[i], payloads[i]};
+                }),
+            typename Tree::allocator_type{alloc});
+        // Nodes are stored in the order of the image, see
+        // LinearTree::from_parent_indexes
+        result.registry.reserve(keys.size());
+        for (size_t i{0}; i < keys.size(); ++i) {
+            if (not result.registry.emplace(keys[i], static_cast<int64_t>(i) + 1)
+                        .second) {
+                throw std::runtime_error{"Unique key constraint failed"};
+            }
+        }
+        return result;
+    }
+
+    /* Push-based counterpart of unflatten, see TreeMap::Unflattener. */
+    class Unflattener {
+    public:
+        explicit Unflattener(const Allocator& alloc = {})
+            : tree{alloc}
+        {
+        }
+
+        auto push(std::optional<entry_t> entry) -> void
+        {
+            decoder.push(std::move(entry), [this](int64_t parent, entry_t&& e) {
+                return tree.appendChild(
+                    parent, std::move(e.first), std::move(e.second));
+            });
+        }
+
+        template <std::ranges::input_range R> auto pushRange(R&& chunk) -> void
+        {
+            for (auto&& entry : chunk) {
+                push(std::forward<decltype(entry)>(entry));
+            }
+        }
+
+        /* Whether the sequence is complete, further entries are ignored. */
+        auto done() const -> bool { return decoder.done(); }
+
+        /* Return tree decoded so far. */
+        auto finish() -> LinearTreeMap { return std::move(tree); }
+
+    private:
+        LinearTreeMap tree;
+        details::FlattenedDecoder<int64_t> decoder{0};
+    };
+
+    auto keys() const { return std::views::keys(registry); }
+
+    template <typename K = KeyT>
+    auto hasNode(const K& node) const -> bool
+        requires isLookupKey<K>
+    {
+        return registry.contains(asLookupKey(node));
+    }
+
+    auto removeNodes(const std::optional<KeyT>& parent,
+                     int64_t row,
+                     int64_t count) -> void
+    {
+        const auto parentIndex = tryLocateNode(parent);
+        if (row < 0 or count < 0 or
+            row + count > tree.child_count_of(parentIndex)) {
+            throwIndexingError("remove", parent, row, count);
+        }
+        cursor = {};
+        auto child = tree.nth_child(parentIndex, row);
+        for (int64_t i{0}; i < count; ++i) {
+            const auto next = tree.next_sibling_of(child);
+            removeSubtree(child);
+            child = next;
+        }
+    }
+
+    template <typename K = KeyT>
+    auto removeNode(const K& key) -> void
+        requires isLookupKey<K>
+    {
+        const auto it = registry.find(asLookupKey(key));
+        if (it == cend(registry)) {
+            std::stringstream ss;
+            ss << "Error removing node: " << key;
+            throw std::runtime_error{ss.str()};
+        }
+        cursor = {};
+        removeSubtree(it->second);
+    }
+
+    auto moveNodes(const std::optional<KeyT>& sourceParent,
+                   int64_t sourceRow,
+                   int64_t count,
+                   const std::optional<KeyT>& destinationParent,
+                   int64_t destinationChild) -> void
+    {
+        if (destinationParent and not hasNode(destinationParent.value())) {
+            throw std::runtime_error{"Wrong destination when moving nodes"};
+        }
+        const auto source = tryLocateNode(sourceParent);
+        if (sourceRow < 0 or count < 0 or
+            sourceRow + count > tree.child_count_of(source)) {
+            throwIndexingError("move", sourceParent, sourceRow, count);
+        }
+        const auto destination = tryLocateNode(destinationParent);
+        cursor = {};
+        // Children past the end of destination are appended, as in TreeMap
+        tree.move_nodes(iteratorAt(source),
+                        SourcePosition{sourceRow},
+                        Count{count},
+                        iteratorAt(destination),
+                        DestinationPosition{std::min(
+                            destinationChild, tree.child_count_of(destination))});
+    }
+
+    auto display() const -> std::string
+    {
+        std::stringstream ss;
+        std::vector<int> levels(tree.storage.parents.size(), -1);
+        forEachIn(0, [&](int64_t index) {
+            const auto level = levels[offset(tree.parent_of(index))] + 1;
+            levels[offset(index)] = level;
+            for (auto i = 0; i < level; ++i) {
+                ss << "   ";
+            }
+            const auto& [key, payload] = tree.payload_of(index);
+            ss << key << " -> " << payload << '\n';
+        });
+        return ss.str();
+    }
+
+private:
+    static auto offset(int64_t index) -> size_t
+    {
+        return static_cast<size_t>(index);
+    }
+
+    auto iteratorAt(int64_t index) -> TreeIterator
+    {
+        return TreeIterator{index, &tree};
+    }
+
+    /* Visit indexes of nodes of subtree in preorder, all nodes of the tree
+     * when index is the fake root's 0.
+     *
+     * Func is (int64_t index) -> void */
+    template <typename Func>
+    auto forEachIn(int64_t subtreeRoot, Func func) const -> void
+    {
+        const auto stop =
+            tree.preorder_successor(tree.last_descendant(subtreeRoot));
+        for (auto current = subtreeRoot == 0 ? tree.preorder_successor(0)
+                                             : subtreeRoot;
+             current != stop;
+             current = tree.preorder_successor(current)) {
+            func(current);
+        }
+    }
+
+    auto childKeys(int64_t index) const
+    {
+        return std::views::transform(
+            tree.child_indexes(index),
+            [this](int64_t child) { return tree.payload_of(child).first; });
+    }
+
+    auto nthChildPayload(int64_t parent, size_t n) const
+        -> std::optional<std::reference_wrapper<const PayloadT>>
+    {
+        const auto count = tree.child_count_of(parent);
+        const auto pos = static_cast<int64_t>(std::min(n, offset(count)));
+        if (pos == count) {
+            return std::nullopt;
+        }
+
+        auto child = int64_t{-1};
+        if (cursor.parent == parent and
+            std::abs(pos - cursor.position) <= std::min(pos, count - 1 - pos)) {
+            child = cursor.child;
+            for (auto at = cursor.position; at < pos; ++at) {
+                child = tree.next_sibling_of(child);
+            }
+            for (auto at = cursor.position; at > pos; --at) {
+                child = tree.prev_sibling_of(child);
+            }
+        }
+        else {
+            child = tree.nth_child(parent, pos);
+        }
+        cursor = {parent, pos, child};
+        return tree.payload_of(child).second;
+    }
+
+    /* Append new node as last child of parent, which is known to be in the
+     * tree. Throws if key is already present. */
+    auto appendChild(int64_t parent, KeyT key, PayloadT payload)
+        -> int64_t
+    {
+        if (registry.contains(key)) {
+            throw std::runtime_error{"Unique key constraint failed"};
+        }
+        const auto index = tree.find_true_index(
+            tree.insert(iteratorAt(parent), entry_t{key, std::move(payload)}));
+        registry.emplace(std::move(key), index);
+        return index;
+    }
+
+    /* Erase node along with its subtree and forget their keys. */
+    auto removeSubtree(int64_t index) -> void
+    {
+        forEachIn(index, [this](int64_t node) {
+            registry.erase(tree.payload_of(node).first);
+        });
+        tree.erase(iteratorAt(index));
+    }
+
+    /* Return index of node with given key if it is in the tree, otherwise
+     * throws. Returns index of fake root when key is not given. */
+    auto tryLocateNode(const std::optional<KeyT>& key) const -> int64_t
+    {
+        if (not key) {
+            return 0;
+        }
+        if (auto it = registry.find(*key); it != cend(registry)) {
+            return it->second;
+        }
+        std::stringstream ss;
+        ss << "Trying to access node that is not in the tree: " << *key;
+        throw std::runtime_error{ss.str()};
+    }
+
+    [[noreturn]] static auto throwIndexingError(std::string_view operation,
+                                                const std::optional<KeyT>& parent,
+                                                int64_t row,
+                                                int64_t count) -> void
+    {
+        std::stringstream ss;
+        ss << "Indexing error when attempting to " << operation
+           << " nodes. Parent: ";
+        if (parent) {
+            ss << *parent;
+        }
+        else {
+            ss << "null";
+        }
+        ss << " row: " << row << " count: " << count;
+        throw std::runtime_error{ss.str()};
+    }
+};
+
+template <class CharT,
+          class Traits,
+          class KeyT,
+          class PayloadT,
+          class Allocator,
+          template <typename...> class RegistryMap>
+std::basic_ostream<CharT, Traits>&
+operator<<(std::basic_ostream<CharT, Traits>& os,
+           const LinearTreeMap<KeyT, PayloadT, Allocator, RegistryMap>& tree)
+{
+    os << "LinearTreeMap\n" << tree.display();
+    return os;
+}
+
+/* Return entries in DFS traversal order */
+template <typename K,
+          typename P,
+          typename A,
+          template <typename...> class R>
+auto entriesDFS(const LinearTreeMap<K, P, A, R>& tree)
+    -> std::vector<typename LinearTreeMap<K, P, A, R>::entry_t>
+{
+    return {tree.entriesView().begin(), tree.entriesView().end()};
+}
+
+template <typename K,
+          typename P,
+          typename A,
+          template <typename...> class R>
+auto operator==(const LinearTreeMap<K, P, A, R>& lhs,
+                const LinearTreeMap<K, P, A, R>& rhs) -> bool
+{
+    return std::ranges::equal(lhs.entriesView(), rhs.entriesView());
+}
+
+template <typename K,
+          typename P,
+          typename A,
+          template <typename...> class R,
+          typename Comp =
+              std::equal_to<typename LinearTreeMap<K, P, A, R>::entry_t>>
+auto compare(const LinearTreeMap<K, P, A, R>& lhs,
+             const LinearTreeMap<K, P, A, R>& rhs,
+             Comp comp = Comp{}) -> bool
+{
+    return std::ranges::equal(lhs.entriesView(), rhs.entriesView(), comp);
+}
+
+namespace pmr {
+
+template <std::default_initializable KeyT, std::default_initializable PayloadT>
+using LinearTreeMap = ds::LinearTreeMap<
+    KeyT,
+    PayloadT,
+    std::pmr::polymorphic_allocator<std::pair<const KeyT, PayloadT>>>;
+
+} // namespace pmr
+
+} // namespace ds
+
+#endif /* end of include guard: LINEARTREEMAP_H_K4PZ7WQM */
@@ -0,0 +1,129 @@
+#ifndef NODEARENA_H_QJ3VXWPD
+#define NODEARENA_H_QJ3VXWPD
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <type_traits>
+
+namespace details {
+
+/* Slab of memory shared by all nodes of arena-backed trees. Nodes are carved
+ * from chunks grouped by block size, freed blocks are reused by subsequent
+ * allocations and all chunks are returned upstream at once when arena is
+ * destroyed. */
+class NodeArena : public std::enable_shared_from_this<NodeArena> {
+public:
+    auto allocate(size_t bytes, size_t alignment) -> void*
+    {
+        return pool.allocate(bytes, alignment);
+    }
+
+    auto deallocate(void* p, size_t bytes, size_t alignment) -> void
+    {
+        pool.deallocate(p, bytes, alignment);
+    }
+
+private:
+    std::pmr::unsynchronized_pool_resource pool;
+};
+
+template <typename Allocator> class ArenaOwner;
+
+} // namespace details
+
+namespace ds {
+
+/* Allocator handing out memory from NodeArena.
+ *
+ * Allocator does not own the arena, it is kept alive by trees using it
+ * instead (see details::ArenaOwner). Default constructed allocator has no
+ * arena and tree constructed with it creates a new one. Copies of the tree
+ * get their own arena, while moves, subtrees and trees derived from the tree
+ * (filter, transform, etc.) share the arena of the source tree.
+ *
+ * Not thread-safe, trees sharing the arena must not be modified
+ * concurrently. */
+template <typename T> class ArenaAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    ArenaAllocator() noexcept = default;
+
+    explicit ArenaAllocator(details::NodeArena* arena_) noexcept
+        : arena{arena_}
+    {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+        : arena{other.arena}
+    {
+    }
+
+    auto allocate(size_t n) -> T*
+    {
+        assert(arena && "Allocator is not bound to arena");
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    auto deallocate(T* p, size_t n) -> void
+    {
+        arena->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    auto select_on_container_copy_construction() const -> ArenaAllocator
+    {
+        return ArenaAllocator{};
+    }
+
+    friend auto operator==(const ArenaAllocator&,
+                           const ArenaAllocator&) noexcept -> bool = default;
+
+private:
+    template <typename U> friend class ArenaAllocator;
+    template <typename Allocator> friend class details::ArenaOwner;
+
+    details::NodeArena* arena{nullptr};
+};
+
+} // namespace ds
+
+namespace details {
+
+/* Keeps memory of arena allocators alive for as long as some container using
+ * it exists. Empty for all other allocators, which are used as is. */
+template <typename Allocator> class ArenaOwner {
+public:
+    auto adopt(const Allocator& alloc) -> const Allocator& { return alloc; }
+
+    auto sole_owner() const -> bool { return false; }
+};
+
+template <typename T> class ArenaOwner<ds::ArenaAllocator<T>> {
+public:
+    /* Share ownership of allocator arena or create new arena for allocator
+     * that does not have one. Return allocator bound to owned arena. */
+    auto adopt(const ds::ArenaAllocator<T>& alloc) -> ds::ArenaAllocator<T>
+    {
+        arena = alloc.arena ? alloc.arena->shared_from_this()
+                            : std::make_shared<NodeArena>();
+        return ds::ArenaAllocator<T>{arena.get()};
+    }
+
+    /* Whether no other container uses the arena, so that memory of the nodes
+     * can be released in bulk when arena is destroyed. */
+    auto sole_owner() const -> bool { return arena.use_count() == 1; }
+
+private:
+    std::shared_ptr<NodeArena> arena;
+};
+
+} // namespace details
+
+#endif /* end of include guard: NODEARENA_H_QJ3VXWPD */
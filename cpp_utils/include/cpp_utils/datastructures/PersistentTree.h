@@ -0,0 +1,437 @@
+#ifndef PERSISTENTTREE_H_H8ZKQ2MC
+#define PERSISTENTTREE_H_H8ZKQ2MC
+
+#include "cpp_utils/algorithms/alg_ext.h"
+#include "cpp_utils/datastructures/TreeCommon.h"
+#include <concepts>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace ds {
+
+/* Tree sharing structure between its copies.
+ *
+ * Copying PersistentTree takes constant time, as the copy shares all nodes
+ * with the original. Modifications copy only those nodes on the path from the
+ * top of the tree to the modified node that are shared with other copies
+ * (path copying), all other subtrees stay shared. This makes copies cheap
+ * enough to keep many of them around as snapshots, i.e. for undo history or
+ * for read-only readers.
+ *
+ * Interface mirrors insert/erase/move_nodes/children of Tree with some
+ * differences:
+ *  - Payloads can not be modified through iterators, as they are shared.
+ *  - Node does not know its parent, as it might have different parents in
+ *    different versions, so iterators keep the whole path from the top of the
+ *    tree instead and are more expensive to copy.
+ *  - Any modification invalidates all iterators except the returned one.
+ *
+ * Different copies might be read and modified from different threads, but
+ * each copy must not be accessed concurrently while it is being modified. */
+template <std::default_initializable T> class PersistentTree {
+    struct Node;
+    using NodePtr = std::shared_ptr<Node>;
+
+    struct Node {
+        Node() = default;
+
+        explicit Node(T payload_)
+            : payload{std::move(payload_)}
+        {
+        }
+
+        Node(const Node&) = default;
+
+        auto operator=(const Node&) -> Node& = delete;
+
+        /* Releases exclusively owned descendants iteratively, so that
+         * destroying deep subtree does not recurse. */
+        ~Node()
+        {
+            auto pending = std::move(children);
+            while (not pending.empty()) {
+                auto node = std::move(pending.back());
+                pending.pop_back();
+                if (node.use_count() == 1) {
+                    std::ranges::move(node->children,
+                                      std::back_inserter(pending));
+                    node->children.clear();
+                }
+            }
+        }
+
+        T payload{};
+        std::vector<NodePtr> children;
+        /* Number of nodes in subtree including the node itself. */
+        int64_t subtree_size{1};
+    };
+
+public:
+    using value_type = T;
+
+    /* Bidirectional iterator visiting nodes in preorder. */
+    class const_iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using element_type = const T;
+
+        friend class PersistentTree;
+
+        const_iterator() = default;
+
+        auto operator*() const -> element_type& { return node()->payload; }
+
+        auto operator->() const -> element_type* { return &node()->payload; }
+
+        auto operator++() -> const_iterator&
+        {
+            if (path.empty()) {
+                return *this;
+            }
+            if (const auto* current = node(); not current->children.empty()) {
+                path.push_back({current->children.front().get(), 0});
+                return *this;
+            }
+            while (not path.empty()) {
+                const auto pos = path.back().pos;
+                path.pop_back();
+                const auto& siblings = node_or_root()->children;
+                if (pos + 1 < std::ssize(siblings)) {
+                    path.push_back(
+                        {siblings[static_cast<size_t>(pos) + 1].get(),
+                         pos + 1});
+                    break;
+                }
+            }
+            return *this;
+        }
+
+        auto operator++(int) -> const_iterator
+        {
+            auto tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        auto operator--() -> const_iterator&
+        {
+            if (path.empty()) {
+                descend_rightmost();
+                return *this;
+            }
+            const auto pos = path.back().pos;
+            path.pop_back();
+            if (pos > 0) {
+                path.push_back(
+                    {node_or_root()->children[static_cast<size_t>(pos) - 1]
+                         .get(),
+                     pos - 1});
+                descend_rightmost();
+            }
+            return *this;
+        }
+
+        auto operator--(int) -> const_iterator
+        {
+            auto tmp = *this;
+            --(*this);
+            return tmp;
+        }
+
+        friend auto operator==(const const_iterator& lhs,
+                               const const_iterator& rhs) -> bool
+        {
+            return lhs.node() == rhs.node();
+        }
+
+        friend auto operator!=(const const_iterator& lhs,
+                               const const_iterator& rhs) -> bool
+        {
+            return not(lhs == rhs);
+        }
+
+    private:
+        struct Step {
+            const Node* node;
+            int64_t pos;
+        };
+
+        /* Nodes from the top of the tree down to the pointed one along with
+         * their positions in their parent children. Empty for end(). */
+        std::vector<Step> path;
+        const Node* root{nullptr};
+
+        const_iterator(std::vector<Step> path_, const Node* root_)
+            : path{std::move(path_)}
+            , root{root_}
+        {
+        }
+
+        auto node() const -> const Node*
+        {
+            return path.empty() ? nullptr : path.back().node;
+        }
+
+        auto node_or_root() const -> const Node*
+        {
+            return path.empty() ? root : path.back().node;
+        }
+
+        auto descend_rightmost() -> void
+        {
+            for (const auto* current = node_or_root();
+                 not current->children.empty();
+                 current = path.back().node) {
+                path.push_back({current->children.back().get(),
+                                std::ssize(current->children) - 1});
+            }
+        }
+    };
+
+    using iterator = const_iterator;
+
+    PersistentTree() = default;
+
+    auto begin() const -> const_iterator
+    {
+        if (root->children.empty()) {
+            return end();
+        }
+        return const_iterator{{{root->children.front().get(), 0}}, root.get()};
+    }
+
+    auto end() const -> const_iterator
+    {
+        return const_iterator{{}, root.get()};
+    }
+
+    auto cbegin() const -> const_iterator { return begin(); }
+
+    auto cend() const -> const_iterator { return end(); }
+
+    auto insert(const_iterator parent, T payload) -> const_iterator
+    {
+        const DestinationPosition position{
+            std::ssize(node_of(parent)->children)};
+        return insert(parent, std::move(payload), position);
+    }
+
+    auto insert(const_iterator parent,
+                T payload,
+                DestinationPosition insert_pos) -> const_iterator
+    {
+        throw_if_invalid_destination(*node_of(parent), insert_pos);
+
+        auto chain = unshare(parent);
+        auto& siblings = chain.back()->children;
+        auto child = std::make_shared<Node>(std::move(payload));
+        auto* child_ptr = child.get();
+        siblings.insert(siblings.begin() + insert_pos, std::move(child));
+        for (auto* node : chain) {
+            ++node->subtree_size;
+        }
+
+        auto path = std::move(parent.path);
+        for (size_t i{0}; i < path.size(); ++i) {
+            path[i].node = chain[i + 1];
+        }
+        path.push_back({child_ptr, insert_pos});
+        return const_iterator{std::move(path), root.get()};
+    }
+
+    auto erase(const_iterator subtree_root) -> void
+    {
+        if (subtree_root == end()) {
+            return;
+        }
+        const auto pos = subtree_root.path.back().pos;
+        subtree_root.path.pop_back();
+
+        auto chain = unshare(subtree_root);
+        auto& siblings = chain.back()->children;
+        const auto erased = siblings[static_cast<size_t>(pos)]->subtree_size;
+        siblings.erase(siblings.begin() + pos);
+        for (auto* node : chain) {
+            node->subtree_size -= erased;
+        }
+    }
+
+    /* Move count children of source_parent starting at source_pos to
+     * destination_parent, so that they are inserted before child at
+     * destination_pos. Throws std::invalid_argument when destination is
+     * inside one of the moved subtrees. */
+    auto move_nodes(const_iterator source_parent,
+                    SourcePosition source_pos,
+                    Count count,
+                    const_iterator destination_parent,
+                    DestinationPosition destination_pos) -> void
+    {
+        const auto* source_node = node_of(source_parent);
+        if (source_pos < 0 or count < 0 or
+            source_pos + count > std::ssize(source_node->children)) {
+            throw std::out_of_range{"Source position out of range"};
+        }
+        throw_if_invalid_destination(*node_of(destination_parent),
+                                     destination_pos);
+
+        if (source_parent == destination_parent) {
+            auto& children = unshare(source_parent).back()->children;
+            alg::slide(children.begin() + source_pos,
+                       children.begin() + source_pos + count,
+                       children.begin() + destination_pos);
+            return;
+        }
+
+        // Removing moved nodes shifts destination path if it goes through
+        // later siblings of the moved nodes
+        auto& destination_path = destination_parent.path;
+        const auto depth = source_parent.path.size();
+        if (destination_path.size() > depth and
+            std::ranges::equal(
+                std::span{destination_path}.first(depth),
+                source_parent.path,
+                {},
+                &const_iterator::Step::node,
+                &const_iterator::Step::node)) {
+            auto& step = destination_path[depth];
+            if (step.pos >= source_pos + count) {
+                step.pos -= count;
+            }
+            else if (step.pos >= source_pos) {
+                throw std::invalid_argument{
+                    "Destination is inside of moved subtree"};
+            }
+        }
+
+        auto source_chain = unshare(source_parent);
+        auto& source_children = source_chain.back()->children;
+        const auto first = source_children.begin() + source_pos;
+        const auto last = first + count;
+        std::vector<NodePtr> moved{std::make_move_iterator(first),
+                                   std::make_move_iterator(last)};
+        source_children.erase(first, last);
+        int64_t moved_size{0};
+        for (const auto& node : moved) {
+            moved_size += node->subtree_size;
+        }
+        for (auto* node : source_chain) {
+            node->subtree_size -= moved_size;
+        }
+
+        auto destination_chain = unshare(destination_parent);
+        auto& destination_children = destination_chain.back()->children;
+        destination_children.insert(destination_children.begin() +
+                                        destination_pos,
+                                    std::make_move_iterator(moved.begin()),
+                                    std::make_move_iterator(moved.end()));
+        for (auto* node : destination_chain) {
+            node->subtree_size += moved_size;
+        }
+    }
+
+    auto parent(const_iterator it) const -> const_iterator
+    {
+        if (not it.path.empty()) {
+            it.path.pop_back();
+        }
+        return it;
+    }
+
+    auto children(const_iterator it) const
+    {
+        return std::views::transform(
+            node_of(it)->children,
+            [](const NodePtr& node) -> const T& { return node->payload; });
+    }
+
+    auto empty() const -> bool { return root->children.empty(); }
+
+    /* Return number of nodes in the tree in constant time. */
+    auto size() const -> int
+    {
+        return static_cast<int>(root->subtree_size - 1);
+    }
+
+    /* Compare trees structurally. Subtrees shared by both trees are not
+     * traversed. */
+    friend auto operator==(const PersistentTree& lhs, const PersistentTree& rhs)
+        -> bool
+    {
+        std::vector<std::pair<const Node*, const Node*>> frontier{
+            {lhs.root.get(), rhs.root.get()}};
+        while (not frontier.empty()) {
+            auto [left, right] = frontier.back();
+            frontier.pop_back();
+            if (left == right) {
+                continue;
+            }
+            if (left->subtree_size != right->subtree_size or
+                left->children.size() != right->children.size() or
+                (left != lhs.root.get() and left->payload != right->payload)) {
+                return false;
+            }
+            for (size_t i{0}; i < left->children.size(); ++i) {
+                frontier.push_back(
+                    {left->children[i].get(), right->children[i].get()});
+            }
+        }
+        return true;
+    }
+
+private:
+    /* Fake root, its children are top-level nodes. */
+    NodePtr root{std::make_shared<Node>()};
+
+    auto node_of(const const_iterator& it) const -> const Node*
+    {
+        return it.path.empty() ? root.get() : it.path.back().node;
+    }
+
+    /* Make nodes on the path from the fake root to it owned by this tree
+     * exclusively, copying those shared with other trees. Return these nodes
+     * starting with the fake root. */
+    auto unshare(const const_iterator& it) -> std::vector<Node*>
+    {
+        std::vector<Node*> chain;
+        chain.reserve(it.path.size() + 1);
+        auto* slot = &root;
+        unshare_node(*slot);
+        chain.push_back(slot->get());
+        for (const auto& step : it.path) {
+            slot = &(*slot)->children[static_cast<size_t>(step.pos)];
+            unshare_node(*slot);
+            chain.push_back(slot->get());
+        }
+        return chain;
+    }
+
+    /* Node owned by single pointer can only be reached from this tree, as
+     * its ancestors are already unshared. */
+    static auto unshare_node(NodePtr& node) -> void
+    {
+        if (node.use_count() > 1) {
+            node = std::make_shared<Node>(*node);
+        }
+    }
+
+    static auto throw_if_invalid_destination(const Node& parent,
+                                             DestinationPosition position)
+        -> void
+    {
+        if (position < 0 or position > std::ssize(parent.children)) {
+            throw std::out_of_range{"Destination out of range"};
+        }
+    }
+};
+
+static_assert(std::bidirectional_iterator<PersistentTree<int>::const_iterator>);
+
+} // namespace ds
+
+#endif /* end of include guard: PERSISTENTTREE_H_H8ZKQ2MC */
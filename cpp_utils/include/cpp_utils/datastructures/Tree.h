@@ -2,13 +2,17 @@
 #define TREE_H_1MKPBXLX
 
 #include "cpp_utils/algorithms/alg_ext.h"
+#include "cpp_utils/datastructures/NodeArena.h"
 #include "cpp_utils/datastructures/TreeCommon.h"
+#include "cpp_utils/datastructures/TreeImage.h"
 #include "cpp_utils/types/NamedType.h"
 #include <algorithm>
 #include <concepts>
+#include <deque>
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <memory_resource>
 #include <optional>
 #include <queue>
 #include <ranges>
@@ -20,27 +24,51 @@
 
 namespace ds {
 
-template <std::default_initializable T> class Tree {
+/* Tree of T allocating all its nodes and their child lists with Allocator.
+ *
+ * Allocators are propagated following the usual container rules: copies use
+ * select_on_container_copy_construction, assignments propagate allocator
+ * only if corresponding propagate_on_container_* trait says so, otherwise
+ * nodes are recreated with allocator of the assigned to tree. Payloads are
+ * constructed with uses-allocator construction, so allocator-aware payloads
+ * (e.g. std::pmr::string in ds::pmr::Tree) share memory resource with the
+ * tree. */
+template <std::default_initializable T, typename Allocator = std::allocator<T>>
+class Tree {
+    static_assert(
+        std::same_as<typename std::allocator_traits<Allocator>::value_type, T>,
+        "Allocator::value_type must be the same as value type of the tree");
+
 private:
+    struct Node;
+    using NodePtr = details::NodePtr<Node, Allocator>;
+    using NodePtrAllocator = details::Rebind<Allocator, NodePtr>;
+    using AllocatorTraits = std::allocator_traits<Allocator>;
+
     struct Node {
-        friend class Tree;
+        template <std::default_initializable, typename> friend class Tree;
 
-        Node() = default;
+        explicit Node(const Allocator& alloc)
+            : children(NodePtrAllocator{alloc})
+            , payload{std::make_obj_using_allocator<T>(alloc)}
+        {
+        }
 
-        Node(T payload_)
-            : payload{payload_}
+        Node(T payload_, const Allocator& alloc)
+            : children(NodePtrAllocator{alloc})
+            , payload{std::make_obj_using_allocator<T>(alloc,
+                                                       std::move(payload_))}
         {
         }
 
-        auto insert(std::unique_ptr<Node> child) -> void
+        auto insert(NodePtr child) -> void
         {
             child->parent = this;
             children.push_back(std::move(child));
             rebuild_position_indexes(std::ssize(children) - 1);
         }
 
-        auto insert(std::unique_ptr<Node> child, DestinationPosition insert_pos)
-            -> void
+        auto insert(NodePtr child, DestinationPosition insert_pos) -> void
         {
             throw_if_invalid_destination(insert_pos);
             child->parent = this;
@@ -63,7 +91,7 @@ private:
             rebuild_position_indexes(it - children.begin());
         }
 
-        auto take(Node* node) -> std::unique_ptr<Node>
+        auto take(Node* node) -> NodePtr
         {
             auto it = std::ranges::find_if(
                 children, [&](auto& p) { return p.get() == node; });
@@ -112,7 +140,7 @@ private:
     private:
         Node* parent{nullptr};
         int64_t pos{0};
-        std::vector<std::unique_ptr<Node>> children;
+        std::vector<NodePtr, NodePtrAllocator> children;
         T payload{};
 
         auto rebuild_position_indexes(int64_t first)
@@ -160,9 +188,16 @@ public:
         std::invoke_result_t<TransformFunc,
                              std::invoke_result_t<Proj, const T&>>>;
 
+    template <typename TransformFunc, typename Proj>
+    using TransformResultTree =
+        Tree<TransformResultT<TransformFunc, Proj>,
+             details::Rebind<Allocator, TransformResultT<TransformFunc, Proj>>>;
+
+    /* Bidirectional iterator visiting nodes in preorder. Iterators keep
+     * pointer to the fake root, so that end iterator can be decremented. */
     template <typename v_type, typename node_type> class PreorderIterator {
     public:
-        using iterator_category = std::forward_iterator_tag;
+        using iterator_category = std::bidirectional_iterator_tag;
         using difference_type = std::ptrdiff_t;
         using element_type = v_type;
 
@@ -171,14 +206,9 @@ public:
 
         PreorderIterator() = default;
 
-        explicit PreorderIterator(node_type* p_)
-            : ptr{p_}
-        {
-        }
-
-        PreorderIterator(node_type* p_, node_type* prev_)
+        PreorderIterator(node_type* p_, node_type* root_)
             : ptr{p_}
-            , prev{prev_}
+            , root{root_}
         {
         }
 
@@ -192,7 +222,7 @@ public:
                      std::is_same_v<std::remove_const_t<node_type>, n_type>)
         PreorderIterator(const PreorderIterator<nv_type, n_type>& rhs)
             : ptr{rhs.ptr}
-            , prev{rhs.prev}
+            , root{rhs.root}
         {
         }
 
@@ -200,57 +230,11 @@ public:
 
         auto operator->() -> element_type* { return &ptr->payload; }
 
-        // auto operator++() -> PreorderIterator&
-        // {
-        //     if (ptr == nullptr) {
-        //         return *this; // Already at end
-        //     }
-        //
-        //     // If current node has children, go to first child
-        //     if (!ptr->children.empty() && prev == ptr->parent) {
-        //         prev = ptr;
-        //         ptr = ptr->children[0].get();
-        //         return *this;
-        //     }
-        //
-        //     // Try to go to next sibling
-        //     if (ptr->parent != nullptr &&
-        //         ptr->pos + 1 < ptr->parent->children.size()) {
-        //         prev = ptr;
-        //         ptr = ptr->parent->children[ptr->pos + 1].get();
-        //         return *this;
-        //     }
-        //
-        //     // Go up until we find a node with next sibling
-        //     auto current = ptr;
-        //     while (current->parent != nullptr) {
-        //         prev = current;
-        //         current = current->parent;
-        //
-        //         if (current->parent != nullptr &&
-        //             prev->pos + 1 < current->children.size()) {
-        //             ptr = current->children[prev->pos + 1].get();
-        //             return *this;
-        //         }
-        //     }
-        //
-        //     // Reached the end
-        //     prev = ptr;
-        //     ptr = nullptr;
-        //     return *this;
-        // }
-
         auto operator++() -> PreorderIterator&
         {
-            auto* tmp = ptr;
-            ptr = bottom_reached() ? ptr->parent : next_node();
-            prev = tmp;
-
-            // Node has been visited before, skip it
-            if (ptr and prev != ptr->parent) {
-                this->operator++(1);
+            if (ptr) {
+                ptr = preorder_successor(ptr);
             }
-
             return *this;
         }
 
@@ -261,6 +245,19 @@ public:
             return tmp;
         }
 
+        auto operator--() -> PreorderIterator&
+        {
+            ptr = preorder_predecessor(ptr, root);
+            return *this;
+        }
+
+        auto operator--(int) -> PreorderIterator
+        {
+            auto tmp = *this;
+            --(*this);
+            return tmp;
+        }
+
         friend auto operator==(const PreorderIterator& lhs,
                                const PreorderIterator& rhs) -> bool
         {
@@ -275,42 +272,202 @@ public:
 
     private:
         node_type* ptr{nullptr};
-        node_type* prev{nullptr};
+        node_type* root{nullptr};
+    };
+
+    /* Forward iterator visiting nodes in postorder, i.e. every node right
+     * after all of its descendants. Converts to preorder iterator pointing to
+     * the same node, so it can be passed to parent(), children() and the
+     * like. */
+    template <typename v_type, typename node_type> class PostorderIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using element_type = v_type;
+
+        friend class PostorderIterator<const v_type, const node_type>;
+        friend class Tree;
+
+        PostorderIterator() = default;
+
+        PostorderIterator(node_type* p_, node_type* root_)
+            : ptr{p_}
+            , root{root_}
+        {
+        }
+
+        PostorderIterator(const PostorderIterator&) = default;
+
+        template <typename n_type, typename nv_type>
+            requires(!std::is_const_v<n_type> && std::is_const_v<node_type> &&
+                     std::is_same_v<std::remove_const_t<node_type>, n_type>)
+        PostorderIterator(const PostorderIterator<nv_type, n_type>& rhs)
+            : ptr{rhs.ptr}
+            , root{rhs.root}
+        {
+        }
+
+        operator PreorderIterator<v_type, node_type>() const
+        {
+            return PreorderIterator<v_type, node_type>{ptr, root};
+        }
+
+        operator PreorderIterator<const v_type, const node_type>() const
+            requires(!std::is_const_v<node_type>)
+        {
+            return PreorderIterator<const v_type, const node_type>{ptr, root};
+        }
+
+        auto operator*() const -> element_type& { return ptr->payload; }
+
+        auto operator->() -> element_type* { return &ptr->payload; }
+
+        auto operator++() -> PostorderIterator&
+        {
+            if (ptr) {
+                ptr = postorder_successor(ptr);
+            }
+            return *this;
+        }
+
+        auto operator++(int) -> PostorderIterator
+        {
+            auto tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        friend auto operator==(const PostorderIterator& lhs,
+                               const PostorderIterator& rhs) -> bool
+        {
+            return lhs.ptr == rhs.ptr;
+        }
+
+    private:
+        node_type* ptr{nullptr};
+        node_type* root{nullptr};
+    };
+
+    /* Forward iterator visiting nodes level by level. Iterator owns queue of
+     * pending nodes, so copying it is not free. Converts to preorder iterator
+     * pointing to the same node. */
+    template <typename v_type, typename node_type> class LevelOrderIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using element_type = v_type;
+
+        friend class LevelOrderIterator<const v_type, const node_type>;
+        friend class Tree;
+
+        LevelOrderIterator() = default;
+
+        LevelOrderIterator(node_type* p_, node_type* root_)
+            : root{root_}
+        {
+            if (p_) {
+                frontier.push_back(p_);
+            }
+        }
+
+        LevelOrderIterator(const LevelOrderIterator&) = default;
+
+        template <typename n_type, typename nv_type>
+            requires(!std::is_const_v<n_type> && std::is_const_v<node_type> &&
+                     std::is_same_v<std::remove_const_t<node_type>, n_type>)
+        LevelOrderIterator(const LevelOrderIterator<nv_type, n_type>& rhs)
+            : frontier{rhs.frontier.begin(), rhs.frontier.end()}
+            , root{rhs.root}
+        {
+        }
+
+        operator PreorderIterator<v_type, node_type>() const
+        {
+            return PreorderIterator<v_type, node_type>{current(), root};
+        }
 
-        auto bottom_reached() const -> bool
+        operator PreorderIterator<const v_type, const node_type>() const
+            requires(!std::is_const_v<node_type>)
         {
-            // ptr points to leaf without siblings to the right
-            return ptr->children.empty() or
-                   (prev != ptr->parent and
-                    (prev->pos + 1 >= std::ssize(ptr->children)));
+            return PreorderIterator<const v_type, const node_type>{current(),
+                                                                   root};
         }
 
-        auto next_node() const -> node_type*
+        auto operator*() const -> element_type&
         {
-            // Pick first child if came from parent or next child if came from
-            // child.
-            const auto offset =
-                static_cast<size_t>(prev == ptr->parent ? 0 : prev->pos + 1);
-            return ptr->children[offset].get();
+            return frontier.front()->payload;
+        }
+
+        auto operator->() -> element_type*
+        {
+            return &frontier.front()->payload;
+        }
+
+        auto operator++() -> LevelOrderIterator&
+        {
+            if (frontier.empty()) {
+                return *this;
+            }
+            auto* node = frontier.front();
+            frontier.pop_front();
+            for (auto& child : node->children) {
+                frontier.push_back(child.get());
+            }
+            return *this;
+        }
+
+        auto operator++(int) -> LevelOrderIterator
+        {
+            auto tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        friend auto operator==(const LevelOrderIterator& lhs,
+                               const LevelOrderIterator& rhs) -> bool
+        {
+            return lhs.current() == rhs.current();
+        }
+
+    private:
+        std::deque<node_type*> frontier;
+        node_type* root{nullptr};
+
+        auto current() const -> node_type*
+        {
+            return frontier.empty() ? nullptr : frontier.front();
         }
     };
 
     using value_type = T;
+    using allocator_type = Allocator;
     using iterator = PreorderIterator<value_type, Node>;
     using const_iterator = PreorderIterator<const value_type, const Node>;
+    using postorder_iterator = PostorderIterator<value_type, Node>;
+    using const_postorder_iterator =
+        PostorderIterator<const value_type, const Node>;
+    using level_order_iterator = LevelOrderIterator<value_type, Node>;
+    using const_level_order_iterator =
+        LevelOrderIterator<const value_type, const Node>;
 
     Tree() = default;
 
-    Tree(std::ranges::input_range auto&& r)
+    explicit Tree(const Allocator& alloc)
+        : allocator{arena_owner.adopt(alloc)}
+    {
+    }
+
+    Tree(std::ranges::input_range auto&& r, const Allocator& alloc = {})
         requires(
             std::same_as<std::ranges::range_reference_t<T>, std::optional<T>>)
-        : Tree{std::ranges::begin(r), std::ranges::end(r)}
+        : Tree{std::ranges::begin(r), std::ranges::end(r), alloc}
     {
     }
 
     template <std::input_iterator I, std::sentinel_for<I> S>
         requires(std::same_as<typename I::value_type, std::optional<T>>)
-    Tree(I first, S last)
+    Tree(I first, S last, const Allocator& alloc = {})
+        : allocator{arena_owner.adopt(alloc)}
     {
         std::queue<iterator> frontier;
         frontier.push(begin());
@@ -328,73 +485,190 @@ public:
         }
     }
 
-    ~Tree() { release_subtree(std::move(root)); }
+    ~Tree() { discard(std::move(root)); }
 
     Tree(const Tree& other)
+        : Tree{other,
+               AllocatorTraits::select_on_container_copy_construction(
+                   other.allocator)}
     {
-        if (this == &other) {
-            return;
-        }
-        *this = other.transform(std::identity{});
+    }
+
+    Tree(const Tree& other, const Allocator& alloc)
+        : allocator{arena_owner.adopt(alloc)}
+    {
+        clone_children(*root, *other.root);
+        node_count = other.node_count;
     }
 
     Tree(Tree&& other) = default;
 
-    static auto from_flattened(std::ranges::input_range auto&& r) -> Tree
+    Tree(Tree&& other, const Allocator& alloc)
+        : allocator{arena_owner.adopt(alloc)}
     {
-        return from_flattened(std::ranges::begin(r), std::ranges::end(r));
+        if (allocator == other.allocator) {
+            discard(std::exchange(root, std::move(other.root)));
+            node_count = other.node_count;
+            return;
+        }
+        insert_children_of(end(), *other.root, DestinationPosition{0});
+    }
+
+    static auto from_flattened(std::ranges::input_range auto&& r,
+                               const Allocator& alloc = {}) -> Tree
+    {
+        return from_flattened(
+            std::ranges::begin(r), std::ranges::end(r), alloc);
     }
 
     template <std::input_iterator I, std::sentinel_for<I> S>
-    static auto from_flattened(I first, S last) -> Tree
+    static auto from_flattened(I first, S last, const Allocator& alloc = {})
+        -> Tree
     {
-        std::queue<iterator> frontier;
-        Tree tree;
-        frontier.push(tree.begin());
+        Unflattener unflattener{alloc};
+        for (; first != last and not unflattener.done(); ++first) {
+            unflattener.push(*first);
+        }
+        return unflattener.finish();
+    }
 
-        ++first;
-        ++first;
+    /* Push-based counterpart of from_flattened. Entries of flattened
+     * sequence are fed as they arrive, e.g. chunk by chunk from a stream, and
+     * turned into nodes right away, so the sequence is never held in memory
+     * as a whole. */
+    class Unflattener {
+    public:
+        explicit Unflattener(const Allocator& alloc = {})
+            : tree{alloc}
+            , decoder{tree.root.get()}
+        {
+        }
 
-        for (; not frontier.empty() and first != last; ++first) {
-            auto parent_it = frontier.front();
-            frontier.pop();
-            for (; first->has_value(); ++first) {
-                auto it = tree.insert(parent_it, first->value());
-                frontier.push(it);
+        auto push(std::optional<T> entry) -> void
+        {
+            decoder.push(std::move(entry), [this](Node* parent, T&& payload) {
+                return tree
+                    .insert(iterator{parent, tree.root.get()},
+                            std::move(payload))
+                    .ptr;
+            });
+        }
+
+        template <std::ranges::input_range R> auto push_range(R&& chunk) -> void
+        {
+            for (auto&& entry : chunk) {
+                push(std::forward<decltype(entry)>(entry));
             }
         }
 
-        return tree;
+        /* Whether the sequence is complete, further entries are ignored. */
+        auto done() const -> bool { return decoder.done(); }
+
+        /* Return tree decoded so far. */
+        auto finish() -> Tree { return std::move(tree); }
+
+    private:
+        Tree tree;
+        details::FlattenedDecoder<Node*> decoder;
+    };
+
+    /* Build tree from nodes listed in preorder, parents[i] being position of
+     * parent of i-th node in the list or -1 for top-level nodes.
+     *
+     * Nodes are created in a single pass and appended directly to child
+     * lists reserved to their exact sizes. Throws std::invalid_argument if
+     * nodes are not listed in preorder or there is not exactly one payload
+     * per node. */
+    static auto from_parent_indexes(std::span<const int64_t> parents,
+                                    std::ranges::sized_range auto&& payloads,
+                                    const Allocator& alloc = {}) -> Tree
+    {
+        details::throw_if_not_preorder(parents);
+        return build_preorder(parents, payloads, alloc);
+    }
+
+    /* Same as above, but nodes are given by their depths, top-level nodes
+     * being at depth 0. */
+    static auto from_depths(std::span<const int64_t> depths,
+                            std::ranges::sized_range auto&& payloads,
+                            const Allocator& alloc = {}) -> Tree
+    {
+        return build_preorder(
+            details::parents_from_depths(depths), payloads, alloc);
     }
 
-    auto operator=(Tree&& other) -> Tree& = default;
+    /* Build tree from binary image written by write_image of any tree with
+     * the same payload type. Throws std::invalid_argument if image is not
+     * valid. */
+    static auto from_image(std::span<const std::byte> image,
+                           const Allocator& alloc = {}) -> Tree
+        requires details::ImageStorable<T>
+    {
+        const TreeImageView<T> view{image};
+        return from_parent_indexes(
+            view.parent_indexes(), view.payloads(), alloc);
+    }
+
+    auto operator=(Tree&& other) noexcept(
+        AllocatorTraits::propagate_on_container_move_assignment::value or
+        AllocatorTraits::is_always_equal::value) -> Tree&
+    {
+        constexpr bool propagate{
+            AllocatorTraits::propagate_on_container_move_assignment::value};
+        if (this == &other) {
+            return *this;
+        }
+        if (not propagate and allocator != other.allocator) {
+            // Nodes have to be recreated with own allocator
+            return *this = Tree{std::move(other), allocator};
+        }
+        discard(std::exchange(root, std::move(other.root)));
+        node_count = other.node_count;
+        if constexpr (propagate) {
+            arena_owner = std::move(other.arena_owner);
+            allocator = other.allocator;
+        }
+        return *this;
+    }
 
     auto operator=(const Tree& other) -> Tree&
     {
+        constexpr bool propagate{
+            AllocatorTraits::propagate_on_container_copy_assignment::value};
         if (this == &other) {
             return *this;
         }
-        root = std::move(other.transform(std::identity{}).root);
+        Tree copy{other, propagate ? other.allocator : allocator};
+        discard(std::exchange(root, std::move(copy.root)));
+        node_count = copy.node_count;
+        if constexpr (propagate) {
+            arena_owner = std::move(copy.arena_owner);
+            allocator = copy.allocator;
+        }
         return *this;
     }
 
+    auto get_allocator() const -> Allocator { return allocator; }
+
     auto insert(iterator parent, T payload) -> iterator
     {
         auto* true_parent{parent == end() ? root.get() : parent.ptr};
-        auto child = std::make_unique<Node>(std::move(payload));
+        auto child = make_node(std::move(payload));
         auto* child_ptr = child.get();
         true_parent->insert(std::move(child));
-        return iterator{child_ptr};
+        ++node_count;
+        return iterator{child_ptr, root.get()};
     }
 
     auto insert(iterator parent, T payload, DestinationPosition insert_pos)
         -> iterator
     {
         auto* true_parent{parent == end() ? root.get() : parent.ptr};
-        auto child = std::make_unique<Node>(std::move(payload));
+        auto child = make_node(std::move(payload));
         auto* child_ptr = child.get();
         true_parent->insert(std::move(child), insert_pos);
-        return iterator{child_ptr};
+        ++node_count;
+        return iterator{child_ptr, root.get()};
     }
 
     auto insert(iterator parent,
@@ -459,16 +733,19 @@ public:
             return end();
         }
         auto* true_parent{parent == end() ? root.get() : parent.ptr};
-        std::vector<std::unique_ptr<Node>> buffer(
-            static_cast<size_t>(last - first));
-        std::transform(first, last, buffer.begin(), [&](auto&& source) {
-            return std::make_unique<Node>(std::invoke(proj, source));
-        });
+        std::vector<NodePtr, NodePtrAllocator> buffer(
+            NodePtrAllocator{allocator});
+        buffer.reserve(static_cast<size_t>(last - first));
+        std::transform(
+            first, last, std::back_inserter(buffer), [&](auto&& source) {
+                return make_node(std::invoke(proj, source));
+            });
         auto* ptr = buffer.front().get();
         true_parent->insert(insert_pos,
                             std::make_move_iterator(buffer.begin()),
                             std::make_move_iterator(buffer.end()));
-        return iterator{ptr};
+        node_count += std::ssize(buffer);
+        return iterator{ptr, root.get()};
     }
 
     auto insert_subtree(iterator parent,
@@ -485,23 +762,7 @@ public:
                         const Tree& other,
                         DestinationPosition insert_pos) -> void
     {
-        std::queue<std::pair<iterator, const Node*>> frontier;
-
-        for (const auto& child : other.root->children) {
-            auto child_it = insert(parent, child->payload, insert_pos);
-            ++insert_pos;
-            frontier.push({child_it, child.get()});
-        }
-
-        while (not frontier.empty()) {
-            auto [it, other_ptr] = frontier.front();
-            frontier.pop();
-
-            for (const auto& child : other_ptr->children) {
-                auto child_it = insert(it, child->payload);
-                frontier.push({child_it, child.get()});
-            }
-        }
+        insert_children_of(parent, std::as_const(*other.root), insert_pos);
     }
 
     auto erase(iterator subtree_root) -> void
@@ -532,7 +793,7 @@ public:
         if (it == cend() or it.ptr->parent == root.get()) {
             return cend();
         }
-        return const_iterator{it.ptr->parent};
+        return const_iterator{it.ptr->parent, root.get()};
     }
 
     auto parent(iterator it) -> iterator
@@ -540,7 +801,22 @@ public:
         if (it == end() or it.ptr->parent == root.get()) {
             return end();
         }
-        return iterator{it.ptr->parent};
+        return iterator{it.ptr->parent, root.get()};
+    }
+
+    /* Return iterator to the node following subtree of it in preorder, i.e.
+     * to its next sibling or to next sibling of its closest ancestor having
+     * one. */
+    auto skip_subtree(iterator it) -> iterator
+    {
+        return iterator{it.ptr ? subtree_successor(it.ptr) : nullptr,
+                        root.get()};
+    }
+
+    auto skip_subtree(const_iterator it) const -> const_iterator
+    {
+        return const_iterator{it.ptr ? subtree_successor(it.ptr) : nullptr,
+                              root.get()};
     }
 
     auto children(iterator it)
@@ -560,50 +836,27 @@ public:
     // These are handy if a need arise to write manual tree traversal
     auto children_iterators(iterator it)
     {
-        // NOTE we are setting prev node for all children iterators to their parent.
-        // This is required for proper subtree iteration when using this method in more
-        // complex traversals.
-        //
-        // Note also that setting prev to parent is correct for the first child, but
-        // incorrect for the rest of them -- as iterator is now implemented, each child
-        // prev should point to previous child, but now it is pointing to parent instead.
-        // This is fine for forward_iterator, but if in the future more complex iterators
-        // will be implemented, this should be dealt with.
         auto* true_ptr = it == end() ? root.get() : it.ptr;
         return std::views::transform(
-            true_ptr->children, [parent_ptr = true_ptr](auto& node) {
-                return iterator{node.get(), parent_ptr};
+            true_ptr->children, [root_ptr = root.get()](auto& node) {
+                return iterator{node.get(), root_ptr};
             });
     }
 
     auto children_iterators(const_iterator it) const
     {
-        // NOTE we are setting prev node for all children iterators to their parent.
-        // This is required for proper subtree iteration when using this method in more
-        // complex traversals.
-        //
-        // Note also that setting prev to parent is correct for the first child, but
-        // incorrect for the rest of them -- as iterator is now implemented, each child
-        // prev should point to previous child, but now it is pointing to parent instead.
-        // This is fine for forward_iterator, but if in the future more complex iterators
-        // will be implemented, this should be dealt with.
         auto* true_ptr = it == end() ? root.get() : it.ptr;
+        const Node* root_ptr{root.get()};
         return std::views::transform(
-            true_ptr->children, [parent_ptr = true_ptr](const auto& node) {
-                return const_iterator{node.get(), parent_ptr};
+            true_ptr->children, [root_ptr](const auto& node) {
+                return const_iterator{node.get(), root_ptr};
             });
     }
 
     auto empty() const -> bool { return children(cend()).size() == 0; }
 
-    /* Return number of nodes in the tree in linear time. */
-    auto size() const -> int
-    {
-        return std::ranges::fold_left(
-            cbegin(), cend(), 0, [](auto acc, const auto& /* payload */) {
-                return acc + 1;
-            });
-    }
+    /* Return number of nodes in the tree in constant time. */
+    auto size() const -> int { return static_cast<int>(node_count); }
 
     // Returns subtree with subtree_root as root.
     auto subtree(const_iterator subtree_root) const -> Tree
@@ -614,8 +867,11 @@ public:
     auto take_subtree(iterator subtree_root) -> Tree
     {
         auto* parent = subtree_root.ptr->parent;
-        Tree subtree;
+        Tree subtree{allocator};
+        subtree.node_count = std::ranges::distance(
+            subtree_root, skip_subtree(subtree_root));
         subtree.root->insert(parent->take(subtree_root.ptr));
+        node_count -= subtree.node_count;
         return subtree;
     }
 
@@ -626,19 +882,19 @@ public:
 
     template <typename Func, typename Proj = std::identity>
     auto transform(Func func, Proj proj = {}) const
-        -> Tree<TransformResultT<Func, Proj>>
+        -> TransformResultTree<Func, Proj>
     {
         return transform(cend(), func, proj);
     }
 
     template <typename Func, typename Proj = std::identity>
     auto transform(const_iterator subtree_root, Func func, Proj proj = {}) const
-        -> Tree<TransformResultT<Func, Proj>>
+        -> TransformResultTree<Func, Proj>
     {
-        using Y = TransformResultT<Func, Proj>;
-        Tree<Y> mapped;
+        using Mapped = TransformResultTree<Func, Proj>;
+        Mapped mapped{typename Mapped::allocator_type{allocator}};
 
-        std::queue<std::pair<const Node*, typename Tree<Y>::iterator>> frontier;
+        std::queue<std::pair<const Node*, typename Mapped::iterator>> frontier;
         if (subtree_root == cend()) {
             for (auto& child : root->children) {
                 auto mapped_it = mapped.insert(
@@ -670,25 +926,98 @@ public:
         return mapped;
     }
 
+    /* Parallel transform of the whole tree.
+     *
+     * Structure of the mapped tree is cloned first with default constructed
+     * payloads, which are then mapped in place by chunks of nodes evaluated
+     * in parallel. */
+    template <typename Func, typename Proj = std::identity>
+    auto transform(const Parallel& policy, Func func, Proj proj = {}) const
+        -> TransformResultTree<Func, Proj>
+    {
+        using Mapped = TransformResultTree<Func, Proj>;
+        using MappedNode = typename Mapped::Node;
+        Mapped mapped{typename Mapped::allocator_type{allocator}};
+
+        std::vector<std::pair<const Node*, MappedNode*>> nodes;
+        nodes.reserve(static_cast<size_t>(node_count));
+        clone_children(
+            *mapped.root, *root, [&](const Node& original) {
+                auto copy = mapped.make_node();
+                nodes.push_back({&original, copy.get()});
+                return copy;
+            });
+        mapped.node_count = node_count;
+
+        const auto threads =
+            details::constructible_in_parallel<typename Mapped::value_type,
+                                               typename Mapped::allocator_type>
+                ? policy.threads
+                : 1U;
+        details::run_in_parallel(
+            threads, nodes.size(), [&](size_t first, size_t last) {
+                for (; first < last; ++first) {
+                    auto [original, copy] = nodes[first];
+                    copy->payload = std::invoke(
+                        func, std::invoke(proj, original->payload));
+                }
+            });
+
+        return mapped;
+    }
+
     auto flatten() const -> std::vector<std::optional<T>>
     {
-        std::queue<const Node*> frontier;
-        frontier.push(root.get());
+        // Every node and every terminator of its children, plus fake root
+        std::vector<std::optional<T>> flattened;
+        flattened.reserve(2 * static_cast<size_t>(node_count) + 3);
+        flatten_to(std::back_inserter(flattened));
+        return flattened;
+    }
+
+    /* Write flattened sequence to out entry by entry instead of collecting
+     * it into a vector. */
+    template <std::output_iterator<std::optional<T>> O>
+    auto flatten_to(O out) const -> O
+    {
+        return details::flatten_to(
+            static_cast<const Node*>(root.get()),
+            std::optional<T>{},
+            [](const Node* node) {
+                return std::views::transform(
+                    node->children,
+                    [](const auto& child) -> const Node* {
+                        return child.get();
+                    });
+            },
+            [](const Node* node) { return std::optional<T>{node->payload}; },
+            std::move(out));
+    }
 
-        std::vector<std::optional<T>> flattened{std::nullopt, std::nullopt};
+    /* Write binary image of the tree, see TreeImage.h. */
+    auto write_image(std::ostream& os) const -> void
+        requires details::ImageStorable<T>
+    {
+        std::vector<int64_t> parents;
+        parents.reserve(static_cast<size_t>(node_count));
+        std::stack<std::pair<const Node*, int64_t>> frontier;
+        const auto push_children = [&frontier](const Node* node,
+                                               int64_t position) {
+            for (const auto& child : node->children | std::views::reverse) {
+                frontier.emplace(child.get(), position);
+            }
+        };
 
+        push_children(root.get(), -1);
         while (not frontier.empty()) {
-            const auto* current = frontier.front();
+            const auto [node, parent] = frontier.top();
             frontier.pop();
-
-            for (const auto& child : current->children) {
-                flattened.push_back(child->payload);
-                frontier.push(child.get());
-            }
-            flattened.push_back(std::nullopt);
+            parents.push_back(parent);
+            push_children(node, std::ssize(parents) - 1);
         }
 
-        return flattened;
+        details::write_image<details::NoKey, T>(
+            os, parents, std::views::empty<details::NoKey>, *this);
     }
 
     auto to_string() const -> std::string
@@ -717,23 +1046,59 @@ public:
         return ss.str();
     }
 
-    auto begin() -> iterator { return ++iterator(root.get()); }
+    auto begin() -> iterator { return ++iterator(root.get(), root.get()); }
 
-    auto end() -> iterator { return iterator(nullptr); }
+    auto end() -> iterator { return iterator(nullptr, root.get()); }
 
     auto begin() const -> const_iterator
     {
-        return ++const_iterator(root.get());
+        return ++const_iterator(root.get(), root.get());
     }
 
-    auto end() const -> const_iterator { return const_iterator(nullptr); }
+    auto end() const -> const_iterator
+    {
+        return const_iterator(nullptr, root.get());
+    }
 
     auto cbegin() const -> const_iterator
     {
-        return ++const_iterator(root.get());
+        return ++const_iterator(root.get(), root.get());
     }
 
-    auto cend() const -> const_iterator { return const_iterator(nullptr); }
+    auto cend() const -> const_iterator
+    {
+        return const_iterator(nullptr, root.get());
+    }
+
+    /* Return range of all nodes in postorder. */
+    auto postorder() -> std::ranges::subrange<postorder_iterator>
+    {
+        return {postorder_iterator{postorder_first(root.get()), root.get()},
+                postorder_iterator{nullptr, root.get()}};
+    }
+
+    auto postorder() const -> std::ranges::subrange<const_postorder_iterator>
+    {
+        const Node* root_ptr{root.get()};
+        return {const_postorder_iterator{postorder_first(root_ptr), root_ptr},
+                const_postorder_iterator{nullptr, root_ptr}};
+    }
+
+    /* Return range of all nodes in level order. */
+    auto level_order() -> std::ranges::subrange<level_order_iterator>
+    {
+        auto first = ++level_order_iterator{root.get(), root.get()};
+        return {std::move(first), level_order_iterator{nullptr, root.get()}};
+    }
+
+    auto level_order() const
+        -> std::ranges::subrange<const_level_order_iterator>
+    {
+        const Node* root_ptr{root.get()};
+        auto first = ++const_level_order_iterator{root_ptr, root_ptr};
+        return {std::move(first),
+                const_level_order_iterator{nullptr, root_ptr}};
+    }
 
     friend auto operator==(const Tree& lhs, const Tree& rhs) -> bool
     {
@@ -765,22 +1130,239 @@ public:
     }
 
 private:
-    std::unique_ptr<Node> root{std::make_unique<Node>()};
+    template <std::default_initializable, typename> friend class Tree;
+
+    [[no_unique_address]] details::ArenaOwner<Allocator> arena_owner;
+    [[no_unique_address]] Allocator allocator{arena_owner.adopt(Allocator{})};
+    NodePtr root{make_node()};
+    int64_t node_count{0};
+
+    template <typename... Args> auto make_node(Args&&... args) const -> NodePtr
+    {
+        return details::allocate_node<Node>(
+            allocator, std::forward<Args>(args)..., allocator);
+    }
+
+    /* Build tree from validated preorder parent positions, see
+     * from_parent_indexes. */
+    template <typename Payloads>
+    static auto build_preorder(std::span<const int64_t> parents,
+                               Payloads&& payloads,
+                               const Allocator& alloc) -> Tree
+    {
+        details::throw_if_payload_count_differs(
+            parents.size(), static_cast<size_t>(std::ranges::size(payloads)));
+
+        // Count children first, so that child lists never reallocate.
+        // Position 0 stands for the fake root, node i is at position i + 1.
+        std::vector<size_t> child_counts(parents.size() + 1);
+        for (const auto parent : parents) {
+            ++child_counts[static_cast<size_t>(parent + 1)];
+        }
+
+        Tree tree{alloc};
+        std::vector<Node*> nodes;
+        nodes.reserve(parents.size() + 1);
+        nodes.push_back(tree.root.get());
+        tree.root->children.reserve(child_counts[0]);
+
+        for (auto&& payload : payloads) {
+            auto* parent =
+                nodes[static_cast<size_t>(parents[nodes.size() - 1] + 1)];
+            auto node =
+                tree.make_node(std::forward<decltype(payload)>(payload));
+            node->parent = parent;
+            node->pos = std::ssize(parent->children);
+            node->children.reserve(child_counts[nodes.size()]);
+            nodes.push_back(node.get());
+            parent->children.push_back(std::move(node));
+        }
+        tree.node_count = std::ssize(parents);
+        return tree;
+    }
+
+    /* Copy children of source with their subtrees into childless
+     * destination. Nodes are created in preorder and linked directly, so
+     * there is no position bookkeeping or validation per node. */
+    auto clone_children(Node& destination, const Node& source) -> void
+    {
+        clone_children(destination, source, [this](const Node& original) {
+            return make_node(original.payload);
+        });
+    }
+
+    /* Same as above, but copies are created with make_copy(original), which
+     * allows destination to be a node of a tree of other type. */
+    template <typename DestinationNode, typename MakeCopy>
+    static auto clone_children(DestinationNode& destination,
+                               const Node& source,
+                               MakeCopy make_copy) -> void
+    {
+        // Children are pushed in reverse, so that they are popped, and
+        // appended to their parent copies, in original order.
+        std::vector<std::pair<DestinationNode*, const Node*>> frontier;
+        auto push_children = [&frontier](DestinationNode* copy,
+                                         const Node* original) {
+            copy->children.reserve(original->children.size());
+            for (const auto& child :
+                 std::ranges::reverse_view(original->children)) {
+                frontier.push_back({copy, child.get()});
+            }
+        };
+
+        push_children(&destination, &source);
+        while (not frontier.empty()) {
+            auto [parent, original] = frontier.back();
+            frontier.pop_back();
+            auto copy = make_copy(*original);
+            copy->parent = parent;
+            copy->pos = std::ssize(parent->children);
+            push_children(copy.get(), original);
+            parent->children.push_back(std::move(copy));
+        }
+    }
+
+    /* Insert children of other_root with their subtrees into parent starting
+     * at insert_pos. Payloads are copied from const nodes and moved from
+     * mutable ones. */
+    template <typename NodeT>
+    auto insert_children_of(iterator parent,
+                            NodeT& other_root,
+                            DestinationPosition insert_pos) -> void
+    {
+        auto payload_of = [](NodeT& node) -> decltype(auto) {
+            if constexpr (std::is_const_v<NodeT>) {
+                return (node.payload);
+            }
+            else {
+                return std::move(node.payload);
+            }
+        };
+        std::queue<std::pair<iterator, NodeT*>> frontier;
+
+        for (auto& child : other_root.children) {
+            auto child_it = insert(parent, payload_of(*child), insert_pos);
+            ++insert_pos;
+            frontier.push({child_it, child.get()});
+        }
+
+        while (not frontier.empty()) {
+            auto [it, other_ptr] = frontier.front();
+            frontier.pop();
+
+            for (auto& child : other_ptr->children) {
+                auto child_it = insert(it, payload_of(*child));
+                frontier.push({child_it, child.get()});
+            }
+        }
+    }
+
+    /* Return node following subtree of given node in preorder or null if
+     * there is no such node. */
+    template <typename NodeT>
+    static auto subtree_successor(NodeT* node) -> NodeT*
+    {
+        for (; node->parent; node = node->parent) {
+            auto* parent = node->parent;
+            if (node->pos + 1 < std::ssize(parent->children)) {
+                return parent->children[static_cast<size_t>(node->pos) + 1]
+                    .get();
+            }
+        }
+        return nullptr;
+    }
+
+    template <typename NodeT>
+    static auto preorder_successor(NodeT* node) -> NodeT*
+    {
+        return node->children.empty() ? subtree_successor(node)
+                                      : node->children.front().get();
+    }
+
+    /* Return node preceding given one in preorder, the last node if node is
+     * null or null if there is no such node. */
+    template <typename NodeT>
+    static auto preorder_predecessor(NodeT* node, NodeT* root_node) -> NodeT*
+    {
+        NodeT* prev{nullptr};
+        if (not node) {
+            prev = rightmost_descendant(root_node);
+        }
+        else if (node->pos > 0) {
+            prev = rightmost_descendant(
+                node->parent->children[static_cast<size_t>(node->pos) - 1]
+                    .get());
+        }
+        else {
+            prev = node->parent;
+        }
+        return prev == root_node ? nullptr : prev;
+    }
 
-    auto release_subtree(std::unique_ptr<Node> subtree_root) -> void
+    template <typename NodeT>
+    static auto rightmost_descendant(NodeT* node) -> NodeT*
+    {
+        while (not node->children.empty()) {
+            node = node->children.back().get();
+        }
+        return node;
+    }
+
+    /* Return node visited first in postorder traversal of subtree. */
+    template <typename NodeT>
+    static auto postorder_first(NodeT* node) -> NodeT*
+    {
+        while (not node->children.empty()) {
+            node = node->children.front().get();
+        }
+        return node->parent ? node : nullptr;
+    }
+
+    template <typename NodeT>
+    static auto postorder_successor(NodeT* node) -> NodeT*
+    {
+        auto* parent = node->parent;
+        if (node->pos + 1 < std::ssize(parent->children)) {
+            return postorder_first(
+                parent->children[static_cast<size_t>(node->pos) + 1].get());
+        }
+        return parent->parent ? parent : nullptr;
+    }
+
+    /* Destroy nodes of subtree in postorder without recursion. Each node is
+     * destroyed once it has no children left, so that its destructor does
+     * not descend further. */
+    auto release_subtree(NodePtr subtree_root) -> void
     {
         if (not subtree_root) {
             return;
         }
 
-        while (not subtree_root->children.empty()) {
-            auto leaves = &subtree_root->children;
-            while (not leaves->back()->children.empty()) {
-                leaves = &leaves->back()->children;
+        for (auto* node = subtree_root.get(); node != subtree_root.get() or
+                                              not node->children.empty();) {
+            if (not node->children.empty()) {
+                node = node->children.back().get();
+                continue;
             }
-            leaves->pop_back();
+            auto* parent = node->parent;
+            parent->children.pop_back();
+            node = parent;
         }
     }
+
+    /* Release nodes no longer belonging to the tree. When tree is the only
+     * user of its arena and nodes need no destruction, memory is left to be
+     * released in bulk with the arena. */
+    auto discard(NodePtr subtree_root) -> void
+    {
+        if constexpr (std::is_trivially_destructible_v<T>) {
+            if (arena_owner.sole_owner()) {
+                static_cast<void>(subtree_root.release());
+                return;
+            }
+        }
+        release_subtree(std::move(subtree_root));
+    }
 };
 
 static_assert(std::is_copy_constructible_v<Tree<int>::iterator>);
@@ -805,8 +1387,38 @@ static_assert(std::is_trivially_copy_constructible_v<Tree<int>::iterator>);
 static_assert(
     std::is_trivially_copy_constructible_v<Tree<int>::const_iterator>);
 
-static_assert(std::forward_iterator<Tree<int>::iterator>);
-static_assert(std::forward_iterator<Tree<int>::const_iterator>);
+static_assert(std::bidirectional_iterator<Tree<int>::iterator>);
+static_assert(std::bidirectional_iterator<Tree<int>::const_iterator>);
+static_assert(std::forward_iterator<Tree<int>::postorder_iterator>);
+static_assert(std::forward_iterator<Tree<int>::const_postorder_iterator>);
+static_assert(std::forward_iterator<Tree<int>::level_order_iterator>);
+static_assert(std::forward_iterator<Tree<int>::const_level_order_iterator>);
+
+// Postorder and level order iterators convert to preorder ones
+static_assert(std::is_convertible_v<Tree<int>::postorder_iterator,
+                                    Tree<int>::iterator>);
+static_assert(std::is_convertible_v<Tree<int>::postorder_iterator,
+                                    Tree<int>::const_iterator>);
+static_assert(not std::is_convertible_v<Tree<int>::const_postorder_iterator,
+                                        Tree<int>::iterator>);
+static_assert(std::is_convertible_v<Tree<int>::level_order_iterator,
+                                    Tree<int>::iterator>);
+static_assert(not std::is_convertible_v<Tree<int>::const_level_order_iterator,
+                                        Tree<int>::iterator>);
+
+/* Tree allocating its nodes from arena it shares only with trees derived
+ * from it. Arena memory is released in bulk with the last tree using it and
+ * trees of trivially destructible payloads skip node-by-node destruction
+ * altogether. */
+template <std::default_initializable T>
+using ArenaTree = Tree<T, ArenaAllocator<T>>;
+
+namespace pmr {
+
+template <std::default_initializable T>
+using Tree = ds::Tree<T, std::pmr::polymorphic_allocator<T>>;
+
+} // namespace pmr
 
 } // namespace ds
 
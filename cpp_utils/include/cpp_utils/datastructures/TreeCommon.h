@@ -3,12 +3,29 @@
 
 #include "cpp_utils/types/NamedType.h"
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <concepts>
 #include <cstdint>
+#include <exception>
 #include <functional>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <queue>
+#include <ranges>
+#include <span>
 #include <stack>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace details {
 
@@ -18,6 +35,729 @@ struct SourcePosTag { };
 
 struct DestinationPosTag { };
 
+template <typename Allocator, typename U>
+using Rebind =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<U>;
+
+/* Deleter for nodes created with allocate_node(). Each deleter keeps a copy of
+ * allocator, so node is always returned to the resource it came from.
+ *
+ * Containers of node pointers need assignable deleters, while some
+ * allocators (std::pmr::polymorphic_allocator) are not assignable. Those are
+ * kept in std::optional and re-emplaced on assignment. */
+template <typename Allocator> class NodeDeleter {
+public:
+    using node_type = typename std::allocator_traits<Allocator>::value_type;
+
+    explicit NodeDeleter(const Allocator& alloc)
+        : allocator{alloc}
+    {
+    }
+
+    NodeDeleter(const NodeDeleter&) = default;
+
+    auto operator=(const NodeDeleter& other) -> NodeDeleter&
+    {
+        if constexpr (assignable) {
+            allocator = other.allocator;
+        }
+        else if (this != &other) {
+            allocator.emplace(*other.allocator);
+        }
+        return *this;
+    }
+
+    auto operator()(node_type* node) -> void
+    {
+        auto& alloc = get_allocator();
+        std::allocator_traits<Allocator>::destroy(alloc, node);
+        std::allocator_traits<Allocator>::deallocate(alloc, node, 1);
+    }
+
+private:
+    static constexpr bool assignable{std::is_copy_assignable_v<Allocator>};
+
+    [[no_unique_address]] std::
+        conditional_t<assignable, Allocator, std::optional<Allocator>>
+            allocator;
+
+    auto get_allocator() -> Allocator&
+    {
+        if constexpr (assignable) {
+            return allocator;
+        }
+        else {
+            return *allocator;
+        }
+    }
+};
+
+template <typename Node, typename Allocator>
+using NodePtr = std::unique_ptr<Node, NodeDeleter<Rebind<Allocator, Node>>>;
+
+/* Allocate and construct single node with given allocator. */
+template <typename Node, typename Allocator, typename... Args>
+auto allocate_node(const Allocator& allocator, Args&&... args)
+    -> NodePtr<Node, Allocator>
+{
+    using NodeAllocator = Rebind<Allocator, Node>;
+    using Traits = std::allocator_traits<NodeAllocator>;
+
+    NodeAllocator node_allocator{allocator};
+    auto* node = Traits::allocate(node_allocator, 1);
+    try {
+        Traits::construct(node_allocator, node, std::forward<Args>(args)...);
+    }
+    catch (...) {
+        Traits::deallocate(node_allocator, node, 1);
+        throw;
+    }
+    return NodePtr<Node, Allocator>{node,
+                                    NodeDeleter<NodeAllocator>{node_allocator}};
+}
+
+/* Check that parents[i], the position of parent of i-th node or -1 for
+ * top-level nodes, describe nodes listed in preorder: parent of every node is
+ * either the previous node or one of its ancestors. Throws
+ * std::invalid_argument otherwise. */
+inline auto throw_if_not_preorder(std::span<const int64_t> parents) -> void
+{
+    // Path from the top-level node to the previous node
+    std::vector<int64_t> path;
+    for (int64_t node{0}; const auto parent : parents) {
+        while (not path.empty() and path.back() != parent) {
+            path.pop_back();
+        }
+        if (path.empty() and parent != -1) {
+            throw std::invalid_argument{"Nodes are not listed in preorder"};
+        }
+        path.push_back(node++);
+    }
+}
+
+/* Convert depths of nodes listed in preorder to positions of their parents,
+ * see throw_if_not_preorder. Throws std::invalid_argument if some node is
+ * more than one level deeper than the previous one. */
+inline auto parents_from_depths(std::span<const int64_t> depths)
+    -> std::vector<int64_t>
+{
+    std::vector<int64_t> parents;
+    parents.reserve(depths.size());
+    // Last node seen at each depth up to the depth of the previous node
+    std::vector<int64_t> path;
+    for (int64_t node{0}; const auto depth : depths) {
+        if (depth < 0 or depth > std::ssize(path)) {
+            throw std::invalid_argument{"Invalid depth of node"};
+        }
+        path.resize(static_cast<size_t>(depth));
+        parents.push_back(path.empty() ? -1 : path.back());
+        path.push_back(node++);
+    }
+    return parents;
+}
+
+/* Throws std::invalid_argument unless there is exactly one payload for each
+ * node passed to bulk builders of the trees. */
+inline auto throw_if_payload_count_differs(size_t nodes, size_t payloads)
+    -> void
+{
+    if (nodes != payloads) {
+        throw std::invalid_argument{
+            "Number of payloads does not match number of nodes"};
+    }
+}
+
+/* Hash and equality of key registry accepting types other than the key
+ * type itself, as with heterogeneous lookup of standard containers. */
+template <typename Hash, typename KeyEqual>
+concept TransparentLookup = requires {
+    typename Hash::is_transparent;
+    typename KeyEqual::is_transparent;
+};
+
+/* K can be passed to registry lookups as is: it is either the key type or
+ * is accepted by transparent Hash and KeyEqual. */
+template <typename K, typename Key, typename Hash, typename KeyEqual>
+concept HeterogeneousKey =
+    std::same_as<K, Key> or
+    (TransparentLookup<Hash, KeyEqual> and
+     std::invocable<const Hash&, const K&> and
+     std::predicate<const KeyEqual&, const Key&, const K&>);
+
+/* K can be used to look up keys of registry, if need be by converting it to
+ * the key type first. */
+template <typename K, typename Key, typename Hash, typename KeyEqual>
+concept LookupKey = HeterogeneousKey<K, Key, Hash, KeyEqual> or
+                    std::convertible_to<const K&, Key>;
+
+/* Return key as passed to registry lookups: the key itself when registry
+ * accepts it, otherwise a temporary of the key type. */
+template <typename Key, typename Hash, typename KeyEqual, typename K>
+auto lookup_key(const K& key) -> decltype(auto)
+{
+    if constexpr (HeterogeneousKey<K, Key, Hash, KeyEqual>) {
+        return (key);
+    }
+    else {
+        return Key(key);
+    }
+}
+
+/* Push-based decoder of flattened tree sequence as produced by flatten() of
+ * the trees: two leading entries standing for the fake root, then children
+ * of every node in level order, each group of siblings terminated by
+ * nullopt.
+ *
+ * Entries are fed one at a time and each node is attached as soon as it
+ * arrives with attach(parent, value), which returns handle of the attached
+ * node. Only handles of nodes whose children have not arrived yet are kept,
+ * so apart from the tree being built memory use is proportional to the
+ * width of the tree rather than to the length of the sequence. */
+template <typename Handle> class FlattenedDecoder {
+public:
+    explicit FlattenedDecoder(Handle root_)
+        : current{root_}
+    {
+    }
+
+    template <typename U, typename Attach>
+    auto push(std::optional<U>&& entry, Attach attach) -> void
+    {
+        if (skipped < 2) {
+            ++skipped;
+            return;
+        }
+        if (finished) {
+            return;
+        }
+        if (entry) {
+            pending.push(attach(current, std::move(*entry)));
+            return;
+        }
+        if (pending.empty()) {
+            finished = true;
+            return;
+        }
+        current = pending.front();
+        pending.pop();
+    }
+
+    /* Whether the sequence is complete, any further entries are ignored. */
+    auto done() const -> bool { return finished; }
+
+private:
+    std::queue<Handle> pending;
+    Handle current;
+    int skipped{0};
+    bool finished{false};
+};
+
+/* Write flattened sequence of the tree (see FlattenedDecoder) starting with
+ * root_entry to out. children_of(node) gives range of child nodes,
+ * entry_of(node) gives entry written for the node. Only nodes whose children
+ * are not written yet are kept aside, no entry is materialized beyond the one
+ * being written. */
+template <typename Entry,
+          typename NodeT,
+          typename ChildrenOf,
+          typename EntryOf,
+          typename O>
+auto flatten_to(NodeT root,
+                Entry root_entry,
+                ChildrenOf children_of,
+                EntryOf entry_of,
+                O out) -> O
+{
+    std::queue<NodeT> frontier;
+    frontier.push(root);
+    *out++ = std::move(root_entry);
+    *out++ = Entry{std::nullopt};
+
+    while (not frontier.empty()) {
+        const auto current = frontier.front();
+        frontier.pop();
+        for (const auto child : children_of(current)) {
+            *out++ = entry_of(child);
+            frontier.push(child);
+        }
+        *out++ = Entry{std::nullopt};
+    }
+    return out;
+}
+
+/* Sequence kept in chunks of bounded size. Inserting or erasing elements at
+ * arbitrary position costs O(size / kChunk + kChunk) plus number of
+ * elements inserted or erased, unlike O(size) of a vector, so a long list
+ * can be edited many times and written back once. */
+template <typename T> class ChunkedSequence {
+public:
+    /* Take over elements of vector, leaving it empty. */
+    template <typename Allocator>
+    explicit ChunkedSequence(std::vector<T, Allocator>& elements)
+        : count{std::ssize(elements)}
+    {
+        for (auto first = elements.begin(); first != elements.end();) {
+            const auto last =
+                first + std::min(kChunk, std::distance(first, elements.end()));
+            chunks.emplace_back(std::make_move_iterator(first),
+                                std::make_move_iterator(last));
+            first = last;
+        }
+        elements.clear();
+    }
+
+    auto size() const -> int64_t { return count; }
+
+    /* Insert elements of [first, last) before position pos. */
+    template <std::input_iterator I>
+    auto insert(int64_t pos, I first, I last) -> void
+    {
+        if (chunks.empty()) {
+            chunks.emplace_back();
+        }
+        const auto [chunk, offset] = locate(pos);
+        auto& elements = chunks[chunk];
+        const auto before = std::ssize(elements);
+        elements.insert(elements.begin() + offset, first, last);
+        count += std::ssize(elements) - before;
+        if (std::ssize(elements) > 2 * kChunk) {
+            split(chunk);
+        }
+    }
+
+    /* Remove n elements starting from position pos and return them. */
+    auto erase(int64_t pos, int64_t n) -> std::vector<T>
+    {
+        std::vector<T> erased;
+        erased.reserve(static_cast<size_t>(n));
+        auto [chunk, offset] = locate(pos);
+        while (std::ssize(erased) < n) {
+            auto& elements = chunks[chunk];
+            const auto first = elements.begin() + offset;
+            const auto last =
+                first + std::min(n - std::ssize(erased),
+                                 std::distance(first, elements.end()));
+            std::move(first, last, std::back_inserter(erased));
+            elements.erase(first, last);
+            if (elements.empty()) {
+                chunks.erase(chunks.begin() + static_cast<int64_t>(chunk));
+            }
+            else {
+                ++chunk;
+            }
+            offset = 0;
+        }
+        count -= n;
+        return erased;
+    }
+
+    /* Func is (const T&) -> void */
+    template <typename Func> auto for_each(Func func) const -> void
+    {
+        for (const auto& elements : chunks) {
+            std::ranges::for_each(elements, func);
+        }
+    }
+
+    /* Move elements to the end of vector in order, leaving sequence empty. */
+    template <typename Allocator>
+    auto move_into(std::vector<T, Allocator>& elements) -> void
+    {
+        elements.reserve(elements.size() + static_cast<size_t>(count));
+        for (auto& chunk : chunks) {
+            std::ranges::move(chunk, std::back_inserter(elements));
+        }
+        chunks.clear();
+        count = 0;
+    }
+
+private:
+    static constexpr int64_t kChunk{256};
+
+    std::vector<std::vector<T>> chunks;
+    int64_t count{0};
+
+    /* Return chunk holding element at position pos and offset of the
+     * element in it. Position past the end is located in the last chunk.
+     * Chunks are walked from the end closer to pos. */
+    auto locate(int64_t pos) const -> std::pair<size_t, int64_t>
+    {
+        if (2 * pos <= count) {
+            size_t chunk{0};
+            for (; chunk + 1 < chunks.size() and
+                   pos >= std::ssize(chunks[chunk]);
+                 ++chunk) {
+                pos -= std::ssize(chunks[chunk]);
+            }
+            return {chunk, pos};
+        }
+        auto chunk = chunks.size() - 1;
+        auto before = count - std::ssize(chunks[chunk]);
+        while (pos < before) {
+            --chunk;
+            before -= std::ssize(chunks[chunk]);
+        }
+        return {chunk, pos - before};
+    }
+
+    auto split(size_t chunk) -> void
+    {
+        auto elements = std::move(chunks[chunk]);
+        std::vector<std::vector<T>> pieces;
+        for (auto first = elements.begin(); first != elements.end();) {
+            const auto last =
+                first + std::min(kChunk, std::distance(first, elements.end()));
+            pieces.emplace_back(std::make_move_iterator(first),
+                                std::make_move_iterator(last));
+            first = last;
+        }
+        chunks.erase(chunks.begin() + static_cast<int64_t>(chunk));
+        chunks.insert(chunks.begin() + static_cast<int64_t>(chunk),
+                      std::make_move_iterator(pieces.begin()),
+                      std::make_move_iterator(pieces.end()));
+    }
+};
+
+/* Piece of work of parallel tree algorithms: either single node or whole
+ * subtree rooted at the node. Pieces are listed in preorder of their nodes,
+ * parent is the index of the piece holding parent node or -1 if parent is
+ * not covered by any piece. */
+template <typename Iterator> struct WorkPiece {
+    Iterator node;
+    bool whole_subtree;
+    int64_t parent;
+};
+
+/* Number of pieces per thread parallel algorithms aim for. Subtrees differ in
+ * size, so pieces are handed out to threads dynamically and there should be
+ * enough of them for threads that got small ones to keep busy. */
+inline constexpr size_t kPiecesPerThread{16};
+
+/* Split subtree pieces level by level into their top nodes and subtrees of
+ * their children until there are enough pieces to keep given number of
+ * threads busy or nothing left to split. Order of pieces stays preorder. */
+template <typename TreeType, typename Iterator>
+auto split_into_pieces(TreeType& tree,
+                       std::vector<WorkPiece<Iterator>> pieces,
+                       unsigned threads) -> std::vector<WorkPiece<Iterator>>
+{
+    const auto target = size_t{threads} * kPiecesPerThread;
+    for (bool split{true}; split and pieces.size() < target;) {
+        split = false;
+        std::vector<WorkPiece<Iterator>> next;
+        next.reserve(pieces.size() * 2);
+        std::vector<int64_t> moved_to(pieces.size());
+        for (size_t i{0}; i < pieces.size(); ++i) {
+            const auto& piece = pieces[i];
+            moved_to[i] = std::ssize(next);
+            next.push_back({piece.node,
+                            false,
+                            piece.parent == -1
+                                ? -1
+                                : moved_to[static_cast<size_t>(piece.parent)]});
+            if (not piece.whole_subtree) {
+                continue;
+            }
+            for (auto child : tree.children_iterators(piece.node)) {
+                next.push_back({child, true, moved_to[i]});
+                split = true;
+            }
+        }
+        pieces = std::move(next);
+    }
+    return pieces;
+}
+
+/* Whether payloads of type U can be constructed on worker threads of
+ * parallel algorithms, when they end up in container using Allocator.
+ * Allocator-aware payloads allocate from the allocator of the container,
+ * which might be not thread-safe (i.e. pmr pools and arenas). */
+template <typename U, typename Allocator>
+inline constexpr bool constructible_in_parallel{
+    not std::uses_allocator_v<U, Allocator> or
+    std::same_as<Allocator, std::allocator<U>>};
+
+/* Call task(first, last) for consecutive ranges covering [0, count) on given
+ * number of threads, calling thread being one of them. If some task throws,
+ * remaining ranges are skipped and the first exception is rethrown once all
+ * threads are done. */
+template <typename Task>
+auto run_in_parallel(unsigned threads, size_t count, Task task) -> void
+{
+    const auto chunk =
+        std::max(size_t{1}, count / (size_t{threads} * kPiecesPerThread));
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto work = [&]() {
+        for (auto first = next.fetch_add(chunk);
+             first < count and not failed.load(std::memory_order_relaxed);
+             first = next.fetch_add(chunk)) {
+            try {
+                task(first, std::min(first + chunk, count));
+            }
+            catch (...) {
+                std::lock_guard lock{error_mutex};
+                if (not error) {
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+    };
+
+    {
+        const auto spawned =
+            std::min(size_t{threads}, (count + chunk - 1) / chunk);
+        std::vector<std::jthread> workers;
+        for (size_t i{1}; i < spawned; ++i) {
+            workers.emplace_back(work);
+        }
+        work();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/* Pieces covering all descendants of subtree_root. */
+template <typename TreeType, typename Iterator>
+auto pieces_of_descendants(TreeType& tree,
+                           Iterator subtree_root,
+                           unsigned threads) -> std::vector<WorkPiece<Iterator>>
+{
+    std::vector<WorkPiece<Iterator>> pieces;
+    for (auto child : tree.children_iterators(subtree_root)) {
+        pieces.push_back({child, true, -1});
+    }
+    return split_into_pieces(tree, std::move(pieces), threads);
+}
+
+/* Pieces covering subtree rooted at subtree_root or the whole tree if it is
+ * end iterator. */
+template <typename TreeType, typename Iterator>
+auto pieces_of_subtree(TreeType& tree, Iterator subtree_root, unsigned threads)
+    -> std::vector<WorkPiece<Iterator>>
+{
+    if (subtree_root != tree.end()) {
+        return split_into_pieces(tree,
+                                 std::vector<WorkPiece<Iterator>>{
+                                     {subtree_root, true, -1}},
+                                 threads);
+    }
+    return pieces_of_descendants(tree, subtree_root, threads);
+}
+
+/* Visit nodes of the piece in preorder. Children of visited node are visited
+ * only if visit returns true. */
+template <typename TreeType, typename Iterator, typename Visit>
+auto traverse_piece(TreeType& tree,
+                    const WorkPiece<Iterator>& piece,
+                    Visit visit) -> void
+{
+    if (not visit(piece.node) or not piece.whole_subtree) {
+        return;
+    }
+    std::stack<Iterator> frontier;
+    for (auto child : tree.children_iterators(piece.node) |
+                          std::views::reverse) {
+        frontier.push(child);
+    }
+    while (not frontier.empty()) {
+        auto current = frontier.top();
+        frontier.pop();
+        if (visit(current)) {
+            for (auto child : tree.children_iterators(current) |
+                                  std::views::reverse) {
+                frontier.push(child);
+            }
+        }
+    }
+}
+
+/* Build result tree from pieces in their order, so that the result does not
+ * depend on how pieces were processed. Nodes of each piece are placed in the
+ * same order traverse_piece visits them: place(piece_index, node, parent) is
+ * expected to insert node under parent into the result and return inserted
+ * node or nothing if node is dropped along with its subtree. */
+template <typename TreeType,
+          typename Iterator,
+          typename ResultIt,
+          typename Place>
+auto assemble_pieces(TreeType& tree,
+                     const std::vector<WorkPiece<Iterator>>& pieces,
+                     ResultIt top,
+                     Place place) -> void
+{
+    std::vector<std::optional<ResultIt>> placed(pieces.size());
+    std::stack<std::pair<Iterator, ResultIt>> frontier;
+    auto push_children = [&](Iterator node, ResultIt placed_node) {
+        for (auto child : tree.children_iterators(node) | std::views::reverse) {
+            frontier.push({child, placed_node});
+        }
+    };
+
+    for (size_t i{0}; i < pieces.size(); ++i) {
+        const auto& piece = pieces[i];
+        auto parent = top;
+        if (piece.parent != -1) {
+            const auto& placed_parent =
+                placed[static_cast<size_t>(piece.parent)];
+            if (not placed_parent) {
+                continue;
+            }
+            parent = *placed_parent;
+        }
+        placed[i] = place(i, piece.node, parent);
+        if (not placed[i] or not piece.whole_subtree) {
+            continue;
+        }
+        push_children(piece.node, *placed[i]);
+        while (not frontier.empty()) {
+            auto [current, placed_parent] = frontier.top();
+            frontier.pop();
+            if (auto placed_node = place(i, current, placed_parent)) {
+                push_children(current, *placed_node);
+            }
+        }
+    }
+}
+
+template <typename TreeType, typename Iterator, typename Fun, typename Proj>
+auto parallel_for_each(unsigned threads,
+                       TreeType& tree,
+                       Iterator subtree_root,
+                       Fun& fn,
+                       Proj& proj) -> void
+{
+    const auto pieces = pieces_of_subtree(tree, subtree_root, threads);
+    run_in_parallel(threads, pieces.size(), [&](size_t first, size_t last) {
+        for (; first < last; ++first) {
+            traverse_piece(tree, pieces[first], [&](Iterator node) {
+                std::invoke(fn, std::invoke(proj, *node));
+                return true;
+            });
+        }
+    });
+}
+
+/* Find first node in preorder among descendants of subtree_root satisfying
+ * predicate. Pieces following the piece with a match found so far are
+ * abandoned. */
+template <typename TreeType, typename Iterator, typename Pred, typename Proj>
+auto parallel_find_if(unsigned threads,
+                      TreeType& tree,
+                      Iterator subtree_root,
+                      Pred& pred,
+                      Proj& proj) -> Iterator
+{
+    constexpr auto none = std::numeric_limits<size_t>::max();
+    const auto pieces = pieces_of_descendants(tree, subtree_root, threads);
+    std::vector<std::optional<Iterator>> found(pieces.size());
+    std::atomic<size_t> first_found{none};
+
+    run_in_parallel(threads, pieces.size(), [&](size_t first, size_t last) {
+        for (auto i = first; i < last; ++i) {
+            traverse_piece(tree, pieces[i], [&](Iterator node) {
+                if (found[i] or
+                    first_found.load(std::memory_order_relaxed) < i) {
+                    return false;
+                }
+                if (not std::invoke(pred, std::invoke(proj, *node))) {
+                    return true;
+                }
+                found[i] = node;
+                auto current = first_found.load(std::memory_order_relaxed);
+                while (i < current and
+                       not first_found.compare_exchange_weak(current, i)) { }
+                return false;
+            });
+        }
+    });
+
+    const auto result = first_found.load();
+    return result == none ? tree.end() : *found[result];
+}
+
+template <typename TreeType, typename Keep>
+auto parallel_filter(unsigned threads, const TreeType& tree, Keep& keep)
+    -> TreeType
+{
+    using Iterator = typename TreeType::const_iterator;
+    const auto pieces = pieces_of_subtree(tree, tree.cend(), threads);
+    std::vector<std::vector<bool>> kept(pieces.size());
+    run_in_parallel(threads, pieces.size(), [&](size_t first, size_t last) {
+        for (auto i = first; i < last; ++i) {
+            traverse_piece(tree, pieces[i], [&](Iterator node) {
+                kept[i].push_back(static_cast<bool>(keep(node)));
+                return kept[i].back();
+            });
+        }
+    });
+
+    TreeType res{tree.get_allocator()};
+    size_t current_piece{0};
+    size_t next{0};
+    assemble_pieces(
+        tree,
+        pieces,
+        res.end(),
+        [&](size_t i, Iterator node, typename TreeType::iterator parent)
+            -> std::optional<typename TreeType::iterator> {
+            if (i != current_piece) {
+                current_piece = i;
+                next = 0;
+            }
+            if (not kept[i][next++]) {
+                return std::nullopt;
+            }
+            return res.insert(parent, *node);
+        });
+    return res;
+}
+
+template <typename TreeType, typename Func, typename Proj>
+auto parallel_transform(unsigned threads,
+                        const TreeType& tree,
+                        Func& func,
+                        Proj& proj)
+{
+    using Iterator = typename TreeType::const_iterator;
+    using Mapped = decltype(tree.transform(func, proj));
+    const auto pieces = pieces_of_subtree(tree, tree.cend(), threads);
+    std::vector<std::vector<typename Mapped::value_type>> mapped_payloads(
+        pieces.size());
+    run_in_parallel(threads, pieces.size(), [&](size_t first, size_t last) {
+        for (auto i = first; i < last; ++i) {
+            traverse_piece(tree, pieces[i], [&](Iterator node) {
+                mapped_payloads[i].push_back(
+                    std::invoke(func, std::invoke(proj, *node)));
+                return true;
+            });
+        }
+    });
+
+    Mapped mapped{typename Mapped::allocator_type{tree.get_allocator()}};
+    size_t current_piece{0};
+    size_t next{0};
+    assemble_pieces(
+        tree,
+        pieces,
+        mapped.end(),
+        [&](size_t i, Iterator, typename Mapped::iterator parent)
+            -> std::optional<typename Mapped::iterator> {
+            if (i != current_piece) {
+                current_piece = i;
+                next = 0;
+            }
+            return mapped.insert(parent, std::move(mapped_payloads[i][next++]));
+        });
+    return mapped;
+}
+
 } // namespace details
 
 namespace ds {
@@ -29,12 +769,43 @@ using SourcePosition = types::ImplicitNamedType<int64_t, details::SourcePosTag>;
 using DestinationPosition =
     types::ImplicitNamedType<int64_t, details::DestinationPosTag>;
 
+/* Default hash of key registries of TreeMap and UniqueElementsTree.
+ *
+ * Hash of strings is transparent, so that string keys can be looked up by
+ * std::string_view or string literal without building a temporary string.
+ * Other keys are hashed with std::hash. */
+template <typename Key> struct RegistryHash : std::hash<Key> { };
+
+template <typename Alloc>
+struct RegistryHash<std::basic_string<char, std::char_traits<char>, Alloc>> {
+    using is_transparent = void;
+
+    auto operator()(std::string_view key) const -> size_t
+    {
+        return std::hash<std::string_view>{}(key);
+    }
+};
+
+/* Execution policy selecting parallel overloads of tree algorithms.
+ *
+ * Parallel overloads split the tree at sibling subtrees into many more pieces
+ * than there are threads and hand pieces out to threads as they become free,
+ * so that threads that got small subtrees pick up more work. Functions given
+ * to them are called concurrently from different threads.
+ *
+ * Standard execution policies are not used, as <execution> of libstdc++
+ * requires linking with TBB whenever TBB headers are installed. */
+struct Parallel {
+    unsigned threads{std::max(1U, std::thread::hardware_concurrency())};
+};
+
 /*
  * Returns a range of elements in a subtree.
  *
- * Allows to use range-based algorithms (that require std::forward_iterator, as Tree implementations only do provide forward iterators) directly on subtrees.
+ * Allows to use range-based algorithms directly on subtrees.
  *
- * Note that due to tree structure in order to build this view whole subtree must be traversed once, so complexity is linear in a size of subtree. There might be a faster implementation of specific algorithm in this header, so check this first.
+ * End of the range is found with tree skip_subtree(), so the subtree itself is
+ * not traversed.
  */
 template <typename TreeType>
 auto subtree_view(const TreeType& tree,
@@ -44,43 +815,16 @@ auto subtree_view(const TreeType& tree,
     if (subtree_root == tree.end()) {
         return std::ranges::subrange(tree.begin(), tree.end());
     }
-    // For a proper subtree range, we need to find the end of the subtree
-    // Since our iterators are preorder, the end of the subtree is the next
-    // sibling or the next node after the subtree in preorder traversal
-
-    // Find the end of the subtree by doing a DFS to find the last node
-    // and then getting the iterator after that node
-    auto last_node = subtree_root;
-    std::stack<typename TreeType::const_iterator> frontier;
-    frontier.push(subtree_root);
-
-    while (not frontier.empty()) {
-        last_node = frontier.top();
-        frontier.pop();
-
-#ifdef __cpp_lib_containers_ranges
-        frontier.push_range(tree.children_iterators(last_node) |
-                            std::views::reverse);
-#else
-        std::ranges::for_each(
-            tree.children_iterators(last_node) | std::views::reverse,
-            [&frontier](auto child) { frontier.push(child); });
-#endif
-    }
-
-    // The end of the subtree is the iterator after the last node
-    auto end_it = last_node;
-    ++end_it;
-
-    return std::ranges::subrange(subtree_root, end_it);
+    return std::ranges::subrange(subtree_root, tree.skip_subtree(subtree_root));
 }
 
 /*
  * Returns a range of elements in a subtree.
  *
- * Allows to use range-based algorithms (that require std::forward_iterator, as Tree implementations only do provide forward iterators) directly on subtrees.
+ * Allows to use range-based algorithms directly on subtrees.
  *
- * Note that due to tree structure in order to build this view whole subtree must be traversed once, so complexity is linear in a size of subtree. There might be a faster implementation of specific algorithm in this header, so check this first.
+ * End of the range is found with tree skip_subtree(), so the subtree itself is
+ * not traversed.
  */
 template <typename TreeType>
 auto subtree_view(TreeType& tree, typename TreeType::iterator subtree_root)
@@ -89,35 +833,7 @@ auto subtree_view(TreeType& tree, typename TreeType::iterator subtree_root)
     if (subtree_root == tree.end()) {
         return std::ranges::subrange(tree.begin(), tree.end());
     }
-    // For a proper subtree range, we need to find the end of the subtree
-    // Since our iterators are preorder, the end of the subtree is the next
-    // sibling or the next node after the subtree in preorder traversal
-
-    // Find the end of the subtree by doing a DFS to find the last node
-    // and then getting the iterator after that node
-    auto last_node = subtree_root;
-    std::stack<typename TreeType::iterator> frontier;
-    frontier.push(subtree_root);
-
-    while (not frontier.empty()) {
-        last_node = frontier.top();
-        frontier.pop();
-
-#ifdef __cpp_lib_containers_ranges
-        frontier.push_range(tree.children_iterators(last_node) |
-                            std::views::reverse);
-#else
-        std::ranges::for_each(
-            tree.children_iterators(last_node) | std::views::reverse,
-            [&frontier](auto child) { frontier.push(child); });
-#endif
-    }
-
-    // The end of the subtree is the iterator after the last node
-    auto end_it = last_node;
-    ++end_it;
-
-    return std::ranges::subrange(subtree_root, end_it);
+    return std::ranges::subrange(subtree_root, tree.skip_subtree(subtree_root));
 }
 
 /* Tree types do provide iterators, but those iterators do not support iterating
@@ -397,7 +1113,7 @@ auto arrange_by(
     std::predicate<typename TreeType::const_iterator::element_type> auto pred)
     -> TreeType
 {
-    TreeType res;
+    TreeType res{tree.get_allocator()};
     for (auto it = tree.cbegin(); it != tree.cend(); ++it) {
         if (std::invoke(pred, *it)) {
             res.insert_subtree(res.end(),
@@ -421,7 +1137,7 @@ auto filter(
     std::indirect_unary_predicate<typename TreeType::const_iterator> auto pred)
     -> TreeType
 {
-    TreeType res;
+    TreeType res{tree.get_allocator()};
     std::queue<std::pair<typename TreeType::const_iterator,
                          typename TreeType::iterator>>
         frontier;
@@ -461,7 +1177,7 @@ auto filter_it(const TreeType& tree,
                std::predicate<typename TreeType::const_iterator> auto pred)
     -> TreeType
 {
-    TreeType res;
+    TreeType res{tree.get_allocator()};
     std::queue<std::pair<typename TreeType::const_iterator,
                          typename TreeType::iterator>>
         frontier;
@@ -489,6 +1205,332 @@ auto filter_it(const TreeType& tree,
     return res;
 }
 
+/* Parallel counterparts of the algorithms above.
+ *
+ * for_each calls fn for nodes in no particular order. find and find_if
+ * return the first matching node in preorder, same as their sequential
+ * versions do when searching the whole tree. filter, filter_it and transform
+ * evaluate predicate or function in parallel and then assemble the result
+ * tree sequentially, so that the result is the same as the one of the
+ * sequential version.
+ */
+
+template <typename TreeType,
+          typename Proj = std::identity,
+          std::indirectly_unary_invocable<
+              std::projected<typename TreeType::iterator, Proj>> Fun>
+auto for_each(const Parallel& policy,
+              TreeType& tree,
+              typename TreeType::iterator subtree_root,
+              Fun fn,
+              Proj proj = {}) -> void
+{
+    details::parallel_for_each(policy.threads, tree, subtree_root, fn, proj);
+}
+
+template <typename TreeType,
+          typename Proj = std::identity,
+          std::indirectly_unary_invocable<
+              std::projected<typename TreeType::const_iterator, Proj>> Fun>
+auto for_each(const Parallel& policy,
+              const TreeType& tree,
+              typename TreeType::const_iterator subtree_root,
+              Fun fn,
+              Proj proj = {}) -> void
+{
+    details::parallel_for_each(policy.threads, tree, subtree_root, fn, proj);
+}
+
+template <typename TreeType, typename Proj = std::identity, typename V>
+    requires std::indirect_binary_predicate<
+        std::ranges::equal_to,
+        std::projected<typename TreeType::iterator, Proj>,
+        const V*>
+auto find(const Parallel& policy,
+          TreeType& tree,
+          typename TreeType::iterator subtree_root,
+          const V& value,
+          Proj proj = {}) -> TreeType::iterator
+{
+    auto pred = [&value](const auto& payload) { return payload == value; };
+    return details::parallel_find_if(
+        policy.threads, tree, subtree_root, pred, proj);
+}
+
+template <typename TreeType, typename Proj = std::identity, typename V>
+    requires std::indirect_binary_predicate<
+        std::ranges::equal_to,
+        std::projected<typename TreeType::const_iterator, Proj>,
+        const V*>
+auto find(const Parallel& policy,
+          const TreeType& tree,
+          typename TreeType::const_iterator subtree_root,
+          const V& value,
+          Proj proj = {}) -> TreeType::const_iterator
+{
+    auto pred = [&value](const auto& payload) { return payload == value; };
+    return details::parallel_find_if(
+        policy.threads, tree, subtree_root, pred, proj);
+}
+
+template <typename TreeType,
+          typename Proj = std::identity,
+          std::indirect_unary_predicate<
+              std::projected<typename TreeType::iterator, Proj>> Pred>
+auto find_if(const Parallel& policy,
+             TreeType& tree,
+             typename TreeType::iterator subtree_root,
+             Pred pred,
+             Proj proj = {}) -> TreeType::iterator
+{
+    return details::parallel_find_if(
+        policy.threads, tree, subtree_root, pred, proj);
+}
+
+template <typename TreeType,
+          typename Proj = std::identity,
+          std::indirect_unary_predicate<
+              std::projected<typename TreeType::const_iterator, Proj>> Pred>
+auto find_if(const Parallel& policy,
+             const TreeType& tree,
+             typename TreeType::const_iterator subtree_root,
+             Pred pred,
+             Proj proj = {}) -> TreeType::const_iterator
+{
+    return details::parallel_find_if(
+        policy.threads, tree, subtree_root, pred, proj);
+}
+
+template <typename TreeType>
+auto filter(
+    const Parallel& policy,
+    const TreeType& tree,
+    std::indirect_unary_predicate<typename TreeType::const_iterator> auto pred)
+    -> TreeType
+{
+    auto keep = [&pred](typename TreeType::const_iterator it) {
+        return pred(*it);
+    };
+    return details::parallel_filter(policy.threads, tree, keep);
+}
+
+template <typename TreeType>
+auto filter_it(const Parallel& policy,
+               const TreeType& tree,
+               std::predicate<typename TreeType::const_iterator> auto pred)
+    -> TreeType
+{
+    return details::parallel_filter(policy.threads, tree, pred);
+}
+
+/* Parallel counterpart of transform member function of the tree. Trees
+ * providing parallel transform of their own (Tree, LinearTree) use it. */
+template <typename TreeType, typename Func, typename Proj = std::identity>
+auto transform(const Parallel& policy,
+               const TreeType& tree,
+               Func func,
+               Proj proj = {})
+{
+    if constexpr (requires { tree.transform(policy, func, proj); }) {
+        return tree.transform(policy, func, proj);
+    }
+    else {
+        return details::parallel_transform(policy.threads, tree, func, proj);
+    }
+}
+
+/* Answers lowest common ancestor, depth and distance queries for nodes of a
+ * tree.
+ *
+ * Index is built with a single preorder pass over the tree. Lowest common
+ * ancestor of two distinct nodes u and v, u preceding v in preorder, is the
+ * parent of the shallowest node in preorder range (u, v], so each query is
+ * reduced to a range minimum over node depths. Range minimum is answered with
+ * a sparse table over fixed-size blocks of nodes plus a scan of two boundary
+ * blocks, which gives constant time queries with linear memory.
+ *
+ * Nodes are identified by address of their payload, so index does not need
+ * anything from the tree besides iterators, parent() and size().
+ *
+ * Index does not observe the tree. Any structural modification (insertion,
+ * erasure, moving nodes) must be followed by invalidate(), index is then
+ * rebuilt by the next query. Modifying payloads does not require that.
+ * Rebuild happens on const queries, so call rebuild() explicitly before
+ * sharing index between threads.
+ *
+ * Tree root (end() iterator) is a common ancestor of all top-level nodes and
+ * has depth -1, top-level nodes have depth 0.
+ * */
+template <typename TreeType> class lca_index {
+public:
+    using const_iterator = typename TreeType::const_iterator;
+
+    explicit lca_index(const TreeType& indexed_tree)
+        : tree{&indexed_tree}
+    {
+    }
+
+    /* Marks index as stale, it will be rebuilt by the next query. */
+    auto invalidate() -> void { index.valid = false; }
+
+    auto rebuild() const -> void
+    {
+        index = Index{};
+        const auto node_count = static_cast<size_t>(tree->size());
+        index.positions.reserve(node_count);
+        index.nodes.reserve(node_count);
+        index.parents.reserve(node_count);
+        index.depths.reserve(node_count);
+
+        for (auto it = tree->cbegin(); it != tree->cend(); ++it) {
+            const auto parent = tree->parent(it);
+            const auto parent_pos =
+                parent == tree->cend()
+                    ? npos
+                    : index.positions.at(std::addressof(*parent));
+            index.positions.emplace(std::addressof(*it), index.nodes.size());
+            index.nodes.push_back(it);
+            index.parents.push_back(parent_pos);
+            index.depths.push_back(
+                parent_pos == npos ? 0 : index.depths[parent_pos] + 1);
+        }
+
+        build_sparse_table();
+        index.valid = true;
+    }
+
+    auto lca(const_iterator a, const_iterator b) const -> const_iterator
+    {
+        if (a == tree->cend() or b == tree->cend()) {
+            return tree->cend();
+        }
+        auto first = position_of(a);
+        auto last = position_of(b);
+        if (first == last) {
+            return a;
+        }
+        if (first > last) {
+            std::swap(first, last);
+        }
+        const auto parent_pos = index.parents[shallowest(first + 1, last)];
+        return parent_pos == npos ? tree->cend() : index.nodes[parent_pos];
+    }
+
+    auto depth(const_iterator it) const -> int64_t
+    {
+        if (it == tree->cend()) {
+            return -1;
+        }
+        const auto pos = position_of(it);
+        return index.depths[pos];
+    }
+
+    /* Returns number of edges on the path between nodes. Nodes in different
+     * top-level subtrees are connected through the tree root. */
+    auto distance(const_iterator a, const_iterator b) const -> int64_t
+    {
+        return depth(a) + depth(b) - 2 * depth(lca(a, b));
+    }
+
+private:
+    static constexpr size_t block_size{64};
+    static constexpr size_t npos{std::numeric_limits<size_t>::max()};
+
+    struct Index {
+        std::unordered_map<const typename TreeType::value_type*, size_t>
+            positions;
+        std::vector<const_iterator> nodes;
+        std::vector<size_t> parents;
+        std::vector<int64_t> depths;
+        /* blocks[k][b] is the shallowest node in blocks [b, b + 2^k). */
+        std::vector<std::vector<size_t>> blocks;
+        bool valid{false};
+    };
+
+    const TreeType* tree;
+    mutable Index index;
+
+    auto position_of(const_iterator it) const -> size_t
+    {
+        if (not index.valid) {
+            rebuild();
+        }
+        const auto pos = index.positions.find(std::addressof(*it));
+        if (pos == index.positions.end()) {
+            throw std::out_of_range("Node is not in the index");
+        }
+        return pos->second;
+    }
+
+    auto shallower(size_t lhs, size_t rhs) const -> size_t
+    {
+        return index.depths[rhs] < index.depths[lhs] ? rhs : lhs;
+    }
+
+    auto scan(size_t first, size_t last) const -> size_t
+    {
+        auto res = first;
+        for (auto pos = first + 1; pos <= last; ++pos) {
+            res = shallower(res, pos);
+        }
+        return res;
+    }
+
+    auto build_sparse_table() const -> void
+    {
+        const auto node_count = index.nodes.size();
+        const auto block_count = (node_count + block_size - 1) / block_size;
+        if (block_count == 0) {
+            return;
+        }
+
+        auto& first_level = index.blocks.emplace_back();
+        first_level.reserve(block_count);
+        for (size_t block{0}; block < block_count; ++block) {
+            first_level.push_back(
+                scan(block * block_size,
+                     std::min(node_count, (block + 1) * block_size) - 1));
+        }
+
+        for (size_t span{2}; span <= block_count; span *= 2) {
+            const auto& prev = index.blocks.back();
+            std::vector<size_t> level;
+            level.reserve(block_count - span + 1);
+            for (size_t block{0}; block + span <= block_count; ++block) {
+                level.push_back(
+                    shallower(prev[block], prev[block + span / 2]));
+            }
+            index.blocks.push_back(std::move(level));
+        }
+    }
+
+    /* Returns position of the shallowest node in preorder range
+     * [first, last]. */
+    auto shallowest(size_t first, size_t last) const -> size_t
+    {
+        const auto first_block = first / block_size;
+        const auto last_block = last / block_size;
+        if (first_block == last_block) {
+            return scan(first, last);
+        }
+
+        auto res = shallower(scan(first, (first_block + 1) * block_size - 1),
+                             scan(last_block * block_size, last));
+        if (last_block - first_block > 1) {
+            const auto span = last_block - first_block - 1;
+            const auto level_span = std::bit_floor(span);
+            const auto level =
+                static_cast<size_t>(std::countr_zero(level_span));
+            const auto& blocks = index.blocks[level];
+            const auto last_span_block = last_block - level_span;
+            res = shallower(res,
+                            shallower(blocks[first_block + 1],
+                                      blocks[last_span_block]));
+        }
+        return res;
+    }
+};
+
 } // namespace ds
 
 #endif /* end of include guard: TREECOMMON_H_HPODLZ4K */
@@ -0,0 +1,368 @@
+#ifndef TREEIMAGE_H_W7NQ3KDZ
+#define TREEIMAGE_H_W7NQ3KDZ
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <ostream>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+/* Binary image of a tree with trivially copyable payloads (and keys).
+ *
+ * Image is laid out so that it can be used in place, e.g. straight from a
+ * mapped file, without parsing or rebuilding anything:
+ *
+ *   header          ImageHeader
+ *   parents         uint32_t[node_count], position of parent or no_node
+ *   next siblings   uint32_t[node_count], position of sibling or no_node
+ *   keys            K[node_count], only present in images of TreeMap
+ *   payloads        T[node_count]
+ *
+ * Nodes are listed in preorder, so positions of nodes of any subtree are
+ * contiguous, first child of a node, if any, directly follows it and
+ * payloads section is the preorder traversal of the tree. Each section starts
+ * at multiple of image_alignment from the start of image. Numbers and
+ * payloads are stored in native byte order, image written on a machine with
+ * different byte order is rejected rather than converted. */
+
+namespace details {
+
+inline constexpr std::array<char, 8> image_magic{
+    'c', 'p', 'p', 't', 'r', 'e', 'e', '\0'};
+inline constexpr uint32_t image_version{1};
+inline constexpr uint32_t image_byte_order{0x01020304};
+inline constexpr size_t image_alignment{16};
+inline constexpr uint32_t no_node{std::numeric_limits<uint32_t>::max()};
+
+/* Key type of images without keys section. */
+struct NoKey { };
+
+struct ImageHeader {
+    std::array<char, 8> magic{image_magic};
+    uint32_t version{image_version};
+    uint32_t byte_order{image_byte_order};
+    uint64_t node_count{0};
+    uint32_t key_size{0};
+    uint32_t key_alignment{0};
+    uint32_t payload_size{0};
+    uint32_t payload_alignment{0};
+};
+
+static_assert(sizeof(ImageHeader) == 40);
+
+template <typename U>
+concept ImageStorable = std::is_trivially_copyable_v<U> and
+                        alignof(U) <= image_alignment;
+
+constexpr auto align_to_image(size_t offset) -> size_t
+{
+    return (offset + image_alignment - 1) / image_alignment * image_alignment;
+}
+
+/* Offsets of image sections in bytes from the start of image. */
+struct ImageLayout {
+    explicit constexpr ImageLayout(const ImageHeader& header)
+        : parents{align_to_image(sizeof(ImageHeader))}
+        , next_siblings{align_to_image(parents + header.node_count *
+                                                     sizeof(uint32_t))}
+        , keys{align_to_image(next_siblings +
+                              header.node_count * sizeof(uint32_t))}
+        , payloads{align_to_image(keys + header.node_count * header.key_size)}
+        , size{align_to_image(payloads +
+                              header.node_count * header.payload_size)}
+    {
+    }
+
+    size_t parents;
+    size_t next_siblings;
+    size_t keys;
+    size_t payloads;
+    size_t size;
+};
+
+/* Return position of next sibling of every node of the tree given by
+ * preorder parent positions (-1 for top-level nodes). */
+inline auto next_sibling_positions(std::span<const int64_t> parents)
+    -> std::vector<uint32_t>
+{
+    std::vector<uint32_t> next_siblings(parents.size(), no_node);
+    // Walking backwards, last seen child of a node is the next sibling of
+    // the current one
+    std::vector<uint32_t> last_children(parents.size(), no_node);
+    uint32_t last_top_level{no_node};
+
+    for (auto i = parents.size(); i-- > 0;) {
+        auto& following =
+            parents[i] == -1 ? last_top_level
+                             : last_children[static_cast<size_t>(parents[i])];
+        next_siblings[i] = following;
+        following = static_cast<uint32_t>(i);
+    }
+
+    return next_siblings;
+}
+
+/* Write image of the tree given by preorder parent positions (-1 for
+ * top-level nodes) with keys and payloads listed in the same order. Key is
+ * NoKey for images without keys section. */
+template <typename Key, ImageStorable Payload>
+auto write_image(std::ostream& os,
+                 std::span<const int64_t> parents,
+                 std::ranges::input_range auto&& keys,
+                 std::ranges::input_range auto&& payloads) -> void
+{
+    if (parents.size() >= no_node) {
+        throw std::length_error{"Tree is too large for an image"};
+    }
+
+    ImageHeader header;
+    header.node_count = parents.size();
+    if constexpr (not std::same_as<Key, NoKey>) {
+        static_assert(ImageStorable<Key>);
+        header.key_size = sizeof(Key);
+        header.key_alignment = alignof(Key);
+    }
+    header.payload_size = sizeof(Payload);
+    header.payload_alignment = alignof(Payload);
+    const ImageLayout layout{header};
+
+    size_t written{0};
+    const auto write = [&os, &written]<typename U>(const U& value) {
+        os.write(reinterpret_cast<const char*>(&value), sizeof(U));
+        written += sizeof(U);
+    };
+    const auto pad_to = [&os, &written](size_t offset) {
+        for (; written < offset; ++written) {
+            os.put('\0');
+        }
+    };
+
+    write(header);
+    pad_to(layout.parents);
+    for (const auto parent : parents) {
+        write(parent == -1 ? no_node : static_cast<uint32_t>(parent));
+    }
+    pad_to(layout.next_siblings);
+    for (const auto sibling : next_sibling_positions(parents)) {
+        write(sibling);
+    }
+    if constexpr (not std::same_as<Key, NoKey>) {
+        pad_to(layout.keys);
+        for (const Key& key : keys) {
+            write(key);
+        }
+    }
+    pad_to(layout.payloads);
+    for (const Payload& payload : payloads) {
+        write(payload);
+    }
+    pad_to(layout.size);
+}
+
+} // namespace details
+
+namespace ds {
+
+/* Read-only tree over binary image, see TreeImage.h for layout.
+ *
+ * View does not own the image, it reads nodes straight from it, so opening
+ * a view over mapped file takes constant time regardless of tree size. Only
+ * the header is validated, contents of the image are trusted. Use from_image
+ * of a tree to get a mutable, validated copy instead.
+ *
+ * Nodes are identified by their preorder positions, iterating over the view
+ * yields payloads in preorder. */
+template <details::ImageStorable T> class TreeImageView {
+public:
+    /* Iterates over chain of siblings starting from given node. */
+    class SiblingIterator {
+    public:
+        using value_type = int64_t;
+        using difference_type = std::ptrdiff_t;
+
+        SiblingIterator() = default;
+
+        SiblingIterator(const uint32_t* next_siblings_, uint32_t node_)
+            : next_siblings{next_siblings_}
+            , node{node_}
+        {
+        }
+
+        auto operator*() const -> int64_t { return node; }
+
+        auto operator++() -> SiblingIterator&
+        {
+            node = next_siblings[node];
+            return *this;
+        }
+
+        auto operator++(int) -> SiblingIterator
+        {
+            auto copy{*this};
+            ++*this;
+            return copy;
+        }
+
+        friend auto operator==(const SiblingIterator& lhs,
+                               const SiblingIterator& rhs) -> bool
+        {
+            return lhs.node == rhs.node;
+        }
+
+        friend auto operator==(const SiblingIterator& it,
+                               std::default_sentinel_t) -> bool
+        {
+            return it.node == details::no_node;
+        }
+
+    private:
+        const uint32_t* next_siblings{nullptr};
+        uint32_t node{details::no_node};
+    };
+
+    /* Throws std::invalid_argument if image is truncated, misaligned,
+     * written with another version of format, on machine with different
+     * byte order or for payloads of different size. */
+    using value_type = T;
+
+    explicit TreeImageView(std::span<const std::byte> image)
+    {
+        if (image.size() < sizeof(details::ImageHeader)) {
+            throw std::invalid_argument{"Image is truncated"};
+        }
+        std::memcpy(&header, image.data(), sizeof(details::ImageHeader));
+        if (header.magic != details::image_magic) {
+            throw std::invalid_argument{"Not a tree image"};
+        }
+        if (header.byte_order != details::image_byte_order) {
+            throw std::invalid_argument{"Image has foreign byte order"};
+        }
+        if (header.version != details::image_version) {
+            throw std::invalid_argument{"Unsupported image version"};
+        }
+        if (header.payload_size != sizeof(T) or
+            header.payload_alignment != alignof(T)) {
+            throw std::invalid_argument{"Image holds payloads of other type"};
+        }
+        if (header.node_count >= details::no_node or
+            details::ImageLayout{header}.size > image.size()) {
+            throw std::invalid_argument{"Image is truncated"};
+        }
+        if (reinterpret_cast<std::uintptr_t>(image.data()) %
+                details::image_alignment !=
+            0) {
+            throw std::invalid_argument{"Image is not aligned"};
+        }
+        data = image.data();
+    }
+
+    auto size() const -> int64_t
+    {
+        return static_cast<int64_t>(header.node_count);
+    }
+
+    auto empty() const -> bool { return header.node_count == 0; }
+
+    /* Return payloads of all nodes in preorder. */
+    auto payloads() const -> std::span<const T>
+    {
+        return section<T>(details::ImageLayout{header}.payloads);
+    }
+
+    auto begin() const { return payloads().begin(); }
+
+    auto end() const { return payloads().end(); }
+
+    auto payload(int64_t node) const -> const T&
+    {
+        throw_if_invalid_node(node);
+        return payloads()[static_cast<size_t>(node)];
+    }
+
+    /* Return keys of all nodes in preorder. Throws std::invalid_argument if
+     * image has no keys of type K. */
+    template <details::ImageStorable K> auto keys() const -> std::span<const K>
+    {
+        if (header.key_size != sizeof(K) or header.key_alignment != alignof(K)) {
+            throw std::invalid_argument{"Image holds no keys of this type"};
+        }
+        return section<K>(details::ImageLayout{header}.keys);
+    }
+
+    /* Return parent of node, if it is not a top-level one. */
+    auto parent(int64_t node) const -> std::optional<int64_t>
+    {
+        throw_if_invalid_node(node);
+        const auto parent = parents()[static_cast<size_t>(node)];
+        return parent == details::no_node ? std::nullopt
+                                          : std::optional<int64_t>{parent};
+    }
+
+    /* Return parents of all nodes as accepted by from_parent_indexes. */
+    auto parent_indexes() const -> std::vector<int64_t>
+    {
+        std::vector<int64_t> indexes;
+        indexes.reserve(header.node_count);
+        for (const auto parent : parents()) {
+            indexes.push_back(parent == details::no_node ? int64_t{-1}
+                                                         : int64_t{parent});
+        }
+        return indexes;
+    }
+
+    /* Return view to positions of children of node. */
+    auto children(int64_t node) const
+    {
+        throw_if_invalid_node(node);
+        const auto first = static_cast<uint32_t>(node) + 1;
+        const auto has_children = first < header.node_count and
+                                  parents()[first] == static_cast<uint32_t>(node);
+        return siblings(has_children ? first : details::no_node);
+    }
+
+    /* Return view to positions of top-level nodes. */
+    auto roots() const { return siblings(empty() ? details::no_node : 0); }
+
+private:
+    details::ImageHeader header;
+    const std::byte* data{nullptr};
+
+    template <typename U> auto section(size_t offset) const -> std::span<const U>
+    {
+        return {reinterpret_cast<const U*>(data + offset), header.node_count};
+    }
+
+    auto parents() const -> std::span<const uint32_t>
+    {
+        return section<uint32_t>(details::ImageLayout{header}.parents);
+    }
+
+    auto siblings(uint32_t first) const
+    {
+        return std::ranges::subrange{
+            SiblingIterator{
+                section<uint32_t>(details::ImageLayout{header}.next_siblings)
+                    .data(),
+                first},
+            std::default_sentinel};
+    }
+
+    auto throw_if_invalid_node(int64_t node) const -> void
+    {
+        if (node < 0 or node >= size()) {
+            throw std::out_of_range{"Node index out of range"};
+        }
+    }
+};
+
+} // namespace ds
+
+#endif /* end of include guard: TREEIMAGE_H_W7NQ3KDZ */
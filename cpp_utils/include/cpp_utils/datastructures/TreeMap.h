@@ -3,82 +3,208 @@
 
 #include "cpp_utils/algorithms/alg_ext.h"
 #include "cpp_utils/algorithms/optional_ext.h"
+#include "cpp_utils/datastructures/FlatHashMap.h"
+#include "cpp_utils/datastructures/TreeCommon.h"
+#include "cpp_utils/datastructures/TreeImage.h"
+#include <algorithm>
 #include <concepts>
 #include <exception>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <memory_resource>
 #include <queue>
 #include <ranges>
+#include <span>
 #include <sstream>
 #include <stack>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <variant>
 #include <vector>
 
 #include <iostream>
 
 namespace ds {
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
+/* Tree of unique keys with payloads. Nodes, their child lists and key
+ * registry are all allocated with Allocator, which is rebound as necessary.
+ * Keys and payloads are constructed with uses-allocator construction.
+ *
+ * Allocator propagation follows the usual container rules.
+ *
+ * Keys are looked up in a registry of type RegistryMap, which is FlatHashMap
+ * by default. Any map with std::unordered_map-like template parameters and
+ * interface, std::unordered_map itself included, can be used instead.
+ *
+ * Registry is instantiated with RegistryHash and std::equal_to<>, so string
+ * keys can be looked up by std::string_view or string literal without
+ * building temporary keys. Heterogeneous lookup of other key types is
+ * enabled by passing an alias of a map that binds transparent hash and
+ * equality of one's own as RegistryMap. */
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator = std::allocator<std::pair<const KeyT, PayloadT>>,
+          template <typename...> class RegistryMap = FlatHashMap>
 class TreeMap {
 
     template <typename TransformFunc>
     using TransformResultT = std::remove_cvref_t<
         std::invoke_result_t<TransformFunc, const PayloadT&>>;
 
+    template <typename TransformFunc>
+    using MappedTreeMap = TreeMap<
+        KeyT,
+        TransformResultT<TransformFunc>,
+        details::Rebind<
+            Allocator,
+            std::pair<const KeyT, TransformResultT<TransformFunc>>>,
+        RegistryMap>;
+
+    using AllocatorTraits = std::allocator_traits<Allocator>;
+
+    struct Node;
+    using NodePtr = details::NodePtr<Node, Allocator>;
+    using NodePtrAllocator = details::Rebind<Allocator, NodePtr>;
+
     struct Node {
-        Node(KeyT&& key_, PayloadT&& payload_, Node* parent_) noexcept
-            : key{std::move(key_)}
-            , payload{std::move(payload_)}
+        Node(KeyT&& key_,
+             PayloadT&& payload_,
+             Node* parent_,
+             const Allocator& alloc)
+            : key{std::make_obj_using_allocator<KeyT>(alloc, std::move(key_))}
+            , payload{std::make_obj_using_allocator<PayloadT>(
+                  alloc, std::move(payload_))}
             , parent{parent_}
+            , children(NodePtrAllocator{alloc})
         {
         }
 
-        Node() = default;
+        explicit Node(const Allocator& alloc)
+            : children(NodePtrAllocator{alloc})
+        {
+        }
 
         KeyT key;
         PayloadT payload;
         Node* parent{nullptr};
-        std::vector<std::unique_ptr<Node>> children;
+        // Position among children of parent
+        int64_t pos{0};
+        std::vector<NodePtr, NodePtrAllocator> children;
+
+        auto rebuildPositionIndexes(int64_t first) -> void
+        {
+            std::for_each(
+                children.begin() + first,
+                children.end(),
+                [pos = first](auto& child) mutable { child->pos = pos++; });
+        }
     };
 
-    std::unique_ptr<Node> root = std::make_unique<Node>();
-    std::unordered_map<KeyT, Node*> registry;
+    using Registry = RegistryMap<
+        KeyT,
+        Node*,
+        RegistryHash<KeyT>,
+        std::equal_to<>,
+        details::Rebind<Allocator, std::pair<const KeyT, Node*>>>;
+
+    /* Lookups accept keys of types registry can hash and compare with KeyT
+     * as they are, without building temporary KeyT, and keys of types
+     * convertible to KeyT. */
+    template <typename K>
+    static constexpr bool isLookupKey{
+        details::LookupKey<K,
+                           KeyT,
+                           typename Registry::hasher,
+                           typename Registry::key_equal>};
+
+    template <typename K>
+    static auto asLookupKey(const K& key) -> decltype(auto)
+    {
+        return details::lookup_key<KeyT,
+                                   typename Registry::hasher,
+                                   typename Registry::key_equal>(key);
+    }
+
+    [[no_unique_address]] Allocator allocator;
+    NodePtr root = makeNode();
+    Registry registry{typename Registry::allocator_type{allocator}};
+
+    template <typename... Args> auto makeNode(Args&&... args) const -> NodePtr
+    {
+        return details::allocate_node<Node>(
+            allocator, std::forward<Args>(args)..., allocator);
+    }
+
+    /* Replace contents with nodes of other, which must use equal allocator. */
+    auto steal(TreeMap& other) -> void;
 
-    auto releaseSubTreeMap(std::unique_ptr<Node> n) -> void;
+    /* Copy nodes of other into this empty tree in a single preorder pass.
+     * Keys of other are known to be unique, so they are not checked. */
+    auto cloneFrom(const TreeMap& other) -> void;
+
+    /* Destroy nodes of subtree in a single postorder pass. Registry is left
+     * intact, see forgetKeys. */
+    static auto releaseSubTreeMap(NodePtr n) -> void;
+
+    /* Remove keys of all nodes of detached subtrees from registry. */
+    auto forgetKeys(std::span<const NodePtr> subtrees) -> void;
 
     /* Func is (size_t level, const entry_t& entry) */
     template <typename Func>
     auto for_each(Func func, const Node* initial = nullptr) const -> void;
 
-    auto addChildInternal(std::unique_ptr<Node> child,
-                          const std::optional<KeyT>& parent,
-                          int64_t insertBeforePosition) -> void;
+    /* Append new node as last child of parent, which is known to be in the
+     * tree. Throws if key is already present. */
+    auto appendChild(Node* parent, KeyT&& key, PayloadT&& payload) -> Node*;
 
     auto removeNodesInternal(const std::optional<KeyT>& parent,
                              int64_t row,
                              int64_t count) -> void;
 
+    /* Remove count children of parent starting from row, which are known to
+     * be there, along with their subtrees. */
+    auto removeChildren(Node* parent, int64_t row, int64_t count) -> void;
+
     /* Returns pointer to node with given key if it is in the tree, otherwise
      * thows. Returns pointer to root when key is not given. */
     auto tryLocateNode(const std::optional<KeyT>& key) const -> Node*;
 
+    [[noreturn]] static auto
+    throwIndexingError(std::string_view operation,
+                       const std::optional<KeyT>& parent,
+                       int64_t row,
+                       int64_t count) -> void;
+
 public:
     using entry_t = std::pair<KeyT, PayloadT>;
+    using allocator_type = Allocator;
 
     TreeMap();
 
-    TreeMap<KeyT, PayloadT> subTreeMap(const KeyT& key) const;
+    explicit TreeMap(const Allocator& alloc);
+
+    TreeMap subTreeMap(const KeyT& key) const;
 
     ~TreeMap() { releaseSubTreeMap(std::move(root)); }
 
     TreeMap(const TreeMap& other);
 
+    TreeMap(const TreeMap& other, const Allocator& alloc);
+
     TreeMap& operator=(const TreeMap& other);
 
     TreeMap(TreeMap&&) noexcept = default;
 
-    TreeMap& operator=(TreeMap&&) noexcept = default;
+    TreeMap(TreeMap&& other, const Allocator& alloc);
+
+    TreeMap& operator=(TreeMap&& other) noexcept(
+        AllocatorTraits::propagate_on_container_move_assignment::value or
+        AllocatorTraits::is_always_equal::value);
+
+    auto get_allocator() const -> Allocator { return allocator; }
 
     auto addChild(KeyT key,
                   PayloadT payload,
@@ -86,7 +212,7 @@ public:
                   std::optional<int64_t> insertBeforePosition = std::nullopt)
         -> void;
 
-    auto addSubtree(const TreeMap<KeyT, PayloadT>& addedTreeMap,
+    auto addSubtree(const TreeMap& addedTreeMap,
                     const std::optional<KeyT>& parent,
                     const std::optional<int64_t>& insertBeforePosition) -> void;
 
@@ -94,7 +220,7 @@ public:
     template <typename Func>
     auto mapped(Func func,
                 const std::optional<KeyT>& initial = std::nullopt) const
-        -> TreeMap<KeyT, TransformResultT<Func>>;
+        -> MappedTreeMap<Func>;
 
     /* Return view to all keys in unspecified order. */
     auto keysView() const;
@@ -105,27 +231,37 @@ public:
     /* Return view to all entries in unspecified order. */
     auto entriesView() const;
 
-    auto parent(const KeyT& child) const
-        -> std::optional<std::reference_wrapper<const KeyT>>;
+    template <typename K = KeyT>
+    auto parent(const K& child) const
+        -> std::optional<std::reference_wrapper<const KeyT>>
+        requires isLookupKey<K>;
 
-    auto payload(const KeyT& key) const
-        -> std::optional<std::reference_wrapper<const PayloadT>>;
+    template <typename K = KeyT>
+    auto payload(const K& key) const
+        -> std::optional<std::reference_wrapper<const PayloadT>>
+        requires isLookupKey<K>;
 
     /* Return view to (keys) children of node with given key. If key is invalid
      * returns view to root's children. */
-    auto children(const KeyT& key) const;
+    template <typename K = KeyT>
+    auto children(const K& key) const
+        requires isLookupKey<K>;
 
     /* Return view to children (keys) of root node (top-level children). */
     auto children() const;
 
-    auto nthChild(const KeyT& key, size_t n) const
-        -> std::optional<std::reference_wrapper<const PayloadT>>;
+    template <typename K = KeyT>
+    auto nthChild(const K& key, size_t n) const
+        -> std::optional<std::reference_wrapper<const PayloadT>>
+        requires isLookupKey<K>;
 
     auto nthChild(size_t n) const
         -> std::optional<std::reference_wrapper<const PayloadT>>;
 
     // Returns node position among it's parent's children. //
-    auto positionInChildren(const KeyT& key) const -> std::optional<size_t>;
+    template <typename K = KeyT>
+    auto positionInChildren(const K& key) const -> std::optional<size_t>
+        requires isLookupKey<K>;
 
     [[nodiscard]] auto leaves() const -> std::vector<PayloadT>;
 
@@ -136,18 +272,77 @@ public:
 
     auto flatten() const -> std::vector<std::optional<entry_t>>;
 
-    static auto unflatten(std::span<const std::optional<entry_t>> flat)
-        -> TreeMap;
+    /* Write flattened sequence to out entry by entry instead of collecting
+     * it into a vector. */
+    template <std::output_iterator<std::optional<entry_t>> O>
+    auto flattenTo(O out) const -> O;
+
+    static auto unflatten(std::span<const std::optional<entry_t>> flat,
+                          const Allocator& alloc = {}) -> TreeMap;
+
+    /* Write binary image of the tree with keys section, see TreeImage.h. */
+    auto writeImage(std::ostream& os) const -> void
+        requires details::ImageStorable<KeyT> and
+                 details::ImageStorable<PayloadT>;
+
+    /* Build tree from binary image written by writeImage. Throws
+     * std::invalid_argument if image is not valid and std::runtime_error if
+     * it holds duplicate keys. */
+    static auto fromImage(std::span<const std::byte> image,
+                          const Allocator& alloc = {}) -> TreeMap
+        requires details::ImageStorable<KeyT> and
+                 details::ImageStorable<PayloadT>;
+
+    /* Push-based counterpart of unflatten. Entries of flattened sequence are
+     * fed as they arrive, e.g. chunk by chunk from a stream, and turned into
+     * nodes right away, so the sequence is never held in memory as a whole. */
+    class Unflattener {
+    public:
+        explicit Unflattener(const Allocator& alloc = {})
+            : tree{alloc}
+            , decoder{tree.root.get()}
+        {
+        }
+
+        auto push(std::optional<entry_t> entry) -> void
+        {
+            decoder.push(std::move(entry), [this](Node* parent, entry_t&& e) {
+                return tree.appendChild(
+                    parent, std::move(e.first), std::move(e.second));
+            });
+        }
+
+        template <std::ranges::input_range R> auto pushRange(R&& chunk) -> void
+        {
+            for (auto&& entry : chunk) {
+                push(std::forward<decltype(entry)>(entry));
+            }
+        }
+
+        /* Whether the sequence is complete, further entries are ignored. */
+        auto done() const -> bool { return decoder.done(); }
+
+        /* Return tree decoded so far. */
+        auto finish() -> TreeMap { return std::move(tree); }
+
+    private:
+        TreeMap tree;
+        details::FlattenedDecoder<Node*> decoder;
+    };
 
     auto keys() const { return std::views::keys(registry); }
 
-    auto hasNode(const KeyT& node) const -> bool;
+    template <typename K = KeyT>
+    auto hasNode(const K& node) const -> bool
+        requires isLookupKey<K>;
 
     auto removeNodes(const std::optional<KeyT>& parent,
                      int64_t row,
                      int64_t count) -> void;
 
-    auto removeNode(const KeyT& node) -> void;
+    template <typename K = KeyT>
+    auto removeNode(const K& node) -> void
+        requires isLookupKey<K>;
 
     auto moveNodes(const std::optional<KeyT>& sourceParent,
                    int64_t sourceRow,
@@ -155,7 +350,119 @@ public:
                    const std::optional<KeyT>& destinationParent,
                    int64_t destinationChild) -> void;
 
+    /* Edits queued to be made by apply(). Edits have the same meaning as
+     * calls of member functions of the same name made in queued order. */
+    class Batch {
+    public:
+        auto addChild(KeyT key,
+                      PayloadT payload,
+                      std::optional<KeyT> parent,
+                      std::optional<int64_t> insertBeforePosition = std::nullopt)
+            -> void
+        {
+            edits.emplace_back(Add{std::move(key),
+                                   std::move(payload),
+                                   std::move(parent),
+                                   insertBeforePosition});
+            ++additions;
+        }
+
+        auto removeNodes(std::optional<KeyT> parent, int64_t row, int64_t count)
+            -> void
+        {
+            edits.emplace_back(Remove{std::move(parent), row, count});
+        }
+
+        auto moveNodes(std::optional<KeyT> sourceParent,
+                       int64_t sourceRow,
+                       int64_t count,
+                       std::optional<KeyT> destinationParent,
+                       int64_t destinationChild) -> void
+        {
+            edits.emplace_back(Move{std::move(sourceParent),
+                                    sourceRow,
+                                    count,
+                                    std::move(destinationParent),
+                                    destinationChild});
+        }
+
+        auto size() const -> size_t { return edits.size(); }
+
+        auto empty() const -> bool { return edits.empty(); }
+
+    private:
+        friend class TreeMap;
+
+        struct Add {
+            KeyT key;
+            PayloadT payload;
+            std::optional<KeyT> parent;
+            std::optional<int64_t> position;
+        };
+
+        struct Remove {
+            std::optional<KeyT> parent;
+            int64_t row;
+            int64_t count;
+        };
+
+        struct Move {
+            std::optional<KeyT> sourceParent;
+            int64_t sourceRow;
+            int64_t count;
+            std::optional<KeyT> destinationParent;
+            int64_t destinationChild;
+        };
+
+        std::vector<std::variant<Add, Remove, Move>> edits;
+        size_t additions{0};
+    };
+
+    /* Net changes made by apply(). Nodes both added and removed by the batch
+     * are counted neither as added nor as removed. */
+    struct BatchSummary {
+        int64_t added{0};
+        // Removed nodes, descendants of removed nodes included
+        int64_t removed{0};
+        // Parents left in the tree whose children changed, each listed once
+        // in order of first change; nullopt stands for the top level
+        std::vector<std::optional<KeyT>> changedParents;
+    };
+
+    /* Make edits of batch in one pass. Child list of each parent is taken
+     * aside on its first edit and written back once after the last one, so
+     * edits of the same list don't shift it over and over, and registry
+     * grows once for all added keys.
+     *
+     * Edits are checked as their member function counterparts check them,
+     * except that positions of added nodes past the end of the list throw.
+     * If an edit throws, edits queued before it remain made. */
+    auto apply(Batch batch) -> BatchSummary;
+
     auto display() const -> std::string;
+
+private:
+    struct BatchState {
+        std::unordered_map<Node*, details::ChunkedSequence<NodePtr>> staged;
+        // Staged parents in order of their first edit
+        std::vector<Node*> stagingOrder;
+        std::unordered_set<const Node*> added;
+        std::vector<NodePtr> removed;
+        int64_t removedCount{0};
+    };
+
+    /* Return children of parent taken aside for the batch. */
+    auto stagedChildren(BatchState& state, Node* parent)
+        -> details::ChunkedSequence<NodePtr>&;
+
+    auto applyEdit(BatchState& state, typename Batch::Add& edit) -> void;
+
+    auto applyEdit(BatchState& state, typename Batch::Remove& edit) -> void;
+
+    auto applyEdit(BatchState& state, typename Batch::Move& edit) -> void;
+
+    /* Write staged children back and destroy removed nodes. */
+    auto finishBatch(BatchState& state) -> BatchSummary;
 };
 
 /* --------------------------------------------------
@@ -166,25 +473,109 @@ public:
  * --------------------------------------------------
  * --------------------------------------------------*/
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-TreeMap<KeyT, PayloadT>::TreeMap() = default;
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::TreeMap() = default;
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::TreeMap(const Allocator& alloc)
+    : allocator{alloc}
+{
+}
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-TreeMap<KeyT, PayloadT>::TreeMap(const TreeMap& other)
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::TreeMap(const TreeMap& other)
+    : TreeMap{other,
+              AllocatorTraits::select_on_container_copy_construction(
+                  other.allocator)}
 {
-    *this = other.mapped(std::identity{});
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-TreeMap<KeyT, PayloadT>&
-TreeMap<KeyT, PayloadT>::operator=(const TreeMap& other)
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::TreeMap(const TreeMap& other,
+                                            const Allocator& alloc)
+    : allocator{alloc}
+{
+    cloneFrom(other);
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::TreeMap(TreeMap&& other,
+                                            const Allocator& alloc)
+    : allocator{alloc}
+{
+    if (allocator == other.allocator) {
+        steal(other);
+    }
+    else {
+        cloneFrom(other);
+    }
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>&
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::operator=(const TreeMap& other)
 {
-    *this = other.mapped(std::identity{});
+    constexpr bool propagate{
+        AllocatorTraits::propagate_on_container_copy_assignment::value};
+    if (this == &other) {
+        return *this;
+    }
+    TreeMap copy{other, propagate ? other.allocator : allocator};
+    steal(copy);
+    if constexpr (propagate) {
+        allocator = other.allocator;
+    }
     return *this;
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::addChild(
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>&
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::operator=(TreeMap&& other) noexcept(
+    AllocatorTraits::propagate_on_container_move_assignment::value or
+    AllocatorTraits::is_always_equal::value)
+{
+    constexpr bool propagate{
+        AllocatorTraits::propagate_on_container_move_assignment::value};
+    if (this == &other) {
+        return *this;
+    }
+    if (not propagate and allocator != other.allocator) {
+        // Nodes have to be recreated with own allocator
+        return *this = TreeMap{std::move(other), allocator};
+    }
+    steal(other);
+    if constexpr (propagate) {
+        allocator = other.allocator;
+    }
+    return *this;
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::addChild(
     KeyT key,
     PayloadT payload,
     const std::optional<KeyT>& parent,
@@ -194,18 +585,21 @@ auto TreeMap<KeyT, PayloadT>::addChild(
         throw std::runtime_error{"Unique key constraint failed"};
     }
     auto* parentPtr = tryLocateNode(parent);
-    auto node =
-        std::make_unique<Node>(std::move(key), std::move(payload), parentPtr);
+    auto node = makeNode(std::move(key), std::move(payload), parentPtr);
     registry.insert({node->key, node.get()});
     const auto position =
-        insertBeforePosition.value_or(parentPtr->children.size());
+        insertBeforePosition.value_or(std::ssize(parentPtr->children));
     parentPtr->children.insert(std::begin(parentPtr->children) + position,
                                std::move(node));
+    parentPtr->rebuildPositionIndexes(position);
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::addSubtree(
-    const TreeMap<KeyT, PayloadT>& addedTreeMap,
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::addSubtree(
+    const TreeMap& addedTreeMap,
     const std::optional<KeyT>& parent,
     const std::optional<int64_t>& insertBeforePosition) -> void
 {
@@ -222,13 +616,16 @@ auto TreeMap<KeyT, PayloadT>::addSubtree(
 }
 
 /* Func is (const PayloadT&) -> TransPayload */
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
 template <typename Func>
-auto TreeMap<KeyT, PayloadT>::mapped(Func func,
-                                     const std::optional<KeyT>& initial) const
-    -> TreeMap<KeyT, TransformResultT<Func>>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::mapped(
+    Func func, const std::optional<KeyT>& initial) const -> MappedTreeMap<Func>
 {
-    TreeMap<KeyT, TransformResultT<Func>> mappedTreeMap;
+    MappedTreeMap<Func> mappedTreeMap{
+        typename MappedTreeMap<Func>::allocator_type{allocator}};
 
     auto transformPayload = [&](auto level, auto* node) {
         // If we are dealing with subTreeMap, parent of the first node would
@@ -242,32 +639,46 @@ auto TreeMap<KeyT, PayloadT>::mapped(Func func,
     return mappedTreeMap;
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::keysView() const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::keysView() const
 {
     return std::views::keys(registry);
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::payloadView() const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::payloadView() const
 {
     return std::views::values(registry) |
            std::views::transform([](auto* node) { return node->payload; });
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::entriesView() const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::entriesView() const
 {
     return std::views::transform(registry, [](const auto& p) {
         return std::make_pair(p.first, p.second->payload);
     });
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::parent(const KeyT& child) const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+template <typename K>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::parent(const K& child) const
     -> std::optional<std::reference_wrapper<const KeyT>>
+    requires isLookupKey<K>
 {
-    if (auto childIt = registry.find(child); childIt != cend(registry)) {
+    if (auto childIt = registry.find(asLookupKey(child)); childIt != cend(registry)) {
         if (auto* parentPtr = childIt->second->parent; parentPtr) {
             return parentPtr == root.get()
                        ? std::nullopt
@@ -278,37 +689,56 @@ auto TreeMap<KeyT, PayloadT>::parent(const KeyT& child) const
     throw std::runtime_error{"Asking for parent of non-existing key"};
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::payload(const KeyT& key) const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+template <typename K>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::payload(const K& key) const
     -> std::optional<std::reference_wrapper<const PayloadT>>
+    requires isLookupKey<K>
 {
-    if (auto it = registry.find(key); it != cend(registry)) {
+    if (auto it = registry.find(asLookupKey(key)); it != cend(registry)) {
         return {it->second->payload};
     }
     return std::nullopt;
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::children(const KeyT& key) const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+template <typename K>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::children(const K& key) const
+    requires isLookupKey<K>
 {
-    auto it = registry.find(key);
+    auto it = registry.find(asLookupKey(key));
     Node* parent = it != cend(registry) ? it->second : root.get();
     return std::views::transform(parent->children,
                                  [](const auto& ptr) { return ptr->key; });
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::children() const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::children() const
 {
     return std::views::transform(root->children,
                                  [](const auto& ptr) { return ptr->key; });
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::nthChild(const KeyT& key, size_t n) const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+template <typename K>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::nthChild(const K& key,
+                                                  size_t n) const
     -> std::optional<std::reference_wrapper<const PayloadT>>
+    requires isLookupKey<K>
 {
-    if (auto it = registry.find(key); it != cend(registry)) {
+    if (auto it = registry.find(asLookupKey(key)); it != cend(registry)) {
         if (n < it->second->children.size()) {
             return it->second->children[n]->payload;
         }
@@ -316,8 +746,11 @@ auto TreeMap<KeyT, PayloadT>::nthChild(const KeyT& key, size_t n) const
     return std::nullopt;
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::nthChild(size_t n) const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::nthChild(size_t n) const
     -> std::optional<std::reference_wrapper<const PayloadT>>
 {
     if (n < root->children.size()) {
@@ -326,28 +759,27 @@ auto TreeMap<KeyT, PayloadT>::nthChild(size_t n) const
     return std::nullopt;
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::positionInChildren(const KeyT& key) const
-    -> std::optional<size_t>
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+template <typename K>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::positionInChildren(
+    const K& key) const -> std::optional<size_t>
+    requires isLookupKey<K>
 {
-    auto it = registry.find(key);
-    if (it == cend(registry)) {
-        return {};
-    }
-
-    const Node* parent{it->second->parent == root.get() ? root.get()
-                                                        : it->second->parent};
-    for (size_t row = 0; const auto& child : parent->children) {
-        if (child->key == key) {
-            return row;
-        }
-        ++row;
+    if (auto it = registry.find(asLookupKey(key)); it != cend(registry)) {
+        return static_cast<size_t>(it->second->pos);
     }
     return std::nullopt;
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::leaves() const -> std::vector<PayloadT>
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::leaves() const
+    -> std::vector<PayloadT>
 {
     std::vector<PayloadT> nodes;
     auto push_leaf = [&nodes](auto /*level*/, const auto* node) {
@@ -359,11 +791,13 @@ auto TreeMap<KeyT, PayloadT>::leaves() const -> std::vector<PayloadT>
     return nodes;
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
 template <typename Func>
-auto TreeMap<KeyT, PayloadT>::dfs(Func func,
-                                  const std::optional<KeyT>& initial) const
-    -> void
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::dfs(
+    Func func, const std::optional<KeyT>& initial) const -> void
 {
     Node* rt =
         initial.transform([&](const auto& key) { return tryLocateNode(key); })
@@ -373,80 +807,179 @@ auto TreeMap<KeyT, PayloadT>::dfs(Func func,
              rt);
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::flatten() const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::flatten() const
     -> std::vector<std::optional<entry_t>>
 {
-    std::queue<Node*> frontier;
-    frontier.push(root.get());
     std::vector<std::optional<entry_t>> flattened;
-    flattened.push_back(std::optional<entry_t>{{root->key, root->payload}});
-    flattened.push_back(std::nullopt);
+    flattened.reserve(2 * registry.size() + 3);
+    flattenTo(std::back_inserter(flattened));
+    return flattened;
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+template <std::output_iterator<std::optional<std::pair<KeyT, PayloadT>>> O>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::flattenTo(O out) const -> O
+{
+    return details::flatten_to(
+        static_cast<const Node*>(root.get()),
+        std::optional<entry_t>{{root->key, root->payload}},
+        [](const Node* node) {
+            return std::views::transform(
+                node->children,
+                [](const auto& child) -> const Node* { return child.get(); });
+        },
+        [](const Node* node) {
+            return std::optional<entry_t>{{node->key, node->payload}};
+        },
+        std::move(out));
+}
+
+// static //
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::unflatten(
+    std::span<const std::optional<entry_t>> flat, const Allocator& alloc)
+    -> TreeMap
+{
+    Unflattener unflattener{alloc};
+    for (const auto& entry : flat) {
+        if (unflattener.done()) {
+            break;
+        }
+        unflattener.push(entry);
+    }
+    return unflattener.finish();
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::writeImage(std::ostream& os) const
+    -> void
+    requires details::ImageStorable<KeyT> and details::ImageStorable<PayloadT>
+{
+    std::vector<const Node*> order;
+    std::vector<int64_t> parents;
+    order.reserve(registry.size());
+    parents.reserve(registry.size());
+    std::stack<std::pair<const Node*, int64_t>> frontier;
+    const auto pushChildren = [&frontier](const Node* node, int64_t position) {
+        for (const auto& child : node->children | std::views::reverse) {
+            frontier.emplace(child.get(), position);
+        }
+    };
 
+    pushChildren(root.get(), -1);
     while (!frontier.empty()) {
-        auto* current = frontier.front();
+        const auto [node, parent] = frontier.top();
         frontier.pop();
-        const auto& children = current->children;
-        for (auto& child : children) {
-            flattened.push_back(
-                std::optional<entry_t>{{child->key, child->payload}});
-            frontier.push(child.get());
-        }
-        flattened.push_back(std::nullopt);
+        order.push_back(node);
+        parents.push_back(parent);
+        pushChildren(node, std::ssize(parents) - 1);
     }
 
-    return flattened;
+    details::write_image<KeyT, PayloadT>(
+        os,
+        parents,
+        order | std::views::transform(
+                    [](const Node* node) -> const KeyT& { return node->key; }),
+        order | std::views::transform([](const Node* node) -> const PayloadT& {
+            return node->payload;
+        }));
 }
 
 // static //
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::unflatten(
-    std::span<const std::optional<entry_t>> flat) -> TreeMap
-{
-    TreeMap<KeyT, PayloadT> result;
-    std::queue<std::reference_wrapper<const entry_t>> frontier;
-    const entry_t fakeroot;
-    frontier.push(fakeroot);
-
-    // Starting from 2 as we have empty root node in the tree itself
-    // and flattened version also has it.
-    for (size_t i{2}; !frontier.empty(); ++i) {
-        const auto current = frontier.front();
-        frontier.pop();
-        for (; flat[i]; ++i) {
-            auto& [key, payload] = *flat[i];
-            result.addChild(key,
-                            payload,
-                            &current.get() == &fakeroot ? std::optional<KeyT>{}
-                                                        : current.get().first);
-            frontier.push(flat[i].value());
-        }
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::fromImage(
+    std::span<const std::byte> image, const Allocator& alloc) -> TreeMap
+    requires details::ImageStorable<KeyT> and details::ImageStorable<PayloadT>
+{
+    const TreeImageView<PayloadT> view{image};
+    const auto keys = view.template keys<KeyT>();
+    const auto payloads = view.payloads();
+    const auto parents = view.parent_indexes();
+    details::throw_if_not_preorder(parents);
+
+    TreeMap result{alloc};
+    std::vector<Node*> nodes;
+    nodes.reserve(parents.size());
+    for (size_t i{0}; i < parents.size(); ++i) {
+        auto* parent = parents[i] == -1
+                           ? result.root.get()
+                           : nodes[static_cast<size_t>(parents[i])];
+        nodes.push_back(
+            result.appendChild(parent, KeyT{keys[i]}, PayloadT{payloads[i]}));
     }
 
     return result;
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::hasNode(const KeyT& node) const -> bool
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::appendChild(Node* parent,
+                                                     KeyT&& key,
+                                                     PayloadT&& payload)
+    -> Node*
+{
+    if (hasNode(key)) {
+        throw std::runtime_error{"Unique key constraint failed"};
+    }
+    auto node = makeNode(std::move(key), std::move(payload), parent);
+    auto* nodePtr = node.get();
+    registry.insert({nodePtr->key, nodePtr});
+    nodePtr->pos = std::ssize(parent->children);
+    parent->children.push_back(std::move(node));
+    return nodePtr;
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+template <typename K>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::hasNode(const K& node) const
+    -> bool
+    requires isLookupKey<K>
 {
-    return registry.contains(node);
+    return registry.contains(asLookupKey(node));
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::removeNodes(const std::optional<KeyT>& parent,
-                                          int64_t row,
-                                          int64_t count) -> void
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::removeNodes(
+    const std::optional<KeyT>& parent, int64_t row, int64_t count) -> void
 {
     removeNodesInternal(parent, row, count);
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::removeNode(const KeyT& key) -> void
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+template <typename K>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::removeNode(const K& key) -> void
+    requires isLookupKey<K>
 {
-    const auto maybeParent = parent(key);
-    if (auto pos = positionInChildren(key); pos) {
-        removeNodesInternal(
-            maybeParent, static_cast<int64_t>(*positionInChildren(key)), 1);
+    if (auto it = registry.find(asLookupKey(key)); it != cend(registry)) {
+        Node* node{it->second};
+        removeChildren(node->parent, node->pos, 1);
     }
     else {
         std::string msg{"Error removing node: "};
@@ -455,8 +988,11 @@ auto TreeMap<KeyT, PayloadT>::removeNode(const KeyT& key) -> void
     }
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::moveNodes(
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::moveNodes(
     const std::optional<KeyT>& sourceParent,
     int64_t sourceRow,
     int64_t count,
@@ -467,23 +1003,18 @@ auto TreeMap<KeyT, PayloadT>::moveNodes(
         throw std::runtime_error{"Wrong destination when moving nodes"};
     }
 
-    auto& children = tryLocateNode(sourceParent)->children;
+    auto* source = tryLocateNode(sourceParent);
+    auto& children = source->children;
 
     if (sourceRow + count > static_cast<int64_t>(children.size())) {
-        std::string mesg{
-            "Indexing error when attempting to move nodes. Parent: "};
-        mesg += sourceParent.value_or("null");
-        mesg += " row: ";
-        mesg += std::to_string(sourceRow);
-        mesg += " count: ";
-        mesg += std::to_string(count);
-        throw std::runtime_error{mesg};
+        throwIndexingError("move", sourceParent, sourceRow, count);
     }
 
     if (sourceParent == destinationParent) {
         alg::slide(std::begin(children) + sourceRow,
                    std::begin(children) + sourceRow + count,
                    std::begin(children) + destinationChild);
+        source->rebuildPositionIndexes(std::min(sourceRow, destinationChild));
         return;
     }
 
@@ -491,15 +1022,45 @@ auto TreeMap<KeyT, PayloadT>::moveNodes(
                                     std::begin(children) + sourceRow + count,
                                     std::end(children));
 
-    std::for_each(first, last, [&](auto& node) {
-        addChildInternal(
-            std::move(node), destinationParent, destinationChild++);
+    auto* destination = tryLocateNode(destinationParent);
+    const auto position =
+        std::min(destinationChild, std::ssize(destination->children));
+    std::for_each(first, last, [destination](auto& node) {
+        node->parent = destination;
     });
+    destination->children.insert(std::begin(destination->children) + position,
+                                 std::make_move_iterator(first),
+                                 std::make_move_iterator(last));
     children.erase(first, last);
+    source->rebuildPositionIndexes(sourceRow);
+    destination->rebuildPositionIndexes(position);
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::display() const -> std::string
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::apply(Batch batch) -> BatchSummary
+{
+    registry.reserve(registry.size() + batch.additions);
+    BatchState state;
+    try {
+        for (auto& edit : batch.edits) {
+            std::visit([&](auto& e) { applyEdit(state, e); }, edit);
+        }
+    }
+    catch (...) {
+        finishBatch(state);
+        throw;
+    }
+    return finishBatch(state);
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::display() const -> std::string
 {
     std::stringstream ss;
     auto print_node = [&](auto level, auto* current) {
@@ -516,28 +1077,39 @@ auto TreeMap<KeyT, PayloadT>::display() const -> std::string
     return ss.str();
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-TreeMap<KeyT, PayloadT>
-TreeMap<KeyT, PayloadT>::subTreeMap(const KeyT& key) const
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>
+TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::subTreeMap(const KeyT& key) const
 {
     return mapped(std::identity{}, key);
 }
 
-template <class CharT, class Traits, class KeyT, class PayloadT>
+template <class CharT,
+          class Traits,
+          class KeyT,
+          class PayloadT,
+          class Allocator,
+          template <typename...> class RegistryMap>
 std::basic_ostream<CharT, Traits>&
 operator<<(std::basic_ostream<CharT, Traits>& os,
-           const TreeMap<KeyT, PayloadT>& tree)
+           const TreeMap<KeyT, PayloadT, Allocator, RegistryMap>& tree)
 {
     os << "TreeMap\n" << tree.display();
     return os;
 }
 
 /* Return entries in DFS traversal order */
-template <typename K, typename P>
-auto entriesDFS(const TreeMap<K, P>& tree)
-    -> std::vector<typename TreeMap<K, P>::entry_t>
+template <typename K,
+          typename P,
+          typename A,
+          template <typename...> class R>
+auto entriesDFS(const TreeMap<K, P, A, R>& tree)
+    -> std::vector<typename TreeMap<K, P, A, R>::entry_t>
 {
-    std::vector<typename TreeMap<K, P>::entry_t> result;
+    std::vector<typename TreeMap<K, P, A, R>::entry_t> result;
     tree.dfs(
         [&result](const auto& key, const auto& payload) {
             result.push_back({key, payload});
@@ -546,8 +1118,12 @@ auto entriesDFS(const TreeMap<K, P>& tree)
     return result;
 }
 
-template <typename K, typename P>
-auto operator==(const TreeMap<K, P>& lhs, const TreeMap<K, P>& rhs) -> bool
+template <typename K,
+          typename P,
+          typename A,
+          template <typename...> class R>
+auto operator==(const TreeMap<K, P, A, R>& lhs, const TreeMap<K, P, A, R>& rhs)
+    -> bool
 {
     const auto leftEntries = entriesDFS(lhs);
     const auto rightEntries = entriesDFS(rhs);
@@ -557,9 +1133,11 @@ auto operator==(const TreeMap<K, P>& lhs, const TreeMap<K, P>& rhs) -> bool
 
 template <typename K,
           typename P,
-          typename Comp = std::equal_to<typename TreeMap<K, P>::entry_t>>
-auto compare(const TreeMap<K, P>& lhs,
-             const TreeMap<K, P>& rhs,
+          typename A,
+          template <typename...> class R,
+          typename Comp = std::equal_to<typename TreeMap<K, P, A, R>::entry_t>>
+auto compare(const TreeMap<K, P, A, R>& lhs,
+             const TreeMap<K, P, A, R>& rhs,
              Comp comp = Comp{}) -> bool
 {
     const auto leftEntries = entriesDFS(lhs);
@@ -574,28 +1152,116 @@ auto compare(const TreeMap<K, P>& lhs,
         PRIVATE
  * --------------------------------------------------*/
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::releaseSubTreeMap(std::unique_ptr<Node> n) -> void
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::steal(TreeMap& other) -> void
+{
+    releaseSubTreeMap(std::exchange(root, std::move(other.root)));
+    registry = std::move(other.registry);
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::cloneFrom(const TreeMap& other)
+    -> void
+{
+    registry.reserve(other.registry.size());
+
+    // Children are pushed in reverse, so that they are popped, and appended
+    // to their parent copies, in original order.
+    std::vector<std::pair<Node*, const Node*>> frontier;
+    auto pushChildren = [&frontier](Node* copy, const Node* source) {
+        copy->children.reserve(source->children.size());
+        for (const auto& child : std::ranges::reverse_view(source->children)) {
+            frontier.push_back({copy, child.get()});
+        }
+    };
+
+    pushChildren(root.get(), other.root.get());
+    while (not frontier.empty()) {
+        auto [parentCopy, source] = frontier.back();
+        frontier.pop_back();
+        auto copy =
+            makeNode(KeyT{source->key}, PayloadT{source->payload}, parentCopy);
+        copy->pos = source->pos;
+        registry.emplace(copy->key, copy.get());
+        pushChildren(copy.get(), source);
+        parentCopy->children.push_back(std::move(copy));
+    }
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::releaseSubTreeMap(NodePtr n) -> void
 {
     if (not n) {
         // Root pointer might not manage memory when TreeMap is in `moved from`
         // state if move was performed.
         return;
     }
-    while (n->children.size() > 0) {
-        auto leaves = &n->children;
-        while (leaves->back()->children.size() > 0) {
-            leaves = &leaves->back()->children;
+    // Descend to the last leaf and climb back through parent pointers once it
+    // is destroyed, so that each node is visited a constant number of times
+    // and no node is destroyed while it still has children.
+    for (auto* node = n.get(); node != n.get() or not node->children.empty();) {
+        if (not node->children.empty()) {
+            node = node->children.back().get();
+            continue;
         }
-        registry.erase(leaves->back()->key);
-        leaves->pop_back();
+        auto* parent = node->parent;
+        parent->children.pop_back();
+        node = parent;
     }
-    registry.erase(n->key);
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::forgetKeys(
+    std::span<const NodePtr> subtrees) -> void
+{
+    std::vector<const Node*> removed;
+    for (const auto& subtree : subtrees) {
+        for_each([&](auto /* level */,
+                     const Node* node) { removed.push_back(node); },
+                 subtree.get());
+    }
+
+    if (2 * removed.size() <= registry.size()) {
+        for (const auto* node : removed) {
+            registry.erase(node->key);
+        }
+        return;
+    }
+
+    // Most of the keys go, it is cheaper to index remaining nodes anew
+    Registry remaining{registry.get_allocator()};
+    remaining.reserve(registry.size() - removed.size());
+    std::vector<Node*> frontier{root.get()};
+    while (not frontier.empty()) {
+        auto* node = frontier.back();
+        frontier.pop_back();
+        for (auto& child : node->children) {
+            remaining.emplace(child->key, child.get());
+            frontier.push_back(child.get());
+        }
+    }
+    registry.swap(remaining);
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
 template <typename Func>
-auto TreeMap<KeyT, PayloadT>::for_each(Func func, const Node* initial) const
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::for_each(Func func,
+                                                  const Node* initial) const
     -> void
 {
     std::stack<std::pair<int, const Node*>> frontier;
@@ -624,51 +1290,48 @@ auto TreeMap<KeyT, PayloadT>::for_each(Func func, const Node* initial) const
     }
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::addChildInternal(
-    std::unique_ptr<Node> child,
-    const std::optional<KeyT>& parent,
-    int64_t insertBeforePosition) -> void
-{
-    auto* parentPtr = tryLocateNode(parent);
-    registry.insert({child->key, child.get()});
-    child->parent = parentPtr;
-    parentPtr->children.insert(
-        std::begin(parentPtr->children) +
-            std::min(insertBeforePosition,
-                     static_cast<int64_t>(parentPtr->children.size())),
-        std::move(child));
-}
-
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::removeNodesInternal(
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::removeNodesInternal(
     const std::optional<KeyT>& parent, int64_t row, int64_t count) -> void
 {
     auto* parentPtr = tryLocateNode(parent);
     auto& children = parentPtr->children;
     if (row + count > static_cast<int64_t>(children.size())) {
-        std::string mesg{
-            "Indexing error when attempting to remove nodes. Parent: "};
-        mesg += parent.value_or("null");
-        mesg += " row: ";
-        mesg += std::to_string(row);
-        mesg += " count: ";
-        mesg += std::to_string(count);
-        throw std::runtime_error{mesg};
+        throwIndexingError("remove", parent, row, count);
     }
+    removeChildren(parentPtr, row, count);
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::removeChildren(
+    Node* parent, int64_t row, int64_t count) -> void
+{
+    auto& children = parent->children;
     auto [first, last] = alg::slide(std::begin(children) + row,
                                     std::begin(children) + row + count,
                                     std::end(children));
-    std::vector<std::unique_ptr<Node>> nodes(static_cast<size_t>(count));
-    std::move(first, last, std::begin(nodes));
+    std::vector<NodePtr> nodes;
+    nodes.reserve(static_cast<size_t>(count));
+    std::move(first, last, std::back_inserter(nodes));
     children.erase(first, last);
+    parent->rebuildPositionIndexes(row);
+    forgetKeys(nodes);
     for (auto& node : nodes) {
         releaseSubTreeMap(std::move(node));
     }
 }
 
-template <std::default_initializable KeyT, std::default_initializable PayloadT>
-auto TreeMap<KeyT, PayloadT>::tryLocateNode(
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::tryLocateNode(
     const std::optional<KeyT>& key) const -> Node*
 {
     auto nodePtr = [&](const auto& nodeKey) {
@@ -685,6 +1348,180 @@ auto TreeMap<KeyT, PayloadT>::tryLocateNode(
     return key.transform(nodePtr).value_or(root.get());
 }
 
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::stagedChildren(
+    BatchState& state, Node* parent) -> details::ChunkedSequence<NodePtr>&
+{
+    if (auto it = state.staged.find(parent); it != state.staged.end()) {
+        return it->second;
+    }
+    state.stagingOrder.push_back(parent);
+    return state.staged.try_emplace(parent, parent->children).first->second;
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::applyEdit(
+    BatchState& state, typename Batch::Add& edit) -> void
+{
+    if (hasNode(edit.key)) {
+        throw std::runtime_error{"Unique key constraint failed"};
+    }
+    auto* parent = tryLocateNode(edit.parent);
+    auto& children = stagedChildren(state, parent);
+    const auto position = edit.position.value_or(children.size());
+    if (position < 0 or position > children.size()) {
+        throwIndexingError("add", edit.parent, position, 1);
+    }
+    auto node = makeNode(std::move(edit.key), std::move(edit.payload), parent);
+    registry.insert({node->key, node.get()});
+    state.added.insert(node.get());
+    children.insert(position,
+                    std::make_move_iterator(&node),
+                    std::make_move_iterator(&node + 1));
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::applyEdit(
+    BatchState& state, typename Batch::Remove& edit) -> void
+{
+    auto& children = stagedChildren(state, tryLocateNode(edit.parent));
+    if (edit.row < 0 or edit.count < 0 or
+        edit.row + edit.count > children.size()) {
+        throwIndexingError("remove", edit.parent, edit.row, edit.count);
+    }
+    for (auto& subtree : children.erase(edit.row, edit.count)) {
+        // Children of removed nodes may be staged too
+        std::vector<Node*> frontier{subtree.get()};
+        while (not frontier.empty()) {
+            auto* node = frontier.back();
+            frontier.pop_back();
+            if (state.added.erase(node) == 0) {
+                ++state.removedCount;
+            }
+            registry.erase(node->key);
+            const auto pushChild = [&frontier](const auto& child) {
+                frontier.push_back(child.get());
+            };
+            if (auto it = state.staged.find(node);
+                it != state.staged.end()) {
+                it->second.for_each(pushChild);
+            }
+            else {
+                std::ranges::for_each(node->children, pushChild);
+            }
+        }
+        state.removed.push_back(std::move(subtree));
+    }
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::applyEdit(
+    BatchState& state, typename Batch::Move& edit) -> void
+{
+    if (edit.destinationParent and not hasNode(*edit.destinationParent)) {
+        throw std::runtime_error{"Wrong destination when moving nodes"};
+    }
+    auto* source = tryLocateNode(edit.sourceParent);
+    auto& children = stagedChildren(state, source);
+    if (edit.sourceRow < 0 or edit.count < 0 or
+        edit.sourceRow + edit.count > children.size()) {
+        throwIndexingError(
+            "move", edit.sourceParent, edit.sourceRow, edit.count);
+    }
+    auto* destination = tryLocateNode(edit.destinationParent);
+    auto position = edit.destinationChild;
+    if (source == destination) {
+        if (position >= edit.sourceRow and
+            position <= edit.sourceRow + edit.count) {
+            return;
+        }
+        if (position > edit.sourceRow) {
+            position -= edit.count;
+        }
+    }
+    auto moved = children.erase(edit.sourceRow, edit.count);
+    for (auto& node : moved) {
+        node->parent = destination;
+    }
+    auto& destinationChildren = stagedChildren(state, destination);
+    destinationChildren.insert(
+        std::clamp(position, int64_t{0}, destinationChildren.size()),
+        std::make_move_iterator(moved.begin()),
+        std::make_move_iterator(moved.end()));
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::finishBatch(BatchState& state)
+    -> BatchSummary
+{
+    BatchSummary summary;
+    summary.added = std::ssize(state.added);
+    summary.removed = state.removedCount;
+    for (auto* parent : state.stagingOrder) {
+        state.staged.at(parent).move_into(parent->children);
+        parent->rebuildPositionIndexes(0);
+        if (parent == root.get()) {
+            summary.changedParents.emplace_back(std::nullopt);
+        }
+        else if (auto it = registry.find(parent->key);
+                 it != cend(registry) and it->second == parent) {
+            summary.changedParents.emplace_back(parent->key);
+        }
+    }
+    for (auto& subtree : state.removed) {
+        releaseSubTreeMap(std::move(subtree));
+    }
+    return summary;
+}
+
+template <std::default_initializable KeyT,
+          std::default_initializable PayloadT,
+          typename Allocator,
+          template <typename...> class RegistryMap>
+auto TreeMap<KeyT, PayloadT, Allocator, RegistryMap>::throwIndexingError(
+    std::string_view operation,
+    const std::optional<KeyT>& parent,
+    int64_t row,
+    int64_t count) -> void
+{
+    std::stringstream ss;
+    ss << "Indexing error when attempting to " << operation
+       << " nodes. Parent: ";
+    if (parent) {
+        ss << *parent;
+    }
+    else {
+        ss << "null";
+    }
+    ss << " row: " << row << " count: " << count;
+    throw std::runtime_error{ss.str()};
+}
+
+namespace pmr {
+
+template <std::default_initializable KeyT, std::default_initializable PayloadT>
+using TreeMap = ds::TreeMap<
+    KeyT,
+    PayloadT,
+    std::pmr::polymorphic_allocator<std::pair<const KeyT, PayloadT>>>;
+
+} // namespace pmr
+
 } // namespace ds
 
 #endif /* end of include guard: TREE_H_RQOZCKEL */
@@ -1,11 +1,14 @@
 #ifndef UNIQUEELEMENTSTREE_H_UZNKGFBF
 #define UNIQUEELEMENTSTREE_H_UZNKGFBF
 
+#include "cpp_utils/datastructures/FlatHashMap.h"
+#include "cpp_utils/datastructures/TreeCommon.h"
 #include <algorithm>
 #include <format>
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <memory_resource>
 #include <optional>
 #include <queue>
 #include <ranges>
@@ -28,32 +31,150 @@ struct KeyError : std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
-/*
- *
+/* Tree of payloads with unique keys, where key is extracted from payload
+ * with Selector.
  *
+ * Nodes, their child lists and key registry are allocated with Allocator,
+ * which is rebound as necessary. Payloads are constructed with uses-allocator
+ * construction.
  *
+ * Keys are looked up in a registry of type RegistryMap, see TreeMap.
  */
 template <std::default_initializable PayloadT,
-          std::default_initializable Selector = std::identity>
+          std::default_initializable Selector = std::identity,
+          typename Allocator = std::allocator<PayloadT>,
+          template <typename...> class RegistryMap = FlatHashMap>
 class UniqueElementsTree {
 private:
     using internal_id_t = int32_t;
+    using AllocatorTraits = std::allocator_traits<Allocator>;
+
+    struct Node;
+    using ChildrenAllocator = details::Rebind<Allocator, Node*>;
 
     struct Node {
+        explicit Node(const Allocator& alloc)
+            : children(ChildrenAllocator{alloc})
+        {
+        }
+
+        Node(Node* parent_, PayloadT&& payload_, const Allocator& alloc)
+            : parent{parent_}
+            , payload{std::make_obj_using_allocator<PayloadT>(
+                  alloc, std::move(payload_))}
+            , children(ChildrenAllocator{alloc})
+        {
+        }
+
         Node* parent{nullptr};
         PayloadT payload{};
-        std::vector<Node*> children;
+        std::vector<Node*, ChildrenAllocator> children;
     };
 
+    using NodePtr = details::NodePtr<Node, Allocator>;
+
 public:
     using key_t =
         std::remove_cvref_t<std::invoke_result_t<Selector, const PayloadT&>>;
     using maybe_key = std::optional<key_t>;
+    using allocator_type = Allocator;
+
+private:
+    using Registry = RegistryMap<
+        key_t,
+        NodePtr,
+        RegistryHash<key_t>,
+        std::equal_to<>,
+        details::Rebind<Allocator, std::pair<const key_t, NodePtr>>>;
+
+    /* Lookups accept keys of types registry can hash and compare with key_t
+     * as they are, and keys of types convertible to key_t, see TreeMap. */
+    template <typename K>
+    static constexpr bool is_lookup_key{
+        details::LookupKey<K,
+                           key_t,
+                           typename Registry::hasher,
+                           typename Registry::key_equal>};
+
+public:
 
     template <typename Func>
     using TransformResultT =
         std::remove_cvref_t<std::invoke_result_t<Func, const PayloadT&>>;
 
+    UniqueElementsTree() = default;
+
+    explicit UniqueElementsTree(const Allocator& alloc)
+        : allocator{alloc}
+    {
+    }
+
+    UniqueElementsTree(const UniqueElementsTree& other)
+        : UniqueElementsTree{
+              other,
+              AllocatorTraits::select_on_container_copy_construction(
+                  other.allocator)}
+    {
+    }
+
+    UniqueElementsTree(const UniqueElementsTree& other, const Allocator& alloc)
+        : allocator{alloc}
+        , selector{other.selector}
+    {
+        clone_from(other);
+    }
+
+    UniqueElementsTree(UniqueElementsTree&&) noexcept = default;
+
+    UniqueElementsTree(UniqueElementsTree&& other, const Allocator& alloc)
+        : allocator{alloc}
+    {
+        if (allocator == other.allocator) {
+            steal(other);
+        }
+        else {
+            clone_from(other);
+        }
+    }
+
+    auto operator=(const UniqueElementsTree& other) -> UniqueElementsTree&
+    {
+        constexpr bool propagate{
+            AllocatorTraits::propagate_on_container_copy_assignment::value};
+        if (this == &other) {
+            return *this;
+        }
+        UniqueElementsTree copy{other, propagate ? other.allocator : allocator};
+        steal(copy);
+        selector = other.selector;
+        if constexpr (propagate) {
+            allocator = other.allocator;
+        }
+        return *this;
+    }
+
+    auto operator=(UniqueElementsTree&& other) noexcept(
+        AllocatorTraits::propagate_on_container_move_assignment::value or
+        AllocatorTraits::is_always_equal::value) -> UniqueElementsTree&
+    {
+        constexpr bool propagate{
+            AllocatorTraits::propagate_on_container_move_assignment::value};
+        if (this == &other) {
+            return *this;
+        }
+        if (not propagate and allocator != other.allocator) {
+            // Nodes have to be recreated with own allocator
+            return *this = UniqueElementsTree{std::move(other), allocator};
+        }
+        steal(other);
+        if constexpr (propagate) {
+            allocator = other.allocator;
+        }
+        return *this;
+    }
+
+    auto get_allocator() const -> Allocator { return allocator; }
+
     using const_dfs_iterator_type = const PayloadT;
     using dfs_iterator_type = PayloadT;
 
@@ -184,14 +305,14 @@ public:
 
         auto* parent_ptr = parent
                                .transform([this](const auto& parent_key) {
-                                   return registry[parent_key].get();
+                                   return registry.at(parent_key).get();
                                })
                                .value_or(root.get());
 
         const auto insert_pos =
             static_cast<int>(pos.value_or(parent_ptr->children.size()));
 
-        auto node = std::make_unique<Node>(parent_ptr, std::move(payload));
+        auto node = make_node(parent_ptr, std::move(payload));
         parent_ptr->children.insert(
             std::begin(parent_ptr->children) + insert_pos, node.get());
         registry.insert({key, std::move(node)});
@@ -204,48 +325,82 @@ public:
     // Mainly useful for serialization.
     auto flatten() const -> std::vector<std::optional<PayloadT>>
     {
-        std::queue<const Node*> frontier;
-        frontier.push(root.get());
         std::vector<std::optional<PayloadT>> flattened;
-        flattened.push_back(std::nullopt);
-        flattened.push_back(std::nullopt);
+        flattened.reserve(2 * registry.size() + 3);
+        flatten_to(std::back_inserter(flattened));
+        return flattened;
+    }
 
-        while (not frontier.empty()) {
-            const auto* current = frontier.front();
-            frontier.pop();
-            for (auto* child : current->children) {
-                flattened.push_back(child->payload);
-                frontier.push(child);
+    // Writes flattened sequence to out entry by entry instead of collecting
+    // it into a vector.
+    template <std::output_iterator<std::optional<PayloadT>> O>
+    auto flatten_to(O out) const -> O
+    {
+        return details::flatten_to(
+            static_cast<const Node*>(root.get()),
+            std::optional<PayloadT>{},
+            [](const Node* node) {
+                return std::views::transform(
+                    node->children,
+                    [](const Node* child) -> const Node* { return child; });
+            },
+            [](const Node* node) {
+                return std::optional<PayloadT>{node->payload};
+            },
+            std::move(out));
+    }
+
+    static auto unflatten(std::span<const std::optional<PayloadT>> flat,
+                          const Allocator& alloc = {}) -> UniqueElementsTree
+    {
+        Unflattener unflattener{alloc};
+        for (const auto& entry : flat) {
+            if (unflattener.done()) {
+                break;
             }
-            flattened.push_back(std::nullopt);
+            unflattener.push(entry);
         }
-
-        return flattened;
+        return unflattener.finish();
     }
 
-    static auto unflatten(std::span<const std::optional<PayloadT>> flat)
-        -> UniqueElementsTree
-    {
-        UniqueElementsTree<PayloadT, Selector> result;
-        std::queue<const PayloadT*> frontier;
-        const PayloadT fakeroot{};
-        frontier.push(&fakeroot);
-        Selector selector;
-
-        for (size_t i{2}; not frontier.empty(); ++i) {
-            const auto* current = frontier.front();
-            frontier.pop();
-            for (; flat[i]; ++i) {
-                const auto& payload = *flat[i];
-                result.add_child(payload,
-                                 current == &fakeroot ? maybe_key{}
-                                                      : selector(*current));
-                frontier.push(&flat[i].value());
+    // Push-based counterpart of unflatten. Entries of flattened sequence are
+    // fed as they arrive, e.g. chunk by chunk from a stream, and turned into
+    // nodes right away, so the sequence is never held in memory as a whole.
+    class Unflattener {
+    public:
+        explicit Unflattener(const Allocator& alloc = {})
+            : tree{alloc}
+            , decoder{tree.root.get()}
+        {
+        }
+
+        auto push(std::optional<PayloadT> entry) -> void
+        {
+            decoder.push(std::move(entry),
+                         [this](Node* parent, PayloadT&& payload) {
+                             return tree.append_child(parent,
+                                                      std::move(payload));
+                         });
+        }
+
+        template <std::ranges::input_range R>
+        auto push_range(R&& chunk) -> void
+        {
+            for (auto&& entry : chunk) {
+                push(std::forward<decltype(entry)>(entry));
             }
         }
 
-        return result;
-    }
+        // Whether the sequence is complete, further entries are ignored.
+        auto done() const -> bool { return decoder.done(); }
+
+        // Returns tree decoded so far.
+        auto finish() -> UniqueElementsTree { return std::move(tree); }
+
+    private:
+        UniqueElementsTree tree;
+        details::FlattenedDecoder<Node*> decoder;
+    };
 
     // template <typename Func, typename NewSelector>
     // auto map(Func func) -> UniqueElementsTree<TransformResultT<Func>,
@@ -289,9 +444,14 @@ public:
     //                  *start);
     // }
 
-    auto has_key(const key_t& key) const -> bool
+    template <typename K = key_t>
+        requires is_lookup_key<K>
+    auto has_key(const K& key) const -> bool
     {
-        return registry.contains(key);
+        return registry.contains(
+            details::lookup_key<key_t,
+                                typename Registry::hasher,
+                                typename Registry::key_equal>(key));
     }
 
     auto to_string() const -> std::string
@@ -313,9 +473,67 @@ public:
     }
 
 private:
-    std::unique_ptr<Node> root = std::make_unique<Node>();
+    [[no_unique_address]] Allocator allocator;
+    NodePtr root = make_node();
     Selector selector;
-    std::unordered_map<key_t, std::unique_ptr<Node>> registry;
+    Registry registry{typename Registry::allocator_type{allocator}};
+
+    template <typename... Args> auto make_node(Args&&... args) const -> NodePtr
+    {
+        return details::allocate_node<Node>(
+            allocator, std::forward<Args>(args)..., allocator);
+    }
+
+    /* Append new node as last child of parent, which is known to be in the
+     * tree. */
+    auto append_child(Node* parent, PayloadT&& payload) -> Node*
+    {
+        auto key = selector(payload);
+        if (has_key(key)) {
+            throw UniqueKeyError{
+                std::format("Unique key constraint failed: {} ", key)};
+        }
+        auto node = make_node(parent, std::move(payload));
+        auto* node_ptr = node.get();
+        parent->children.push_back(node_ptr);
+        registry.insert({std::move(key), std::move(node)});
+        return node_ptr;
+    }
+
+    /* Replace contents with nodes of other, which must use equal allocator. */
+    auto steal(UniqueElementsTree& other) -> void
+    {
+        registry = std::move(other.registry);
+        root = std::move(other.root);
+    }
+
+    /* Copy nodes of other into this empty tree in a single preorder pass.
+     * Keys of other are known to be unique, so they are not checked. */
+    auto clone_from(const UniqueElementsTree& other) -> void
+    {
+        registry.reserve(other.registry.size());
+
+        // Children are pushed in reverse, so that they are popped, and
+        // appended to their parent copies, in original order.
+        std::vector<std::pair<Node*, const Node*>> frontier;
+        auto push_children = [&frontier](Node* copy, const Node* original) {
+            copy->children.reserve(original->children.size());
+            for (auto* child : std::ranges::reverse_view(original->children)) {
+                frontier.push_back({copy, child});
+            }
+        };
+
+        push_children(root.get(), other.root.get());
+        while (not frontier.empty()) {
+            auto [parent, original] = frontier.back();
+            frontier.pop_back();
+            auto node = make_node(parent, PayloadT{original->payload});
+            auto* node_ptr = node.get();
+            registry.emplace(selector(node_ptr->payload), std::move(node));
+            parent->children.push_back(node_ptr);
+            push_children(node_ptr, original);
+        }
+    }
 
     /* Apply Func for side-effects to each element of a subtree with root at
      * inital node.
@@ -421,6 +639,17 @@ template <class C> auto end_dfs(const C& c) -> decltype(c.end_dfs())
 //     return tree.cend_dfs();
 // }
 
+namespace pmr {
+
+template <std::default_initializable PayloadT,
+          std::default_initializable Selector = std::identity>
+using UniqueElementsTree =
+    ds::UniqueElementsTree<PayloadT,
+                           Selector,
+                           std::pmr::polymorphic_allocator<PayloadT>>;
+
+} // namespace pmr
+
 } // namespace ds
 
 #endif /* end of include guard: UNIQUEELEMENTSTREE_H_UZNKGFBF */
@@ -0,0 +1,160 @@
+#include "cpp_utils/datastructures/FlatHashMap.h"
+#include "gmock/gmock.h"
+#include <memory>
+#include <memory_resource>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using ::testing::ElementsAre;
+
+using namespace ds;
+
+TEST(FlatHashMapTest, finds_inserted_entries)
+{
+    FlatHashMap<int, int> map;
+    for (int key{0}; key < 10000; ++key) {
+        EXPECT_TRUE(map.insert({key, key * 2}).second);
+    }
+
+    EXPECT_EQ(10000u, map.size());
+    for (int key{0}; key < 10000; ++key) {
+        ASSERT_TRUE(map.contains(key));
+        EXPECT_EQ(key * 2, map.find(key)->second);
+        EXPECT_EQ(key * 2, map.at(key));
+    }
+    EXPECT_FALSE(map.contains(10000));
+    EXPECT_EQ(map.end(), map.find(-1));
+    EXPECT_THROW(map.at(-1), std::out_of_range);
+}
+
+TEST(FlatHashMapTest, does_not_overwrite_existing_entries)
+{
+    FlatHashMap<std::string, int> map;
+    map.emplace("1", 1);
+
+    const auto [it, inserted] = map.try_emplace("1", 2);
+
+    EXPECT_FALSE(inserted);
+    EXPECT_EQ(1, it->second);
+    EXPECT_EQ(1u, map.size());
+}
+
+TEST(FlatHashMapTest, iterates_in_insertion_order_across_rehashes)
+{
+    FlatHashMap<std::string, int> map;
+    std::vector<std::string> expected;
+    for (int i{0}; i < 1000; ++i) {
+        expected.push_back(std::to_string(i));
+        map[expected.back()] = i;
+    }
+
+    EXPECT_TRUE(std::ranges::equal(expected, std::views::keys(map)));
+}
+
+TEST(FlatHashMapTest, looks_up_entries_by_transparent_keys)
+{
+    FlatHashMap<std::string, int, RegistryHash<std::string>, std::equal_to<>>
+        map;
+    map.emplace("1", 1);
+    map.emplace("2", 2);
+    const std::string_view key{"1"};
+
+    EXPECT_TRUE(map.contains(key));
+    EXPECT_EQ(1, map.find(key)->second);
+    EXPECT_EQ(1, map.at(key));
+    EXPECT_EQ(1u, map.erase(key));
+    EXPECT_FALSE(map.contains(key));
+    EXPECT_EQ(2, map.at("2"));
+}
+
+TEST(FlatHashMapTest, erasing_moves_last_entry_into_freed_place)
+{
+    FlatHashMap<int, int> map;
+    for (int key{0}; key < 5; ++key) {
+        map.insert({key, key});
+    }
+
+    EXPECT_EQ(1u, map.erase(1));
+    EXPECT_EQ(0u, map.erase(1));
+
+    const auto keys = std::views::keys(map);
+    EXPECT_THAT(std::vector<int>(keys.begin(), keys.end()),
+                ElementsAre(0, 4, 2, 3));
+}
+
+TEST(FlatHashMapTest, stays_consistent_under_insert_erase_churn)
+{
+    FlatHashMap<int, int> map;
+    for (int round{0}; round < 50; ++round) {
+        for (int key{0}; key < 1000; ++key) {
+            map.insert({round * 1000 + key, key});
+        }
+        for (int key{0}; key < 1000; key += 2) {
+            map.erase(round * 1000 + key);
+        }
+        if (round % 2 == 0) {
+            for (int key{1}; key < 1000; key += 2) {
+                map.erase(round * 1000 + key);
+            }
+        }
+    }
+
+    EXPECT_EQ(25u * 500u, map.size());
+    for (int round{0}; round < 50; ++round) {
+        for (int key{0}; key < 1000; ++key) {
+            EXPECT_EQ(round % 2 == 1 and key % 2 == 1,
+                      map.contains(round * 1000 + key));
+        }
+    }
+    for (const auto& [key, value] : map) {
+        EXPECT_EQ(key % 1000, value);
+    }
+}
+
+TEST(FlatHashMapTest, holds_move_only_values)
+{
+    FlatHashMap<int, std::unique_ptr<int>> map;
+    for (int key{0}; key < 100; ++key) {
+        map.emplace(key, std::make_unique<int>(key));
+    }
+
+    map.erase(0);
+
+    EXPECT_EQ(99u, map.size());
+    EXPECT_EQ(99, *map.at(99));
+}
+
+TEST(FlatHashMapTest, clear_and_reserve_keep_map_usable)
+{
+    FlatHashMap<int, int> map;
+    map.reserve(100);
+    for (int key{0}; key < 100; ++key) {
+        map.insert({key, key});
+    }
+
+    map.clear();
+    map.insert({7, 7});
+
+    EXPECT_EQ(1u, map.size());
+    EXPECT_EQ(7, map.at(7));
+    EXPECT_FALSE(map.contains(8));
+}
+
+TEST(FlatHashMapTest, allocates_entries_from_resource)
+{
+    std::pmr::monotonic_buffer_resource resource;
+    FlatHashMap<std::pmr::string,
+                int,
+                std::hash<std::pmr::string>,
+                std::equal_to<std::pmr::string>,
+                std::pmr::polymorphic_allocator<
+                    std::pair<const std::pmr::string, int>>>
+        map{&resource};
+
+    map.insert({std::pmr::string{"a fairly long key that is not inlined"}, 1});
+
+    EXPECT_EQ(&resource, map.get_allocator().resource());
+    EXPECT_EQ(&resource, map.begin()->first.get_allocator().resource());
+}
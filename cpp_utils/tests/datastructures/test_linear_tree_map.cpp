@@ -0,0 +1,325 @@
+#include "cpp_utils/datastructures/LinearTreeMap.h"
+#include "cpp_utils/datastructures/TreeMap.h"
+#include "gmock/gmock.h"
+#include <cstring>
+#include <memory_resource>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using ::testing::ElementsAre;
+
+namespace {
+
+template <typename TreeMapType> auto make_sample_tree() -> TreeMapType
+{
+    TreeMapType sut;
+    /*
+     * 1
+     *   2
+     *     10
+     *   3
+     * 4
+     *   5
+     *     6
+     *     7
+     *       8
+     * 9
+     */
+    sut.addChild("1", 1, std::nullopt);
+    sut.addChild("2", 2, "1");
+    sut.addChild("3", 3, "1");
+    sut.addChild("4", 4, std::nullopt);
+    sut.addChild("5", 5, "4");
+    sut.addChild("6", 6, "5");
+    sut.addChild("7", 7, "5");
+    sut.addChild("8", 8, "7");
+    sut.addChild("9", 9, std::nullopt);
+    sut.addChild("10", 10, "2");
+    return sut;
+}
+
+template <typename TreeMapType>
+auto children_of(const TreeMapType& tree, const std::optional<std::string>& key)
+    -> std::vector<std::string>
+{
+    std::vector<std::string> children;
+    if (key) {
+        std::ranges::copy(tree.children(*key), std::back_inserter(children));
+    }
+    else {
+        std::ranges::copy(tree.children(), std::back_inserter(children));
+    }
+    return children;
+}
+
+template <typename TreeMapType>
+auto parent_of(const TreeMapType& tree, const std::string& key)
+    -> std::optional<std::string>
+{
+    const auto parent = tree.parent(key);
+    return parent ? std::optional<std::string>{parent->get()} : std::nullopt;
+}
+
+/* Flattened tree without the entry of the root, payload of root of TreeMap
+ * is left uninitialized. */
+template <typename TreeMapType>
+auto flattened_nodes(const TreeMapType& tree)
+{
+    auto flattened = tree.flatten();
+    flattened.erase(flattened.begin());
+    return flattened;
+}
+
+} // namespace
+
+class LinearTreeMapFixture : public ::testing::Test {
+public:
+    ds::LinearTreeMap<std::string, int> sut{
+        make_sample_tree<ds::LinearTreeMap<std::string, int>>()};
+};
+
+TEST_F(LinearTreeMapFixture, looks_up_nodes_by_key)
+{
+    EXPECT_EQ(8, sut.payload("8"));
+    EXPECT_EQ(std::nullopt, sut.payload("bogus_key"));
+    EXPECT_EQ("7", sut.parent("8").value().get());
+    EXPECT_EQ(std::nullopt, sut.parent("4"));
+    EXPECT_THROW(sut.parent("bogus_key"), std::runtime_error);
+    EXPECT_THAT(children_of(sut, "5"), ElementsAre("6", "7"));
+    EXPECT_THAT(children_of(sut, "bogus_key"), ElementsAre("1", "4", "9"));
+    EXPECT_THAT(children_of(sut, std::nullopt), ElementsAre("1", "4", "9"));
+    EXPECT_EQ(7, sut.nthChild("5", 1));
+    EXPECT_EQ(std::nullopt, sut.nthChild("5", 2));
+    EXPECT_EQ(9, sut.nthChild(2));
+    EXPECT_EQ(std::optional<size_t>{2}, sut.positionInChildren("9"));
+    EXPECT_EQ(std::optional<size_t>{1}, sut.positionInChildren("7"));
+    EXPECT_EQ(std::nullopt, sut.positionInChildren("bogus_key"));
+    EXPECT_TRUE(sut.hasNode("10"));
+    EXPECT_FALSE(sut.hasNode("11"));
+    EXPECT_THAT(sut.leaves(), ElementsAre(10, 3, 6, 8, 9));
+}
+
+TEST_F(LinearTreeMapFixture, throws_on_invalid_edits)
+{
+    EXPECT_THROW(sut.addChild("5", 5, std::nullopt), std::runtime_error);
+    EXPECT_THROW(sut.addChild("11", 11, "bogus_key"), std::runtime_error);
+    EXPECT_THROW(sut.removeNode("bogus_key"), std::runtime_error);
+    EXPECT_THROW(sut.removeNodes("5", 1, 2), std::runtime_error);
+    EXPECT_THROW(sut.moveNodes("5", 0, 1, "bogus_key", 0), std::runtime_error);
+    EXPECT_THROW(sut.moveNodes("5", 2, 1, "4", 0), std::runtime_error);
+
+    const auto expected =
+        make_sample_tree<ds::LinearTreeMap<std::string, int>>();
+    EXPECT_EQ(expected, sut);
+}
+
+TEST_F(LinearTreeMapFixture, nth_child_finds_rows_in_any_order)
+{
+    ds::LinearTreeMap<std::string, int> tree;
+    for (int i{0}; i < 100; ++i) {
+        tree.addChild(std::to_string(i), i, std::nullopt);
+    }
+    std::vector<int> rows(100);
+    std::iota(rows.begin(), rows.end(), 0);
+    std::ranges::shuffle(rows, std::mt19937{42});
+
+    for (int row{0}; row < 100; ++row) {
+        EXPECT_EQ(row, tree.nthChild(static_cast<size_t>(row)));
+    }
+    for (int row{99}; row >= 0; --row) {
+        EXPECT_EQ(row, tree.nthChild(static_cast<size_t>(row)));
+    }
+    for (const auto row : rows) {
+        EXPECT_EQ(row, tree.nthChild(static_cast<size_t>(row)));
+    }
+    tree.addChild("first", -1, std::nullopt, 0);
+    EXPECT_EQ(-1, tree.nthChild(0));
+    EXPECT_EQ(0, tree.nthChild(1));
+    tree.removeNodes(std::nullopt, 0, 2);
+    EXPECT_EQ(1, tree.nthChild(0));
+    EXPECT_EQ(99, tree.nthChild(98));
+    EXPECT_EQ(std::nullopt, tree.nthChild(99));
+}
+
+TEST_F(LinearTreeMapFixture, behaves_like_tree_map_under_random_edits)
+{
+    auto expected = make_sample_tree<ds::TreeMap<std::string, int>>();
+    std::mt19937 gen{7};
+    int next_key{11};
+    const auto random_key = [&](const auto& tree) -> std::optional<std::string> {
+        std::vector<std::string> keys(tree.keys().begin(), tree.keys().end());
+        std::ranges::sort(keys);
+        const auto pick = std::uniform_int_distribution<size_t>{
+            0, keys.size()}(gen);
+        return pick == keys.size() ? std::nullopt
+                                   : std::optional<std::string>{keys[pick]};
+    };
+    const auto child_count = [](const auto& tree, const auto& parent) {
+        return static_cast<int64_t>(children_of(tree, parent).size());
+    };
+
+    for (int step{0}; step < 2000; ++step) {
+        const auto parent = random_key(sut);
+        const auto count = child_count(sut, parent);
+        switch (std::uniform_int_distribution<int>{0, 5}(gen)) {
+        case 0:
+        case 1: {
+            const auto pos =
+                std::uniform_int_distribution<int64_t>{0, count}(gen);
+            const auto key = std::to_string(next_key++);
+            sut.addChild(key, next_key, parent, pos);
+            expected.addChild(key, next_key, parent, pos);
+            break;
+        }
+        case 2:
+            if (count > 0) {
+                const auto row =
+                    std::uniform_int_distribution<int64_t>{0, count - 1}(gen);
+                sut.removeNodes(parent, row, 1);
+                expected.removeNodes(parent, row, 1);
+            }
+            break;
+        case 3:
+            if (parent) {
+                sut.removeNode(*parent);
+                expected.removeNode(*parent);
+            }
+            break;
+        default: {
+            // Only moves to top level or within the same parent, moving
+            // nodes into their own subtrees is not allowed
+            if (count == 0) {
+                break;
+            }
+            const auto row =
+                std::uniform_int_distribution<int64_t>{0, count - 1}(gen);
+            const auto moved = std::uniform_int_distribution<int64_t>{
+                1, count - row}(gen);
+            const auto to_top = parent and step % 2 == 0;
+            const auto destination = to_top ? std::nullopt : parent;
+            // Like Qt, destination inside of the moved range is not allowed
+            const auto skipped = destination == parent ? moved - 1 : 0;
+            auto to = std::uniform_int_distribution<int64_t>{
+                0, child_count(sut, destination) - skipped}(gen);
+            if (destination == parent and to > row) {
+                to += skipped;
+            }
+            sut.moveNodes(parent, row, moved, destination, to);
+            expected.moveNodes(parent, row, moved, destination, to);
+        }
+        }
+
+        ASSERT_EQ(ds::entriesDFS(expected), ds::entriesDFS(sut));
+    }
+
+    EXPECT_EQ(flattened_nodes(expected), flattened_nodes(sut));
+    for (const auto& key : expected.keys()) {
+        EXPECT_EQ(expected.positionInChildren(key),
+                  sut.positionInChildren(key));
+        EXPECT_EQ(parent_of(expected, key), parent_of(sut, key));
+        EXPECT_EQ(children_of(expected, key), children_of(sut, key));
+    }
+}
+
+TEST_F(LinearTreeMapFixture, flatten_and_unflatten)
+{
+    const auto flattened = sut.flatten();
+
+    const auto restored =
+        ds::LinearTreeMap<std::string, int>::unflatten(flattened);
+
+    EXPECT_EQ(
+        flattened_nodes(make_sample_tree<ds::TreeMap<std::string, int>>()),
+        flattened_nodes(sut));
+    EXPECT_EQ(sut, restored);
+    EXPECT_EQ(flattened, restored.flatten());
+}
+
+TEST_F(LinearTreeMapFixture, image_round_trip_restores_tree)
+{
+    ds::LinearTreeMap<int, double> tree;
+    tree.addChild(1, 1.5, std::nullopt);
+    tree.addChild(2, 2.5, 1);
+    tree.addChild(3, 3.5, std::nullopt);
+    tree.addChild(4, 4.5, 2);
+    tree.removeNode(3);
+    std::stringstream ss;
+    tree.writeImage(ss);
+    const auto text = ss.str();
+    std::vector<std::byte> image(text.size());
+    std::memcpy(image.data(), text.data(), text.size());
+
+    const auto restored = ds::LinearTreeMap<int, double>::fromImage(image);
+
+    EXPECT_EQ(tree, restored);
+    EXPECT_EQ(2, restored.parent(4).value().get());
+    EXPECT_FALSE(restored.hasNode(3));
+    const auto restored_tree_map = ds::TreeMap<int, double>::fromImage(image);
+    EXPECT_EQ(flattened_nodes(tree), flattened_nodes(restored_tree_map));
+}
+
+TEST_F(LinearTreeMapFixture, mapped_and_sub_tree)
+{
+    const auto mapped =
+        sut.mapped([](int payload) { return std::to_string(payload * 2); });
+    const auto subtree = sut.subTreeMap("5");
+
+    EXPECT_EQ("16", mapped.payload("8").value().get());
+    EXPECT_EQ("7", mapped.parent("8").value().get());
+    EXPECT_THAT(ds::entriesDFS(subtree),
+                ElementsAre(std::pair<std::string, int>{"5", 5},
+                            std::pair<std::string, int>{"6", 6},
+                            std::pair<std::string, int>{"7", 7},
+                            std::pair<std::string, int>{"8", 8}));
+    EXPECT_EQ(std::nullopt, subtree.parent("5"));
+}
+
+TEST_F(LinearTreeMapFixture, add_subtree)
+{
+    ds::LinearTreeMap<std::string, int> added;
+    added.addChild("11", 11, std::nullopt);
+    added.addChild("12", 12, "11");
+    added.addChild("13", 13, std::nullopt);
+    ds::LinearTreeMap<std::string, int> clashing;
+    clashing.addChild("14", 14, std::nullopt);
+    clashing.addChild("8", 8, "14");
+
+    sut.addSubtree(added, "5", 1);
+
+    EXPECT_THAT(children_of(sut, "5"), ElementsAre("6", "11", "13", "7"));
+    EXPECT_EQ("11", sut.parent("12").value().get());
+    EXPECT_THROW(sut.addSubtree(clashing, std::nullopt, 0),
+                 std::runtime_error);
+    EXPECT_FALSE(sut.hasNode("14"));
+}
+
+TEST_F(LinearTreeMapFixture, copies_are_equal_and_independent)
+{
+    auto copy = sut;
+
+    copy.removeNode("5");
+    copy.addChild("11", 11, "9");
+
+    EXPECT_NE(sut, copy);
+    EXPECT_TRUE(sut.hasNode("8"));
+    EXPECT_FALSE(sut.hasNode("11"));
+    EXPECT_FALSE(copy.hasNode("8"));
+    EXPECT_EQ("9", copy.parent("11").value().get());
+}
+
+TEST(LinearTreeMapTest, allocates_entries_and_registry_from_resource)
+{
+    std::pmr::monotonic_buffer_resource resource;
+    ds::pmr::LinearTreeMap<std::pmr::string, int> tree{&resource};
+
+    tree.addChild("a fairly long key that is not inlined", 1, std::nullopt);
+
+    EXPECT_EQ(&resource, tree.get_allocator().resource());
+    EXPECT_EQ(&resource,
+              (*tree.keysView().begin()).get_allocator().resource());
+    EXPECT_EQ(&resource,
+              tree.entriesView().begin()->first.get_allocator().resource());
+}
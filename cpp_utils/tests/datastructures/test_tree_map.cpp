@@ -1,5 +1,10 @@
 #include "cpp_utils/datastructures/TreeMap.h"
 #include "gmock/gmock.h"
+#include <cstring>
+#include <memory_resource>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
 
 ds::TreeMap<std::string, int> make_sample_tree()
 {
@@ -169,6 +174,125 @@ TEST_F(TreeMapFixture, flatten_and_unflatten)
     EXPECT_EQ(tree, restored);
 }
 
+TEST_F(TreeMapFixture, unflattener_restores_tree_streamed_in_chunks)
+{
+    std::vector<std::optional<std::pair<std::string, int>>> flattened;
+    sut.flattenTo(std::back_inserter(flattened));
+    ds::TreeMap<std::string, int>::Unflattener unflattener;
+
+    const std::span entries{flattened};
+    for (size_t i{0}; i < entries.size(); i += 3) {
+        const auto count = std::min(entries.size() - i, 3uz);
+        unflattener.pushRange(entries.subspan(i, count));
+    }
+
+    EXPECT_TRUE(unflattener.done());
+    EXPECT_EQ(sut, unflattener.finish());
+}
+
+TEST_F(TreeMapFixture, image_round_trip_restores_tree)
+{
+    ds::TreeMap<int, UncomparableData> tree;
+    tree.addChild(1, UncomparableData{1}, std::nullopt);
+    tree.addChild(2, UncomparableData{2}, 1);
+    tree.addChild(3, UncomparableData{3}, 1);
+    tree.addChild(4, UncomparableData{4}, std::nullopt);
+    tree.addChild(5, UncomparableData{5}, 4);
+    tree.addChild(10, UncomparableData{10}, 2);
+    std::stringstream ss;
+    tree.writeImage(ss);
+    const auto bytes = ss.str();
+    std::vector<std::byte> image(bytes.size());
+    std::memcpy(image.data(), bytes.data(), bytes.size());
+
+    const auto restored =
+        ds::TreeMap<int, UncomparableData>::fromImage(image);
+
+    EXPECT_EQ(tree, restored);
+    EXPECT_EQ(1u, restored.positionInChildren(4));
+    EXPECT_THROW((ds::TreeMap<int64_t, UncomparableData>::fromImage(image)),
+                 std::invalid_argument);
+}
+
+TEST_F(TreeMapFixture, registry_can_be_replaced_with_std_unordered_map)
+{
+    using StdRegistryTreeMap =
+        ds::TreeMap<std::string,
+                    int,
+                    std::allocator<std::pair<const std::string, int>>,
+                    std::unordered_map>;
+    auto tree = StdRegistryTreeMap::unflatten(sut.flatten());
+
+    tree.removeNode("5");
+    sut.removeNode("5");
+
+    EXPECT_EQ(ds::entriesDFS(sut), ds::entriesDFS(tree));
+    EXPECT_FALSE(tree.hasNode("7"));
+    EXPECT_TRUE(tree.hasNode("9"));
+}
+
+/* Memory resource counting allocations made from it. */
+class AllocationCounter : public std::pmr::memory_resource {
+public:
+    int64_t allocations{0};
+
+private:
+    auto do_allocate(size_t bytes, size_t alignment) -> void* override
+    {
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    auto do_deallocate(void* p, size_t bytes, size_t alignment)
+        -> void override
+    {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    auto do_is_equal(const std::pmr::memory_resource& other) const noexcept
+        -> bool override
+    {
+        return this == &other;
+    }
+};
+
+TEST(TreeMapTest, looks_up_string_keys_without_building_temporary_keys)
+{
+    using namespace std::string_view_literals;
+    ds::TreeMap<std::pmr::string, int> tree;
+    tree.addChild("a key too long for small string buffer", 1, std::nullopt);
+    tree.addChild("another key that does not fit inline either",
+                  2,
+                  "a key too long for small string buffer");
+    AllocationCounter counter;
+    auto* previous = std::pmr::set_default_resource(&counter);
+
+    const auto parent = "a key too long for small string buffer"sv;
+    const auto child = "another key that does not fit inline either"sv;
+    EXPECT_TRUE(tree.hasNode(child));
+    EXPECT_FALSE(tree.hasNode("a bogus key long enough to be allocated"sv));
+    EXPECT_EQ(1, tree.payload(parent));
+    EXPECT_EQ(parent, tree.parent(child).value().get());
+    EXPECT_EQ(2, tree.nthChild(parent, 0));
+    EXPECT_EQ(std::optional<size_t>{0}, tree.positionInChildren(child));
+    EXPECT_EQ(1, std::ranges::distance(tree.children(parent)));
+    tree.removeNode(child);
+
+    std::pmr::set_default_resource(previous);
+    EXPECT_EQ(0, counter.allocations);
+    EXPECT_FALSE(tree.hasNode(child));
+}
+
+TEST(TreeMapTest, looks_up_keys_of_convertible_types)
+{
+    ds::TreeMap<int64_t, int> tree;
+    tree.addChild(1, 1, std::nullopt);
+
+    EXPECT_TRUE(tree.hasNode(1));
+    EXPECT_EQ(1, tree.payload(short{1}));
+    EXPECT_FALSE(tree.hasNode(2U));
+}
+
 TEST_F(TreeMapFixture, returns_none_when_asked_for_payload_for_missing_key)
 {
     EXPECT_EQ(std::nullopt, sut.payload("bogus_key"));
@@ -244,6 +368,46 @@ TEST_F(TreeMapFixture, returns_node_position_in_parent_children)
     EXPECT_EQ(std::optional<size_t>{}, sut.positionInChildren("bogus_key"));
 }
 
+TEST_F(TreeMapFixture, keeps_node_positions_up_to_date_through_edits)
+{
+    const auto expectPositionsMatchChildren = [this] {
+        for (const auto& key : sut.keys()) {
+            const auto parent = sut.parent(key);
+            std::vector<std::string> siblings;
+            if (parent) {
+                std::ranges::copy(sut.children(parent->get()),
+                                  std::back_inserter(siblings));
+            }
+            else {
+                std::ranges::copy(sut.children(), std::back_inserter(siblings));
+            }
+            const auto expected = static_cast<size_t>(
+                std::ranges::find(siblings, key) - siblings.begin());
+            EXPECT_EQ(std::optional<size_t>{expected},
+                      sut.positionInChildren(key))
+                << key;
+        }
+    };
+
+    sut.addChild("11", 11, "5", 0);
+    expectPositionsMatchChildren();
+    sut.moveNodes("5", 0, 2, "5", 3);
+    expectPositionsMatchChildren();
+    sut.moveNodes("5", 1, 2, std::nullopt, 1);
+    expectPositionsMatchChildren();
+    sut.moveNodes(std::nullopt, 0, 2, "9", 0);
+    expectPositionsMatchChildren();
+    sut.removeNodes(std::nullopt, 0, 1);
+    expectPositionsMatchChildren();
+    sut.removeNode("11");
+    expectPositionsMatchChildren();
+
+    const auto copy = sut;
+    for (const auto& key : sut.keys()) {
+        EXPECT_EQ(sut.positionInChildren(key), copy.positionInChildren(key));
+    }
+}
+
 TEST_F(TreeMapFixture, returns_keys_in_unspecified_order)
 {
     std::vector<std::string> expected{
@@ -364,6 +528,22 @@ TEST_F(TreeMapFixture, removing_nodes_also_removes_all_subnodes)
                 ::testing::UnorderedElementsAre("1", "2", "3", "8", "9", "10"));
 }
 
+TEST_F(TreeMapFixture, removing_most_of_the_nodes_keeps_registry_consistent)
+{
+    ds::TreeMap<std::string, int> expected;
+    expected.addChild("9", 9, std::nullopt);
+    expected.addChild("5", 5, "9");
+
+    sut.removeNodes(std::nullopt, 0, 2);
+    sut.addChild("5", 5, "9");
+
+    EXPECT_EQ(expected, sut);
+    std::vector<std::string> keys;
+    std::ranges::copy(sut.keysView(), std::back_inserter(keys));
+    EXPECT_THAT(keys, ::testing::UnorderedElementsAre("9", "5"));
+    EXPECT_FALSE(sut.hasNode("8"));
+}
+
 TEST_F(TreeMapFixture, removing_nodes_throws_when_count_is_too_large)
 {
     /*
@@ -965,3 +1145,101 @@ TEST_F(TreeMapFixture, entries_view)
                                                 ::testing::Pair("9", 9),
                                                 ::testing::Pair("10", 10)));
 }
+
+TEST_F(TreeMapFixture, batch_makes_edits_as_calls_made_in_order)
+{
+    auto expected = make_sample_tree();
+    ds::TreeMap<std::string, int>::Batch batch;
+    const auto queue = [&](auto edit) {
+        edit(expected);
+        edit(batch);
+    };
+
+    // Enough children to be staged in several chunks
+    for (int i{0}; i < 2000; ++i) {
+        const auto key = "n" + std::to_string(i);
+        queue([&](auto& t) { t.addChild(key, i, "5", (i * 7) % (i + 1)); });
+    }
+    queue([](auto& t) { t.addChild("11", 11, "n100"); });
+    queue([](auto& t) { t.addChild("12", 12, "11"); });
+    queue([](auto& t) { t.moveNodes("5", 10, 300, std::nullopt, 1); });
+    queue([](auto& t) { t.moveNodes("5", 500, 40, "5", 20); });
+    queue([](auto& t) { t.moveNodes("5", 20, 40, "5", 1500); });
+    queue([](auto& t) { t.moveNodes(std::nullopt, 3, 5, "9", 0); });
+    queue([](auto& t) { t.removeNodes("5", 100, 600); });
+    queue([](auto& t) { t.removeNodes(std::nullopt, 0, 1); });
+
+    sut.apply(std::move(batch));
+
+    EXPECT_EQ(expected, sut);
+    EXPECT_EQ(sut.flatten(), expected.flatten());
+    for (const auto& key : expected.keys()) {
+        ASSERT_EQ(expected.positionInChildren(key),
+                  sut.positionInChildren(key))
+            << key;
+    }
+}
+
+TEST_F(TreeMapFixture, batch_reports_net_changes)
+{
+    ds::TreeMap<std::string, int>::Batch batch;
+    batch.addChild("11", 11, "5", 0);
+    batch.addChild("12", 12, "11");
+    batch.addChild("13", 13, "9");
+    batch.removeNodes("1", 0, 1);
+    batch.removeNodes("5", 0, 1);
+    batch.moveNodes("4", 0, 1, "9", 0);
+
+    const auto summary = sut.apply(std::move(batch));
+
+    // "11" and "12" are removed along with "5" they were added to
+    EXPECT_EQ(1, summary.added);
+    EXPECT_EQ(2, summary.removed);
+    EXPECT_THAT(summary.changedParents,
+                ::testing::ElementsAre(std::optional<std::string>{"5"},
+                                       std::optional<std::string>{"9"},
+                                       std::optional<std::string>{"1"},
+                                       std::optional<std::string>{"4"}));
+    EXPECT_FALSE(sut.hasNode("12"));
+    EXPECT_FALSE(sut.hasNode("10"));
+    EXPECT_EQ(std::optional<size_t>{1}, sut.positionInChildren("13"));
+}
+
+TEST_F(TreeMapFixture, batch_keeps_edits_made_before_failed_one)
+{
+    ds::TreeMap<std::string, int>::Batch batch;
+    batch.addChild("11", 11, std::nullopt, 0);
+    batch.removeNodes("5", 0, 1);
+    batch.addChild("7", 7, std::nullopt);
+    batch.addChild("12", 12, std::nullopt);
+
+    EXPECT_THROW(sut.apply(std::move(batch)), std::runtime_error);
+
+    EXPECT_EQ(std::optional<size_t>{0}, sut.positionInChildren("11"));
+    EXPECT_EQ(std::optional<size_t>{1}, sut.positionInChildren("1"));
+    EXPECT_FALSE(sut.hasNode("6"));
+    EXPECT_EQ(std::optional<size_t>{0}, sut.positionInChildren("7"));
+    EXPECT_FALSE(sut.hasNode("12"));
+}
+
+TEST_F(TreeMapFixture, batch_throws_on_invalid_edits)
+{
+    const auto applying = [this](auto edit) {
+        ds::TreeMap<std::string, int>::Batch batch;
+        edit(batch);
+        sut.apply(std::move(batch));
+    };
+
+    EXPECT_THROW(applying([](auto& b) { b.addChild("11", 11, "bogus"); }),
+                 std::runtime_error);
+    EXPECT_THROW(applying([](auto& b) { b.addChild("11", 11, "5", 3); }),
+                 std::runtime_error);
+    EXPECT_THROW(applying([](auto& b) { b.removeNodes("5", 1, 2); }),
+                 std::runtime_error);
+    EXPECT_THROW(
+        applying([](auto& b) { b.moveNodes("5", 0, 1, "bogus", 0); }),
+        std::runtime_error);
+    EXPECT_THROW(applying([](auto& b) { b.moveNodes("5", 2, 1, "4", 0); }),
+                 std::runtime_error);
+    EXPECT_EQ(make_sample_tree(), sut);
+}
@@ -1,8 +1,18 @@
+#include "cpp_utils/datastructures/ConcurrentTree.h"
 #include "cpp_utils/datastructures/LinearTree.h"
+#include "cpp_utils/datastructures/PersistentTree.h"
 #include "cpp_utils/datastructures/Tree.h"
+#include "cpp_utils/datastructures/TreeImage.h"
 #include "gmock/gmock.h"
+#include <cstring>
+#include <map>
+#include <memory_resource>
 #include <numeric>
+#include <random>
 #include <ranges>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <tuple>
 
 using ::testing::ElementsAre;
@@ -252,6 +262,7 @@ public:
 
 using MyTypes = ::testing::Types<
     std::tuple<Tree<int>, Tree<std::string>, Tree<CompoundType>>,
+    std::tuple<ArenaTree<int>, ArenaTree<std::string>, ArenaTree<CompoundType>>,
     std::tuple<LinearTree<int>,
                LinearTree<std::string>,
                LinearTree<CompoundType>>>;
@@ -282,6 +293,51 @@ TYPED_TEST(GenericTreeFixture, flatten_and_unflatten_inbox_tree)
     EXPECT_EQ(expected_flattened, this->inbox_tree.flatten());
 }
 
+TYPED_TEST(GenericTreeFixture, builds_tree_from_preorder_parent_indexes)
+{
+    using IntTree = typename TestFixture::IntTree;
+    const std::vector<int64_t> parents{-1, 0, 1, 0, -1, 4, 5, 5, 7, -1};
+    const std::vector<int> payloads{1, 2, 10, 3, 4, 5, 6, 7, 8, 9};
+
+    auto tree = IntTree::from_parent_indexes(parents, payloads);
+
+    EXPECT_EQ(this->sut, tree);
+    EXPECT_EQ(10, tree.size());
+    tree.insert(std::ranges::find(tree, 7), 11);
+    this->sut.insert(std::ranges::find(this->sut, 7), 11);
+    EXPECT_EQ(this->sut, tree);
+}
+
+TYPED_TEST(GenericTreeFixture, builds_tree_from_preorder_depths)
+{
+    using IntTree = typename TestFixture::IntTree;
+    const std::vector<int64_t> depths{0, 1, 2, 1, 0, 1, 2, 2, 3, 0};
+    const std::vector<int> payloads{1, 2, 10, 3, 4, 5, 6, 7, 8, 9};
+
+    EXPECT_EQ(this->sut, IntTree::from_depths(depths, payloads));
+    EXPECT_EQ(this->empty_tree,
+              IntTree::from_depths(std::vector<int64_t>{},
+                                   std::vector<int>{}));
+}
+
+TYPED_TEST(GenericTreeFixture, bulk_builders_reject_invalid_input)
+{
+    using IntTree = typename TestFixture::IntTree;
+    const std::vector<int> payloads{1, 2, 3, 4};
+
+    EXPECT_THROW(IntTree::from_parent_indexes(
+                     std::vector<int64_t>{-1, 0, 0, 1}, payloads),
+                 std::invalid_argument);
+    EXPECT_THROW(IntTree::from_parent_indexes(
+                     std::vector<int64_t>{1, -1, 0, 0}, payloads),
+                 std::invalid_argument);
+    EXPECT_THROW(
+        IntTree::from_depths(std::vector<int64_t>{0, 2, 1, 0}, payloads),
+        std::invalid_argument);
+    EXPECT_THROW(IntTree::from_depths(std::vector<int64_t>{0, 1, 1}, payloads),
+                 std::invalid_argument);
+}
+
 TYPED_TEST(GenericTreeFixture, empty_tree_iteration)
 {
     EXPECT_EQ(this->empty_tree.begin(), this->empty_tree.end());
@@ -406,6 +462,36 @@ TYPED_TEST(GenericTreeFixture, returns_tree_size)
     ASSERT_EQ(10, this->sut.size());
 }
 
+TYPED_TEST(GenericTreeFixture, keeps_tree_size_after_modifications)
+{
+    auto& tree = this->sut;
+    const std::vector<int> payloads{11, 12, 13};
+
+    tree.insert(std::ranges::find(tree, 3), DestinationPosition{0}, payloads);
+    tree.insert(tree.end(), 14, DestinationPosition{1});
+    tree.insert_subtree(tree.end(), this->simple_tree, DestinationPosition{0});
+    EXPECT_EQ(17, tree.size());
+
+    tree.move_nodes(tree.end(),
+                    SourcePosition{0},
+                    Count{2},
+                    std::ranges::find(tree, 6),
+                    DestinationPosition{0});
+    EXPECT_EQ(17, tree.size());
+
+    auto taken = tree.take_subtree(std::ranges::find(tree, 6));
+    EXPECT_EQ(11, taken.size());
+    EXPECT_EQ(6, tree.size());
+
+    tree.erase(std::ranges::find(tree, 4));
+    EXPECT_EQ(2, tree.size());
+
+    auto copy = tree;
+    EXPECT_EQ(2, copy.size());
+    copy = taken;
+    EXPECT_EQ(11, copy.size());
+}
+
 TYPED_TEST(GenericTreeFixture, returns_if_tree_empty)
 {
     typename TestFixture::IntTree tree;
@@ -751,6 +837,169 @@ TYPED_TEST(GenericTreeFixture, returns_node_position_in_children)
     EXPECT_EQ(0, this->sut.position_in_children(this->sut.cend()));
 }
 
+TYPED_TEST(GenericTreeFixture, iterates_in_reverse_preorder)
+{
+    std::vector<int> actual;
+
+    std::ranges::copy(this->sut | std::views::reverse,
+                      std::back_inserter(actual));
+
+    EXPECT_THAT(actual, ElementsAre(9, 8, 7, 6, 5, 4, 3, 10, 2, 1));
+}
+
+TYPED_TEST(GenericTreeFixture, decrements_preorder_iterator)
+{
+    auto it = std::ranges::find(this->sut, 4);
+
+    EXPECT_EQ(3, *std::prev(it));
+    EXPECT_EQ(10, *std::prev(it, 2));
+    EXPECT_EQ(4, *std::prev(std::next(it)));
+    EXPECT_EQ(9, *std::prev(this->sut.end()));
+    EXPECT_EQ(this->sut.begin(), std::prev(std::ranges::find(this->sut, 2)));
+}
+
+TYPED_TEST(GenericTreeFixture, iterates_in_postorder)
+{
+    const auto& tree = this->sut;
+    std::vector<int> actual;
+
+    std::ranges::copy(tree.postorder(), std::back_inserter(actual));
+
+    EXPECT_THAT(actual, ElementsAre(10, 2, 3, 1, 6, 8, 7, 5, 4, 9));
+}
+
+TYPED_TEST(GenericTreeFixture, iterates_in_level_order)
+{
+    const auto& tree = this->sut;
+    std::vector<int> actual;
+
+    std::ranges::copy(tree.level_order(), std::back_inserter(actual));
+
+    EXPECT_THAT(actual, ElementsAre(1, 4, 9, 2, 3, 5, 10, 6, 7, 8));
+}
+
+TYPED_TEST(GenericTreeFixture, traversals_of_empty_tree_are_empty)
+{
+    EXPECT_TRUE(this->empty_tree.postorder().empty());
+    EXPECT_TRUE(this->empty_tree.level_order().empty());
+    EXPECT_TRUE((this->empty_tree | std::views::reverse).empty());
+}
+
+TYPED_TEST(GenericTreeFixture, modifies_payloads_through_postorder_iterators)
+{
+    for (auto& payload : this->sut.postorder()) {
+        payload *= 2;
+    }
+    for (auto& payload : this->sut.level_order()) {
+        payload += 1;
+    }
+
+    EXPECT_THAT(this->sut, ElementsAre(3, 5, 21, 7, 9, 11, 13, 15, 17, 19));
+}
+
+TYPED_TEST(GenericTreeFixture, aggregates_subtree_sums_in_postorder)
+{
+    // Single postorder pass suffices, as children sums are always known by
+    // the time their parent is visited
+    std::map<int, int> sums;
+    auto postorder = this->sut.postorder();
+
+    for (auto it = postorder.begin(); it != postorder.end(); ++it) {
+        typename TestFixture::IntTree::const_iterator node = it;
+        sums[*it] = *it;
+        for (const auto child : this->sut.children(node)) {
+            sums[*it] += sums[child];
+        }
+    }
+
+    EXPECT_EQ(15, sums[2] + sums[3]);
+    EXPECT_EQ(16, sums[1]);
+    EXPECT_EQ(30, sums[4]);
+    EXPECT_EQ(9, sums[9]);
+}
+
+TYPED_TEST(GenericTreeFixture, parent_of_level_order_iterator)
+{
+    auto level_order = this->sut.level_order();
+    auto it = std::ranges::find(level_order, 7);
+
+    EXPECT_EQ(5, *this->sut.parent(it));
+}
+
+TYPED_TEST(GenericTreeFixture, skips_subtree)
+{
+    const auto& tree = this->sut;
+
+    EXPECT_EQ(3, *tree.skip_subtree(std::ranges::find(tree, 2)));
+    EXPECT_EQ(4, *tree.skip_subtree(std::ranges::find(tree, 1)));
+    EXPECT_EQ(9, *tree.skip_subtree(std::ranges::find(tree, 7)));
+    EXPECT_EQ(9, *tree.skip_subtree(std::ranges::find(tree, 4)));
+    EXPECT_EQ(tree.cend(), tree.skip_subtree(std::ranges::find(tree, 9)));
+    EXPECT_EQ(tree.cend(), tree.skip_subtree(tree.cend()));
+}
+
+TYPED_TEST(GenericTreeFixture, iterates_from_skipped_subtree)
+{
+    std::vector<int> actual;
+
+    for (auto it = this->sut.begin(); it != this->sut.end();) {
+        actual.push_back(*it);
+        it = *it == 5 ? this->sut.skip_subtree(it) : std::next(it);
+    }
+
+    EXPECT_THAT(actual, ElementsAre(1, 2, 10, 3, 4, 5, 9));
+}
+
+TYPED_TEST(GenericTreeFixture, keeps_preorder_after_modifications)
+{
+    auto& tree = this->sut;
+
+    tree.insert(std::ranges::find(tree, 2), 11, DestinationPosition{0});
+    tree.insert(std::ranges::find(tree, 3), 12);
+    tree.move_nodes(std::ranges::find(tree, 5),
+                    SourcePosition{1},
+                    Count{1},
+                    tree.end(),
+                    DestinationPosition{1});
+    tree.erase(std::ranges::find(tree, 2));
+    tree.move_nodes(tree.end(),
+                    SourcePosition{0},
+                    Count{2},
+                    tree.end(),
+                    DestinationPosition{4});
+    tree.insert(tree.end(), 13);
+
+    EXPECT_THAT(tree, ElementsAre(4, 5, 6, 9, 1, 3, 12, 7, 8, 13));
+}
+
+TYPED_TEST(GenericTreeFixture, keeps_positions_in_children_after_modifications)
+{
+    typename TestFixture::IntTree tree;
+    auto root = tree.insert(tree.end(), 0);
+    std::vector<int> payloads(10);
+    std::iota(payloads.begin(), payloads.end(), 1);
+    tree.insert(root, DestinationPosition{0}, payloads);
+
+    tree.insert(root, 11, DestinationPosition{5});
+    tree.erase(std::ranges::find(tree, 2));
+    tree.move_nodes(
+        root, SourcePosition{7}, Count{2}, root, DestinationPosition{1});
+    tree.move_nodes(
+        root, SourcePosition{0}, Count{1}, tree.end(), DestinationPosition{0});
+
+    std::vector<int64_t> positions;
+    std::ranges::transform(tree.children_iterators(root),
+                           std::back_inserter(positions),
+                           [&tree](auto it) {
+                               return tree.position_in_children(it);
+                           });
+
+    const std::vector<int> expected{8, 9, 3, 4, 5, 11, 6, 7, 10};
+    EXPECT_TRUE(std::ranges::equal(expected, tree.children(root)));
+    EXPECT_THAT(positions, ElementsAre(0, 1, 2, 3, 4, 5, 6, 7, 8));
+    EXPECT_EQ(1, tree.position_in_children(std::ranges::find(tree, 0)));
+}
+
 TYPED_TEST(GenericTreeFixture, deep_tree)
 {
     // Test with a deep tree to check for stack overflow in iterator
@@ -1511,6 +1760,48 @@ TYPED_TEST(GenericTreeFixture, flatten_tree)
                             std::nullopt));
 }
 
+TYPED_TEST(GenericTreeFixture, flatten_to_writes_same_sequence_as_flatten)
+{
+    std::vector<std::optional<int>> flattened;
+
+    this->sut.flatten_to(std::back_inserter(flattened));
+
+    EXPECT_EQ(this->sut.flatten(), flattened);
+}
+
+TYPED_TEST(GenericTreeFixture, unflattener_restores_tree_fed_in_chunks)
+{
+    using IntTree = typename TestFixture::IntTree;
+    auto flattened = this->sut.flatten();
+    // Anything past the end of sequence is ignored
+    flattened.push_back(42);
+    typename IntTree::Unflattener unflattener;
+
+    const std::span entries{flattened};
+    for (size_t i{0}; i < entries.size(); i += 4) {
+        const auto count = std::min(entries.size() - i, 4uz);
+        unflattener.push_range(entries.subspan(i, count));
+    }
+
+    EXPECT_TRUE(unflattener.done());
+    EXPECT_EQ(this->sut.flatten(), unflattener.finish().flatten());
+}
+
+TYPED_TEST(GenericTreeFixture, unflattens_tree_from_single_pass_input)
+{
+    using IntTree = typename TestFixture::IntTree;
+    std::istringstream in{"- - 1 4 9 - 2 3 - 5 - - 10 - - 6 7 - - - 8 - -"};
+    auto entries = std::views::istream<std::string>(in) |
+                   std::views::transform([](const std::string& token) {
+                       return token == "-" ? std::nullopt
+                                           : std::optional{std::stoi(token)};
+                   });
+
+    const auto tree = IntTree::from_flattened(entries.begin(), entries.end());
+
+    EXPECT_EQ(this->sut.flatten(), tree.flatten());
+}
+
 TYPED_TEST(GenericTreeFixture, transform_subtree)
 {
     const auto subtree =
@@ -2016,3 +2307,798 @@ TYPED_TEST(GenericTreeFixture, returns_filtered_tree_with_iterator_predicate)
                   return it->id == "1";
               }));
 }
+
+template <typename TreeType> auto make_random_tree(int size) -> TreeType
+{
+    std::mt19937 gen{42};
+    TreeType tree;
+    std::vector<typename TreeType::iterator> nodes;
+    for (int i = 0; i < size; ++i) {
+        std::uniform_int_distribution<int> dist{-1, i - 1};
+        const auto parent = dist(gen);
+        nodes.push_back(tree.insert(
+            parent < 0 ? tree.end() : nodes[static_cast<size_t>(parent)], i));
+    }
+    return tree;
+}
+
+TYPED_TEST(GenericTreeFixture, parallel_for_each_visits_every_node_of_subtree)
+{
+    using IntTree = typename TestFixture::IntTree;
+    for (const unsigned threads : {1U, 3U, 8U}) {
+        const Parallel policy{threads};
+        IntTree tree = this->sut;
+        for_each(policy, tree, std::ranges::find(tree, 5), [](int& val) {
+            val *= val;
+        });
+        std::atomic<int> sum{0};
+        for_each(
+            policy, std::as_const(tree), tree.cend(), [&sum](const int& val) {
+                sum += val;
+            });
+
+        EXPECT_THAT(tree, ElementsAre(1, 2, 10, 3, 4, 25, 36, 49, 64, 9));
+        EXPECT_EQ(203, sum);
+    }
+}
+
+TYPED_TEST(GenericTreeFixture, parallel_find_returns_first_match_in_preorder)
+{
+    using IntTree = typename TestFixture::IntTree;
+    const auto tree = make_random_tree<IntTree>(5000);
+    const auto sequential =
+        std::ranges::find_if(tree, [](int val) { return val % 97 == 96; });
+    auto is_multiple = [](int val) { return val > 0 and val % 500 == 0; };
+    const Parallel policy{4};
+
+    EXPECT_EQ(sequential,
+              find_if(policy, tree, tree.cend(), [](int val) {
+                  return val % 97 == 96;
+              }));
+    EXPECT_EQ(std::ranges::find(tree, 4321),
+              find(policy, tree, tree.cend(), 4321));
+    EXPECT_EQ(tree.cend(), find(policy, tree, tree.cend(), 5000));
+    EXPECT_EQ(std::ranges::find_if(tree, is_multiple),
+              find_if(policy, tree, tree.cend(), is_multiple));
+    EXPECT_EQ(std::ranges::find(this->sut, 8),
+              find(policy, this->sut, std::ranges::find(this->sut, 5), 8));
+    EXPECT_EQ(this->sut.end(),
+              find(policy, this->sut, std::ranges::find(this->sut, 5), 5));
+}
+
+TYPED_TEST(GenericTreeFixture, parallel_filter_matches_sequential_filter)
+{
+    using IntTree = typename TestFixture::IntTree;
+    const auto tree = make_random_tree<IntTree>(5000);
+    auto pred = [](int val) { return val % 7 != 3; };
+    auto it_pred = [&tree](auto it) {
+        return tree.parent(it) == tree.cend() or *it % 2 == 0;
+    };
+
+    for (const unsigned threads : {1U, 2U, 8U}) {
+        const Parallel policy{threads};
+        EXPECT_EQ(filter(tree, pred), filter(policy, tree, pred));
+        EXPECT_EQ(filter_it(tree, it_pred), filter_it(policy, tree, it_pred));
+    }
+}
+
+TYPED_TEST(GenericTreeFixture, parallel_transform_matches_sequential_transform)
+{
+    using IntTree = typename TestFixture::IntTree;
+    const auto tree = make_random_tree<IntTree>(5000);
+    auto func = [](int val) { return std::to_string(val); };
+
+    for (const unsigned threads : {1U, 2U, 8U}) {
+        const Parallel policy{threads};
+        EXPECT_EQ(tree.transform(func), transform(policy, tree, func));
+        EXPECT_EQ(this->empty_tree.transform(func),
+                  transform(policy, this->empty_tree, func));
+    }
+}
+
+TYPED_TEST(GenericTreeFixture,
+           parallel_transform_keeps_layout_of_tree_with_erased_nodes)
+{
+    using IntTree = typename TestFixture::IntTree;
+    auto tree = make_random_tree<IntTree>(5000);
+    for (auto value : {17, 170, 1700}) {
+        tree.erase(std::ranges::find(tree, value));
+    }
+    auto func = [](int val) { return std::to_string(val); };
+
+    for (const unsigned threads : {1U, 4U}) {
+        auto expected = tree.transform(func);
+        auto mapped = tree.transform(Parallel{threads}, func);
+        EXPECT_EQ(expected, mapped);
+        EXPECT_EQ(tree.size(), mapped.size());
+
+        expected.insert(std::ranges::find(expected, "42"), "new");
+        mapped.insert(std::ranges::find(mapped, "42"), "new");
+        EXPECT_EQ(expected, mapped);
+    }
+}
+
+template <typename TreeType> auto image_of(const TreeType& tree)
+{
+    std::stringstream ss;
+    tree.write_image(ss);
+    const auto bytes = ss.str();
+    std::vector<std::byte> image(bytes.size());
+    std::memcpy(image.data(), bytes.data(), bytes.size());
+    return image;
+}
+
+TYPED_TEST(GenericTreeFixture, image_round_trip_restores_tree)
+{
+    using IntTree = typename TestFixture::IntTree;
+    auto tree = make_random_tree<IntTree>(1000);
+    for (auto value : {17, 170}) {
+        tree.erase(std::ranges::find(tree, value));
+    }
+
+    EXPECT_EQ(tree, IntTree::from_image(image_of(tree)));
+    EXPECT_EQ(this->sut, IntTree::from_image(image_of(this->sut)));
+    EXPECT_TRUE(IntTree::from_image(image_of(this->empty_tree)).empty());
+}
+
+TYPED_TEST(GenericTreeFixture, image_view_reads_tree_in_place)
+{
+    const auto image = image_of(this->sut);
+
+    const TreeImageView<int> view{image};
+
+    EXPECT_EQ(10, view.size());
+    EXPECT_THAT(view, ElementsAre(1, 2, 10, 3, 4, 5, 6, 7, 8, 9));
+    EXPECT_TRUE(std::ranges::equal(std::vector{0, 4, 9}, view.roots()));
+    EXPECT_TRUE(std::ranges::equal(std::vector{1, 3}, view.children(0)));
+    EXPECT_TRUE(std::ranges::equal(std::vector{6, 7}, view.children(5)));
+    EXPECT_TRUE(std::ranges::empty(view.children(9)));
+    EXPECT_EQ(7, view.parent(8));
+    EXPECT_EQ(std::nullopt, view.parent(4));
+    EXPECT_EQ(8, view.payload(8));
+    EXPECT_THROW(view.payload(10), std::out_of_range);
+}
+
+TYPED_TEST(GenericTreeFixture, image_readers_reject_invalid_images)
+{
+    using IntTree = typename TestFixture::IntTree;
+    const auto image = image_of(this->sut);
+    auto corrupted = image;
+    corrupted[0] = std::byte{'x'};
+
+    EXPECT_THROW(IntTree::from_image(std::span{image}.first(100)),
+                 std::invalid_argument);
+    EXPECT_THROW(IntTree::from_image(corrupted), std::invalid_argument);
+    EXPECT_THROW(TreeImageView<double>{image}, std::invalid_argument);
+    EXPECT_THROW(TreeImageView<int>{image}.template keys<int>(),
+                 std::invalid_argument);
+}
+
+TYPED_TEST(GenericTreeFixture, parallel_algorithms_rethrow_exceptions)
+{
+    using IntTree = typename TestFixture::IntTree;
+    const auto tree = make_random_tree<IntTree>(1000);
+    auto throwing = [](int val) {
+        if (val == 500) {
+            throw std::runtime_error{"Failed"};
+        }
+        return val;
+    };
+
+    EXPECT_THROW(transform(Parallel{4}, tree, throwing), std::runtime_error);
+    EXPECT_THROW(for_each(Parallel{4}, tree, tree.cend(), throwing),
+                 std::runtime_error);
+}
+
+TYPED_TEST(GenericTreeFixture, answers_lowest_common_ancestor_queries)
+{
+    const auto& tree = this->sut;
+    auto node = [&tree](int payload) {
+        return std::ranges::find(tree, payload);
+    };
+    lca_index index{tree};
+
+    EXPECT_EQ(node(5), index.lca(node(6), node(8)));
+    EXPECT_EQ(node(1), index.lca(node(10), node(3)));
+    EXPECT_EQ(node(4), index.lca(node(8), node(4)));
+    EXPECT_EQ(node(2), index.lca(node(2), node(2)));
+    EXPECT_EQ(tree.end(), index.lca(node(1), node(9)));
+    EXPECT_EQ(tree.end(), index.lca(node(10), node(8)));
+    EXPECT_EQ(tree.end(), index.lca(tree.end(), node(8)));
+}
+
+TYPED_TEST(GenericTreeFixture, answers_depth_and_distance_queries)
+{
+    const auto& tree = this->sut;
+    auto node = [&tree](int payload) {
+        return std::ranges::find(tree, payload);
+    };
+    lca_index index{tree};
+
+    EXPECT_EQ(-1, index.depth(tree.end()));
+    EXPECT_EQ(0, index.depth(node(9)));
+    EXPECT_EQ(2, index.depth(node(10)));
+    EXPECT_EQ(3, index.depth(node(8)));
+
+    EXPECT_EQ(0, index.distance(node(7), node(7)));
+    EXPECT_EQ(1, index.distance(node(7), node(8)));
+    EXPECT_EQ(3, index.distance(node(6), node(8)));
+    EXPECT_EQ(3, index.distance(node(10), node(3)));
+    EXPECT_EQ(4, index.distance(node(10), node(9)));
+    EXPECT_EQ(4, index.distance(node(8), tree.end()));
+}
+
+TYPED_TEST(GenericTreeFixture, lca_index_is_rebuilt_after_invalidation)
+{
+    auto& tree = this->sut;
+    auto node = [&tree](int payload) {
+        return typename TestFixture::IntTree::const_iterator{
+            std::ranges::find(tree, payload)};
+    };
+    lca_index index{std::as_const(tree)};
+    ASSERT_EQ(node(4), index.lca(node(6), node(4)));
+
+    tree.move_nodes(std::ranges::find(tree, 4),
+                    SourcePosition{0},
+                    Count{1},
+                    tree.end(),
+                    DestinationPosition{3});
+    tree.erase(std::ranges::find(tree, 2));
+    index.invalidate();
+
+    EXPECT_EQ(tree.end(), index.lca(node(6), node(4)));
+    EXPECT_EQ(node(5), index.lca(node(6), node(8)));
+    EXPECT_EQ(2, index.depth(node(8)));
+    EXPECT_EQ(1, index.distance(node(1), node(3)));
+}
+
+TYPED_TEST(GenericTreeFixture, lca_index_agrees_with_parent_walk)
+{
+    /* Large enough to span many blocks of the range minimum table. */
+    typename TestFixture::IntTree tree;
+    std::vector<typename TestFixture::IntTree::iterator> nodes;
+    for (int i = 0; i < 2000; ++i) {
+        const auto parent_pos = (i * 7919) % (i / 3 + 1) - 1;
+        nodes.push_back(tree.insert(
+            parent_pos < 0 ? tree.end()
+                           : nodes[static_cast<size_t>(parent_pos)],
+            i));
+    }
+    const auto& const_tree = tree;
+    lca_index index{const_tree};
+
+    auto ancestors = [&const_tree](auto it) {
+        std::vector<decltype(it)> res{it};
+        while (it != const_tree.end()) {
+            it = const_tree.parent(it);
+            res.push_back(it);
+        }
+        return res;
+    };
+
+    for (int i = 0; i < 2000; i += 13) {
+        for (int j = 0; j < 2000; j += 17) {
+            const typename TestFixture::IntTree::const_iterator a{
+                nodes[static_cast<size_t>(i)]};
+            const typename TestFixture::IntTree::const_iterator b{
+                nodes[static_cast<size_t>(j)]};
+            const auto a_path = ancestors(a);
+            const auto b_path = ancestors(b);
+            const auto expected = *std::ranges::find_first_of(a_path, b_path);
+            ASSERT_EQ(expected, index.lca(a, b));
+            EXPECT_EQ(std::ssize(a_path) - 2, index.depth(a));
+        }
+    }
+}
+
+/* Memory resource counting outstanding allocations of upstream resource. */
+class CountingResource : public std::pmr::memory_resource {
+public:
+    int64_t outstanding{0};
+
+private:
+    auto do_allocate(size_t bytes, size_t alignment) -> void* override
+    {
+        ++outstanding;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    auto do_deallocate(void* p, size_t bytes, size_t alignment)
+        -> void override
+    {
+        --outstanding;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    auto do_is_equal(const std::pmr::memory_resource& other) const noexcept
+        -> bool override
+    {
+        return this == &other;
+    }
+};
+
+template <typename TreeType> class PmrTreeFixture : public ::testing::Test {
+public:
+    CountingResource resource;
+    CountingResource other_resource;
+
+    auto make_tree(std::pmr::memory_resource* res) -> TreeType
+    {
+        TreeType tree{res};
+        auto root = tree.insert(tree.end(), "root node with heap allocated id");
+        tree.insert(root, "first child with heap allocated id");
+        tree.insert(root, "second child with heap allocated id");
+        tree.insert(tree.end(), "another root with heap allocated id");
+        return tree;
+    }
+};
+
+using PmrTreeTypes =
+    ::testing::Types<ds::pmr::Tree<std::pmr::string>,
+                     ds::pmr::LinearTree<std::pmr::string>>;
+
+TYPED_TEST_SUITE(PmrTreeFixture, PmrTreeTypes);
+
+TYPED_TEST(PmrTreeFixture, allocates_nodes_and_payloads_from_given_resource)
+{
+    {
+        auto tree = this->make_tree(&this->resource);
+
+        EXPECT_EQ(&this->resource, tree.get_allocator().resource());
+        EXPECT_GT(this->resource.outstanding, 0);
+        for (const auto& payload : tree) {
+            EXPECT_EQ(&this->resource, payload.get_allocator().resource());
+        }
+    }
+    EXPECT_EQ(0, this->resource.outstanding);
+}
+
+TYPED_TEST(PmrTreeFixture, copies_and_moves_follow_allocator_propagation_rules)
+{
+    const auto tree = this->make_tree(&this->resource);
+
+    const TypeParam default_copy{tree};
+    EXPECT_EQ(std::pmr::get_default_resource(),
+              default_copy.get_allocator().resource());
+
+    const TypeParam copy{tree, &this->other_resource};
+    EXPECT_EQ(tree, copy);
+    EXPECT_EQ(&this->other_resource, copy.get_allocator().resource());
+    EXPECT_EQ(&this->other_resource, copy.begin()->get_allocator().resource());
+
+    auto source = this->make_tree(&this->resource);
+    TypeParam moved{std::move(source)};
+    EXPECT_EQ(tree, moved);
+    EXPECT_EQ(&this->resource, moved.get_allocator().resource());
+
+    TypeParam target{&this->other_resource};
+    target = std::move(moved);
+    EXPECT_EQ(tree, target);
+    EXPECT_EQ(&this->other_resource, target.get_allocator().resource());
+    for (const auto& payload : target) {
+        EXPECT_EQ(&this->other_resource, payload.get_allocator().resource());
+    }
+}
+
+TYPED_TEST(PmrTreeFixture, derived_trees_use_resource_of_source_tree)
+{
+    const auto tree = this->make_tree(&this->resource);
+
+    const auto lengths =
+        tree.transform([](const auto& payload) { return payload.size(); });
+    const auto filtered =
+        filter(tree, [](const auto& payload) { return payload[0] != 'a'; });
+
+    EXPECT_EQ(&this->resource, lengths.get_allocator().resource());
+    EXPECT_EQ(&this->resource, filtered.get_allocator().resource());
+    EXPECT_EQ(3, filtered.size());
+}
+
+TYPED_TEST(PmrTreeFixture, parallel_transform_constructs_payloads_from_resource)
+{
+    const auto tree = this->make_tree(&this->resource);
+
+    const auto mapped = tree.transform(
+        Parallel{4}, [](const auto& payload) { return payload + "!"; });
+
+    EXPECT_EQ(tree.transform([](const auto& payload) { return payload + "!"; }),
+              mapped);
+    for (const auto& payload : mapped) {
+        EXPECT_EQ(&this->resource, payload.get_allocator().resource());
+    }
+}
+
+TEST(ArenaTreeTest, trees_sharing_arena_outlive_source_tree)
+{
+    ArenaTree<int> subtree;
+    ArenaTree<std::string> transformed;
+    {
+        ArenaTree<int> tree;
+        auto one = tree.insert(tree.end(), 1);
+        auto two = tree.insert(one, 2);
+        tree.insert(two, 3);
+        tree.insert(one, 4);
+        tree.insert(tree.end(), 5);
+        const ArenaTree<int> copy{tree};
+
+        subtree = tree.take_subtree(two);
+        transformed =
+            tree.transform([](int payload) { return std::to_string(payload); });
+
+        EXPECT_EQ(tree.get_allocator(), subtree.get_allocator());
+        EXPECT_NE(tree.get_allocator(), copy.get_allocator());
+    }
+
+    EXPECT_THAT(std::vector(subtree.begin(), subtree.end()), ElementsAre(2, 3));
+    EXPECT_THAT(std::vector(transformed.begin(), transformed.end()),
+                ElementsAre("1", "4", "5"));
+    subtree.insert(subtree.end(), 6);
+    EXPECT_EQ(3, subtree.size());
+}
+
+class LinearTreeFixture : public ::testing::Test {
+public:
+    /*
+     * 1
+     *   2
+     *     10
+     *   3
+     * 4
+     *   5
+     *     6
+     *     7
+     *       8
+     * 9
+     */
+    LinearTree<int> sut = []() {
+        LinearTree<int> tree;
+        auto one = tree.insert(tree.end(), 1);
+        auto two = tree.insert(one, 2);
+        tree.insert(two, 10);
+        tree.insert(one, 3);
+        auto four = tree.insert(tree.end(), 4);
+        auto five = tree.insert(four, 5);
+        tree.insert(five, 6);
+        auto seven = tree.insert(five, 7);
+        tree.insert(seven, 8);
+        tree.insert(tree.end(), 9);
+        return tree;
+    }();
+
+    auto node(int payload) { return std::ranges::find(sut, payload); }
+};
+
+TEST_F(LinearTreeFixture, answers_ancestor_queries)
+{
+    EXPECT_TRUE(sut.is_ancestor(node(1), node(10)));
+    EXPECT_TRUE(sut.is_ancestor(node(4), node(8)));
+    EXPECT_TRUE(sut.is_ancestor(node(7), node(8)));
+    EXPECT_TRUE(sut.is_ancestor(sut.end(), node(9)));
+    EXPECT_FALSE(sut.is_ancestor(node(1), node(1)));
+    EXPECT_FALSE(sut.is_ancestor(node(10), node(2)));
+    EXPECT_FALSE(sut.is_ancestor(node(2), node(3)));
+    EXPECT_FALSE(sut.is_ancestor(node(4), node(9)));
+    EXPECT_FALSE(sut.is_ancestor(node(9), sut.end()));
+    EXPECT_FALSE(sut.is_ancestor(sut.end(), sut.end()));
+}
+
+TEST_F(LinearTreeFixture, answers_subtree_membership_queries)
+{
+    EXPECT_TRUE(sut.is_in_subtree(node(5), node(5)));
+    EXPECT_TRUE(sut.is_in_subtree(node(5), node(8)));
+    EXPECT_TRUE(sut.is_in_subtree(sut.end(), sut.end()));
+    EXPECT_FALSE(sut.is_in_subtree(node(5), node(4)));
+    EXPECT_FALSE(sut.is_in_subtree(node(5), node(9)));
+}
+
+TEST_F(LinearTreeFixture, returns_subtree_range)
+{
+    const auto& tree = sut;
+
+    EXPECT_THAT(std::vector(tree.subtree_range(node(5)).begin(),
+                            tree.subtree_range(node(5)).end()),
+                ElementsAre(5, 6, 7, 8));
+    EXPECT_THAT(std::vector(tree.subtree_range(node(1)).begin(),
+                            tree.subtree_range(node(1)).end()),
+                ElementsAre(1, 2, 10, 3));
+    EXPECT_EQ(10, std::ranges::distance(tree.subtree_range(tree.end())));
+    EXPECT_EQ(1, std::ranges::distance(sut.subtree_range(node(9))));
+}
+
+TEST_F(LinearTreeFixture, interval_queries_follow_structural_edits)
+{
+    EXPECT_TRUE(sut.is_ancestor(node(4), node(7)));
+
+    sut.move_nodes(
+        node(5), SourcePosition{1}, Count{1}, node(1), DestinationPosition{0});
+    auto eleven = sut.insert(node(8), 11);
+    sut.erase(node(2));
+
+    EXPECT_FALSE(sut.is_ancestor(node(4), node(7)));
+    EXPECT_TRUE(sut.is_ancestor(node(1), eleven));
+    EXPECT_TRUE(sut.is_ancestor(node(7), eleven));
+    EXPECT_EQ(node(3), sut.skip_subtree(node(7)));
+    EXPECT_EQ(sut.end(), sut.skip_subtree(node(9)));
+    EXPECT_EQ(5, std::ranges::distance(sut.subtree_range(node(1))));
+}
+
+TEST_F(LinearTreeFixture, compaction_preserves_tree_and_remaps_nodes)
+{
+    sut.erase(node(2));
+    sut.insert(node(9), 11);
+    sut.erase(node(5));
+    sut.insert(node(3), 12);
+    auto three = node(3);
+    auto nine = node(9);
+    const auto expected = sut;
+
+    const auto remap = sut.compact();
+
+    EXPECT_EQ(expected, sut);
+    EXPECT_EQ(6, sut.size());
+    EXPECT_EQ(3, *sut.relocate(three, remap));
+    EXPECT_EQ(9, *sut.relocate(nine, remap));
+    EXPECT_EQ(sut.end(), sut.relocate(sut.end(), remap));
+    EXPECT_EQ(7, std::ranges::count_if(remap, [](auto i) { return i != -1; }));
+
+    // Already compact tree keeps its numbering
+    const auto identity = sut.compact();
+    EXPECT_EQ(7, std::ssize(identity));
+    EXPECT_TRUE(std::ranges::equal(identity, std::views::iota(0, 7)));
+
+    sut.insert(sut.relocate(nine, remap), 13);
+    EXPECT_THAT(std::vector(sut.begin(), sut.end()),
+                ElementsAre(1, 3, 12, 4, 9, 11, 13));
+}
+
+TEST_F(LinearTreeFixture, compacts_automatically_above_threshold)
+{
+    sut.set_compaction_threshold(0.25);
+    sut.erase(node(10));
+    sut.erase(node(3));
+    auto below_threshold = sut;
+    EXPECT_EQ(11, std::ssize(below_threshold.compact()));
+
+    sut.erase(node(5));
+    EXPECT_THAT(std::vector(sut.begin(), sut.end()), ElementsAre(1, 2, 4, 9));
+    const auto remap = sut.compact();
+    EXPECT_TRUE(std::ranges::equal(remap, std::views::iota(0, 5)));
+}
+
+class PersistentTreeFixture : public ::testing::Test {
+public:
+    /*
+     * 1
+     *   2
+     *     10
+     *   3
+     * 4
+     *   5
+     *     6
+     *     7
+     *       8
+     * 9
+     */
+    PersistentTree<int> sut = []() {
+        PersistentTree<int> tree;
+        auto one = tree.insert(tree.end(), 1);
+        auto two = tree.insert(one, 2);
+        tree.insert(two, 10);
+        one = tree.parent(two);
+        tree.insert(one, 3);
+        auto four = tree.insert(tree.end(), 4);
+        auto five = tree.insert(four, 5);
+        tree.insert(five, 6);
+        auto seven = tree.insert(five, 7);
+        tree.insert(seven, 8);
+        tree.insert(tree.end(), 9);
+        return tree;
+    }();
+
+    auto node(int payload) { return std::ranges::find(sut, payload); }
+
+    static auto payloads(const PersistentTree<int>& tree) -> std::vector<int>
+    {
+        return std::vector(tree.begin(), tree.end());
+    }
+};
+
+TEST_F(PersistentTreeFixture, iterates_in_preorder_in_both_directions)
+{
+    std::vector<int> reversed;
+    for (auto it = sut.end(); it != sut.begin();) {
+        reversed.push_back(*--it);
+    }
+
+    EXPECT_THAT(payloads(sut), ElementsAre(1, 2, 10, 3, 4, 5, 6, 7, 8, 9));
+    EXPECT_THAT(reversed, ElementsAre(9, 8, 7, 6, 5, 4, 3, 10, 2, 1));
+    EXPECT_EQ(10, sut.size());
+    EXPECT_EQ(7, *sut.parent(node(8)));
+    EXPECT_EQ(sut.end(), sut.parent(node(4)));
+    EXPECT_THAT(std::vector(sut.children(node(5)).begin(),
+                            sut.children(node(5)).end()),
+                ElementsAre(6, 7));
+}
+
+TEST_F(PersistentTreeFixture, modifications_do_not_affect_copies)
+{
+    const auto snapshot = sut;
+
+    auto eleven = sut.insert(node(7), 11, DestinationPosition{0});
+    sut.erase(node(2));
+    sut.move_nodes(node(5),
+                   SourcePosition{0},
+                   Count{2},
+                   sut.end(),
+                   DestinationPosition{0});
+
+    EXPECT_EQ(11, *eleven);
+    EXPECT_THAT(payloads(sut), ElementsAre(6, 7, 11, 8, 1, 3, 4, 5, 9));
+    EXPECT_EQ(9, sut.size());
+    EXPECT_THAT(payloads(snapshot),
+                ElementsAre(1, 2, 10, 3, 4, 5, 6, 7, 8, 9));
+    EXPECT_EQ(10, snapshot.size());
+    EXPECT_NE(snapshot, sut);
+}
+
+TEST_F(PersistentTreeFixture, copies_share_unmodified_subtrees)
+{
+    auto copy = sut;
+    EXPECT_EQ(sut, copy);
+
+    copy.insert(copy.parent(std::ranges::find(copy, 8)), 11);
+
+    const auto shared = {1, 2, 10, 3, 6, 9};
+    for (const auto payload : shared) {
+        EXPECT_EQ(&*node(payload), &*std::ranges::find(copy, payload));
+    }
+    const auto copied = {4, 5, 7};
+    for (const auto payload : copied) {
+        EXPECT_NE(&*node(payload), &*std::ranges::find(copy, payload));
+    }
+}
+
+TEST_F(PersistentTreeFixture, moves_nodes_within_same_parent)
+{
+    sut.move_nodes(sut.end(),
+                   SourcePosition{0},
+                   Count{1},
+                   sut.end(),
+                   DestinationPosition{3});
+
+    EXPECT_THAT(payloads(sut), ElementsAre(4, 5, 6, 7, 8, 9, 1, 2, 10, 3));
+}
+
+TEST_F(PersistentTreeFixture, moves_nodes_to_later_sibling_subtree)
+{
+    sut.move_nodes(sut.end(),
+                   SourcePosition{0},
+                   Count{1},
+                   node(7),
+                   DestinationPosition{1});
+
+    EXPECT_THAT(payloads(sut), ElementsAre(4, 5, 6, 7, 8, 1, 2, 10, 3, 9));
+    EXPECT_EQ(10, sut.size());
+}
+
+TEST_F(PersistentTreeFixture, throws_on_invalid_positions)
+{
+    const auto expected = sut;
+
+    EXPECT_THROW(sut.insert(node(2), 11, DestinationPosition{2}),
+                 std::out_of_range);
+    EXPECT_THROW(sut.move_nodes(node(5),
+                                SourcePosition{1},
+                                Count{2},
+                                sut.end(),
+                                DestinationPosition{0}),
+                 std::out_of_range);
+    EXPECT_THROW(sut.move_nodes(sut.end(),
+                                SourcePosition{1},
+                                Count{1},
+                                node(7),
+                                DestinationPosition{0}),
+                 std::invalid_argument);
+    EXPECT_EQ(expected, sut);
+}
+
+TEST_F(PersistentTreeFixture, destroys_deep_tree)
+{
+    PersistentTree<int> tree;
+    tree.insert(tree.end(), 0);
+    // Wrap the whole tree into new top-level node, so that no operation goes
+    // deeper than the top level
+    for (int i = 1; i < 500'000; ++i) {
+        tree.insert(tree.end(), i, DestinationPosition{0});
+        tree.move_nodes(tree.end(),
+                        SourcePosition{1},
+                        Count{1},
+                        tree.begin(),
+                        DestinationPosition{0});
+    }
+
+    EXPECT_EQ(500'000, tree.size());
+    EXPECT_EQ(499'999, *tree.begin());
+    EXPECT_EQ(0, *std::prev(tree.end()));
+}
+
+TEST(ConcurrentTreeTest, snapshots_are_unaffected_by_updates)
+{
+    ConcurrentTree<LinearTree<int>> sut;
+    const auto before = sut.snapshot();
+
+    const auto published = sut.update([](auto& tree) {
+        auto top = tree.insert(tree.end(), 1);
+        tree.insert(top, 2);
+    });
+
+    EXPECT_TRUE(before->empty());
+    EXPECT_EQ(published, sut.snapshot());
+    EXPECT_THAT(std::vector(sut.snapshot()->begin(), sut.snapshot()->end()),
+                ElementsAre(1, 2));
+}
+
+TEST(ConcurrentTreeTest, failed_update_publishes_nothing)
+{
+    LinearTree<int> initial;
+    initial.insert(initial.end(), 1);
+    ConcurrentTree sut{initial};
+    const auto before = sut.snapshot();
+
+    EXPECT_THROW(sut.update([](auto& tree) {
+        tree.insert(tree.end(), 2);
+        throw std::runtime_error{"Rejected"};
+    }),
+                 std::runtime_error);
+
+    EXPECT_EQ(before, sut.snapshot());
+    EXPECT_EQ(initial, *sut.snapshot());
+}
+
+TEST(ConcurrentTreeTest, reader_refreshes_when_new_version_is_published)
+{
+    ConcurrentTree<LinearTree<int>> sut;
+    ConcurrentTree<LinearTree<int>>::Reader reader{sut};
+    const auto* first = &reader.get();
+
+    EXPECT_EQ(first, &reader.get());
+
+    sut.update([](auto& tree) { tree.insert(tree.end(), 1); });
+
+    EXPECT_NE(first, &reader.get());
+    EXPECT_EQ(1, *ds::find(reader.get(), reader.get().cend(), 1));
+}
+
+TEST(ConcurrentTreeTest, readers_see_consistent_versions_while_writer_updates)
+{
+    constexpr int updates{200};
+    ConcurrentTree<LinearTree<int>> sut{[]() {
+        LinearTree<int> tree;
+        tree.insert(tree.end(), 0);
+        return tree;
+    }()};
+
+    auto read = [&sut]() {
+        ConcurrentTree<LinearTree<int>>::Reader reader{sut};
+        for (int last_seen{0}; last_seen < updates;) {
+            const auto& tree = reader.get();
+            // Top-level node holds number of its children
+            const auto top = tree.cbegin();
+            EXPECT_EQ(*top, std::ranges::ssize(tree.children(top)));
+            EXPECT_GE(*top, last_seen);
+            last_seen = *top;
+        }
+    };
+
+    std::vector<std::jthread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back(read);
+    }
+    for (int i = 1; i <= updates; ++i) {
+        sut.update([i](auto& tree) {
+            auto top = tree.begin();
+            tree.insert(top, i);
+            *top = i;
+        });
+    }
+}
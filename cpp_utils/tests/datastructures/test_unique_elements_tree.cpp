@@ -3,6 +3,7 @@
 
 #include <bits/iterator_concepts.h>
 #include <functional>
+#include <string_view>
 
 namespace {
 
@@ -156,6 +157,23 @@ TEST_F(UniqueElementsTreeFixture, flatten_and_unflatten)
     EXPECT_EQ(tree, restored_tree);
 }
 
+TEST_F(UniqueElementsTreeFixture, unflattener_restores_tree_streamed_in_chunks)
+{
+    const auto tree = make_sample_tree();
+    std::vector<std::optional<CompoundType>> flattened;
+    tree.flatten_to(std::back_inserter(flattened));
+    ds::UniqueElementsTree<CompoundType, Selector>::Unflattener unflattener;
+
+    const std::span entries{flattened};
+    for (size_t i{0}; i < entries.size(); i += 3) {
+        const auto count = std::min(entries.size() - i, 3uz);
+        unflattener.push_range(entries.subspan(i, count));
+    }
+
+    EXPECT_TRUE(unflattener.done());
+    EXPECT_EQ(tree, unflattener.finish());
+}
+
 TEST_F(UniqueElementsTreeFixture, const_dfs_iterator)
 {
     auto tree = make_sample_tree();
@@ -205,3 +223,29 @@ TEST_F(UniqueElementsTreeFixture, dfs_iterator)
 
     EXPECT_EQ(expected, dfs_order);
 }
+
+TEST_F(UniqueElementsTreeFixture, copies_are_equal_and_independent)
+{
+    const auto tree = make_sample_tree();
+    auto copy = tree;
+    ds::UniqueElementsTree<CompoundType, Selector> assigned;
+    assigned.add_child(CompoundType{"11", 11});
+    assigned = tree;
+
+    EXPECT_EQ(tree, copy);
+    EXPECT_EQ(tree, assigned);
+    EXPECT_FALSE(assigned.has_key("11"));
+
+    copy.add_child(CompoundType{"11", 11}, "10");
+    EXPECT_TRUE(copy.has_key("11"));
+    EXPECT_FALSE(tree.has_key("11"));
+    EXPECT_THROW(copy.add_child(CompoundType{"6", 6}), ds::UniqueKeyError);
+}
+
+TEST_F(UniqueElementsTreeFixture, looks_up_string_keys_by_string_view)
+{
+    const auto tree = make_sample_tree();
+
+    EXPECT_TRUE(tree.has_key(std::string_view{"10"}));
+    EXPECT_FALSE(tree.has_key(std::string_view{"11"}));
+}